@@ -0,0 +1,65 @@
+#ifndef BACKEND_EPOLL_H
+#define BACKEND_EPOLL_H
+
+// epoll backend (Linux only): the kernel keeps the interest list, so a wakeup costs
+// O(ready) instead of O(registered).
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include "reactor.h"
+
+typedef struct {
+    int epfd;
+    struct epoll_event events[MAX_EVENTS];
+} epoll_be_t;
+
+static inline unsigned epoll_be_mask(unsigned events) {
+    return ((events & EV_READ) ? EPOLLIN : 0) | ((events & EV_WRITE) ? EPOLLOUT : 0);
+}
+
+static inline int epoll_be_init(epoll_be_t* b, int fd_cap) {
+    (void)fd_cap;
+    b->epfd = epoll_create1(EPOLL_CLOEXEC);
+    return b->epfd == -1 ? -1 : 0;
+}
+
+static inline void epoll_be_destroy(epoll_be_t* b) {
+    close(b->epfd);
+}
+
+static inline int epoll_be_add(epoll_be_t* b, int fd, unsigned events) {
+    struct epoll_event ev = { 0 };
+    ev.events             = epoll_be_mask(events);
+    ev.data.fd            = fd;
+    return epoll_ctl(b->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static inline int epoll_be_mod(epoll_be_t* b, int fd, unsigned events) {
+    struct epoll_event ev = { 0 };
+    ev.events             = epoll_be_mask(events);
+    ev.data.fd            = fd;
+    return epoll_ctl(b->epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+static inline void epoll_be_del(epoll_be_t* b, int fd) {
+    epoll_ctl(b->epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static inline int epoll_be_wait(epoll_be_t* b, ev_t* out, int max, int timeout_ms) {
+    if (max > MAX_EVENTS) {
+        max = MAX_EVENTS;
+    }
+    int n = epoll_wait(b->epfd, b->events, max, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        unsigned re   = b->events[i].events;
+        out[i].fd     = b->events[i].data.fd;
+        out[i].events = ((re & EPOLLIN) ? EV_READ : 0) |
+                        ((re & EPOLLOUT) ? EV_WRITE : 0) |
+                        ((re & (EPOLLERR | EPOLLHUP)) ? EV_ERROR : 0);
+    }
+    return n;
+}
+
+#endif
+#endif
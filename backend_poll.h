@@ -0,0 +1,105 @@
+#ifndef BACKEND_POLL_H
+#define BACKEND_POLL_H
+
+// poll() backend: a dense pollfd array that is kept up to date incrementally instead of being
+// rebuilt from clientStates every iteration. fd_index maps fd -> position so removal is a
+// swap with the last entry.
+
+#include <poll.h>
+#include "reactor.h"
+
+typedef struct {
+    struct pollfd* fds;
+    int* fd_index;
+    int nfds;
+    int fd_cap;
+    int cursor; // where the next scan starts, see poll_be_wait
+} poll_be_t;
+
+static inline short poll_be_mask(unsigned events) {
+    return (short)(((events & EV_READ) ? POLLIN : 0) | ((events & EV_WRITE) ? POLLOUT : 0));
+}
+
+static inline int poll_be_init(poll_be_t* b, int fd_cap) {
+    b->fds      = calloc(fd_cap, sizeof(struct pollfd));
+    b->fd_index = malloc(fd_cap * sizeof(int));
+    b->nfds     = 0;
+    b->fd_cap   = fd_cap;
+    b->cursor   = 0;
+    if (b->fds == NULL || b->fd_index == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < fd_cap; i++) {
+        b->fd_index[i] = -1;
+    }
+    return 0;
+}
+
+static inline void poll_be_destroy(poll_be_t* b) {
+    free(b->fds);
+    free(b->fd_index);
+}
+
+static inline int poll_be_add(poll_be_t* b, int fd, unsigned events) {
+    if (fd >= b->fd_cap || b->nfds == b->fd_cap) {
+        errno = EINVAL;
+        return -1;
+    }
+    b->fds[b->nfds].fd      = fd;
+    b->fds[b->nfds].events  = poll_be_mask(events);
+    b->fds[b->nfds].revents = 0;
+    b->fd_index[fd]         = b->nfds++;
+    return 0;
+}
+
+static inline int poll_be_mod(poll_be_t* b, int fd, unsigned events) {
+    int i = b->fd_index[fd];
+    if (i == -1) {
+        errno = ENOENT;
+        return -1;
+    }
+    b->fds[i].events = poll_be_mask(events);
+    return 0;
+}
+
+static inline void poll_be_del(poll_be_t* b, int fd) {
+    int i = b->fd_index[fd];
+    if (i == -1) {
+        return;
+    }
+    int last = --b->nfds;
+    if (i != last) {
+        b->fds[i]                  = b->fds[last];
+        b->fd_index[b->fds[i].fd] = i;
+    }
+    b->fd_index[fd] = -1;
+}
+
+static inline int poll_be_wait(poll_be_t* b, ev_t* out, int max, int timeout_ms) {
+    int ready = poll(b->fds, b->nfds, timeout_ms);
+    if (ready <= 0) {
+        return ready;
+    }
+
+    // resume the scan where the last one stopped, so that when more entries are ready than
+    // fit in out[] the ones at the end of the array are not always the ones left behind
+    int n     = 0;
+    int start = b->cursor < b->nfds ? b->cursor : 0;
+    for (int k = 0; k < b->nfds && n < max && ready > 0; k++) {
+        int i    = start + k < b->nfds ? start + k : start + k - b->nfds;
+        short re = b->fds[i].revents;
+        if (re == 0) {
+            continue;
+        }
+        b->cursor = i + 1;
+        ready--;
+        out[n].fd     = b->fds[i].fd;
+        out[n].events = ((re & POLLIN) ? EV_READ : 0) |
+                        ((re & POLLOUT) ? EV_WRITE : 0) |
+                        ((re & (POLLERR | POLLHUP | POLLNVAL)) ? EV_ERROR : 0);
+        n++;
+    }
+    return n;
+}
+
+#endif
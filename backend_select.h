@@ -0,0 +1,112 @@
+#ifndef BACKEND_SELECT_H
+#define BACKEND_SELECT_H
+
+// select() backend: keeps master fd_sets and copies them into select() every wakeup,
+// then scans 0..maxfd for set bits. O(maxfd) per wakeup and capped at FD_SETSIZE.
+
+#include <sys/select.h>
+#include "reactor.h"
+
+typedef struct {
+    fd_set read_set;
+    fd_set write_set;
+    int maxfd;
+    int cursor; // where the next scan starts, see select_be_wait
+} select_be_t;
+
+static inline int select_be_init(select_be_t* b, int fd_cap) {
+    (void)fd_cap;
+    FD_ZERO(&b->read_set);
+    FD_ZERO(&b->write_set);
+    b->maxfd  = -1;
+    b->cursor = 0;
+    return 0;
+}
+
+static inline void select_be_destroy(select_be_t* b) {
+    (void)b;
+}
+
+static inline int select_be_mod(select_be_t* b, int fd, unsigned events) {
+    if (fd >= FD_SETSIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (events & EV_READ) {
+        FD_SET(fd, &b->read_set);
+    } else {
+        FD_CLR(fd, &b->read_set);
+    }
+    if (events & EV_WRITE) {
+        FD_SET(fd, &b->write_set);
+    } else {
+        FD_CLR(fd, &b->write_set);
+    }
+    // select_be_del shrinks maxfd past fds with no interest left, which may still be
+    // registered and resume later: raise it again whenever an fd wants something
+    if (events != 0 && fd > b->maxfd) {
+        b->maxfd = fd;
+    }
+    return 0;
+}
+
+static inline int select_be_add(select_be_t* b, int fd, unsigned events) {
+    return select_be_mod(b, fd, events);
+}
+
+static inline void select_be_del(select_be_t* b, int fd) {
+    FD_CLR(fd, &b->read_set);
+    FD_CLR(fd, &b->write_set);
+    while (b->maxfd >= 0 &&
+           !FD_ISSET(b->maxfd, &b->read_set) &&
+           !FD_ISSET(b->maxfd, &b->write_set)) {
+        b->maxfd--;
+    }
+}
+
+static inline int select_be_wait(select_be_t* b, ev_t* out, int max, int timeout_ms) {
+    // select overwrites the sets it is given, so it always works on a copy
+    fd_set read_fds  = b->read_set;
+    fd_set write_fds = b->write_set;
+    struct timeval tv;
+    struct timeval* tvp = NULL;
+
+    if (timeout_ms >= 0) {
+        tv.tv_sec  = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        tvp        = &tv;
+    }
+
+    int ready = select(b->maxfd + 1, &read_fds, &write_fds, NULL, tvp);
+    if (ready <= 0) {
+        return ready;
+    }
+
+    // The scan starts where the previous one stopped and wraps around. When more fds are ready
+    // than fit in out[], a scan from 0 would hand out the low fds every time and the high ones
+    // would wait for a wakeup where fewer clients are busy.
+    int n     = 0;
+    int range = b->maxfd + 1;
+    int start = b->cursor < range ? b->cursor : 0;
+    for (int k = 0; k < range && n < max && ready > 0; k++) {
+        int fd          = start + k < range ? start + k : start + k - range;
+        unsigned events = 0;
+        if (FD_ISSET(fd, &read_fds)) {
+            events |= EV_READ;
+            ready--;
+        }
+        if (FD_ISSET(fd, &write_fds)) {
+            events |= EV_WRITE;
+            ready--;
+        }
+        if (events) {
+            out[n].fd     = fd;
+            out[n].events = events;
+            n++;
+            b->cursor = fd + 1;
+        }
+    }
+    return n;
+}
+
+#endif
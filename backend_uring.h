@@ -0,0 +1,300 @@
+#ifndef BACKEND_URING_H
+#define BACKEND_URING_H
+
+// io_uring backend (Linux only), written against the raw syscalls so it needs no liburing.
+//
+// Readiness is reported with one-shot IORING_OP_POLL_ADD requests: each completion is turned
+// into an ev_t and the fd is re-armed at the start of the next wait, so all the re-arms of
+// one iteration go to the kernel in the same io_uring_enter() as the wait itself.
+// Every poll carries (generation << 32 | fd) as user_data; del/mod bump the generation so a
+// completion that was already in flight for an old registration is simply dropped.
+
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <stdint.h>
+#include "reactor.h"
+
+#define URING_ENTRIES 256
+#define URING_CQ_ENTRIES 8192
+#define URING_IGNORE UINT64_MAX
+
+typedef struct {
+    int ring_fd;
+    unsigned features;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe* sqes;
+    unsigned to_submit;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ptr;
+    size_t sq_sz;
+    void* cq_ptr;
+    size_t cq_sz;
+    size_t sqes_sz;
+
+    int fd_cap;
+    unsigned* interest; // 0 means not registered
+    unsigned* gen;
+    unsigned char* armed;
+    int* rearm;
+    int n_rearm;
+} uring_be_t;
+
+static inline int uring_be_enter(uring_be_t* b, unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t argsz) {
+    int ret = (int)syscall(__NR_io_uring_enter, b->ring_fd, to_submit, min_complete, flags, arg, argsz);
+    if (ret >= 0) {
+        b->to_submit -= (unsigned)ret < to_submit ? (unsigned)ret : to_submit;
+    }
+    return ret;
+}
+
+static inline int uring_be_init(uring_be_t* b, int fd_cap) {
+    struct io_uring_params p;
+
+    memset(b, 0, sizeof(*b));
+    memset(&p, 0, sizeof(p));
+    p.flags      = IORING_SETUP_CQSIZE;
+    p.cq_entries = URING_CQ_ENTRIES;
+
+    b->ring_fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (b->ring_fd == -1) {
+        return -1;
+    }
+    b->features = p.features;
+
+    b->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    b->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (b->cq_sz > b->sq_sz) {
+            b->sq_sz = b->cq_sz;
+        }
+        b->cq_sz = b->sq_sz;
+    }
+
+    b->sq_ptr = mmap(NULL, b->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, b->ring_fd, IORING_OFF_SQ_RING);
+    if (b->sq_ptr == MAP_FAILED) {
+        goto fail_sq;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        b->cq_ptr = b->sq_ptr;
+    } else {
+        b->cq_ptr = mmap(NULL, b->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, b->ring_fd, IORING_OFF_CQ_RING);
+        if (b->cq_ptr == MAP_FAILED) {
+            goto fail_cq;
+        }
+    }
+    b->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    b->sqes    = mmap(NULL, b->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, b->ring_fd, IORING_OFF_SQES);
+    if (b->sqes == MAP_FAILED) {
+        goto fail_sqes;
+    }
+
+    char* sq         = b->sq_ptr;
+    char* cq         = b->cq_ptr;
+    b->sq_head       = (unsigned*)(sq + p.sq_off.head);
+    b->sq_tail       = (unsigned*)(sq + p.sq_off.tail);
+    b->sq_mask       = (unsigned*)(sq + p.sq_off.ring_mask);
+    b->sq_array      = (unsigned*)(sq + p.sq_off.array);
+    b->sq_entries    = p.sq_entries;
+    b->cq_head       = (unsigned*)(cq + p.cq_off.head);
+    b->cq_tail       = (unsigned*)(cq + p.cq_off.tail);
+    b->cq_mask       = (unsigned*)(cq + p.cq_off.ring_mask);
+    b->cqes          = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    b->fd_cap   = fd_cap;
+    b->interest = calloc(fd_cap, sizeof(unsigned));
+    b->gen      = calloc(fd_cap, sizeof(unsigned));
+    b->armed    = calloc(fd_cap, 1);
+    b->rearm    = malloc(fd_cap * sizeof(int));
+    if (b->interest == NULL || b->gen == NULL || b->armed == NULL || b->rearm == NULL) {
+        goto fail_arrays;
+    }
+    return 0;
+
+    // each label undoes the steps that succeeded before the one that failed
+fail_arrays:
+    free(b->interest);
+    free(b->gen);
+    free(b->armed);
+    free(b->rearm);
+    munmap(b->sqes, b->sqes_sz);
+fail_sqes:
+    if (b->cq_ptr != b->sq_ptr) {
+        munmap(b->cq_ptr, b->cq_sz);
+    }
+fail_cq:
+    munmap(b->sq_ptr, b->sq_sz);
+fail_sq:
+    close(b->ring_fd);
+    b->ring_fd = -1;
+    return -1;
+}
+
+static inline void uring_be_destroy(uring_be_t* b) {
+    munmap(b->sqes, b->sqes_sz);
+    if (b->cq_ptr != b->sq_ptr) {
+        munmap(b->cq_ptr, b->cq_sz);
+    }
+    munmap(b->sq_ptr, b->sq_sz);
+    close(b->ring_fd);
+    free(b->interest);
+    free(b->gen);
+    free(b->armed);
+    free(b->rearm);
+}
+
+static inline struct io_uring_sqe* uring_be_get_sqe(uring_be_t* b) {
+    unsigned tail = *b->sq_tail;
+    unsigned head = __atomic_load_n(b->sq_head, __ATOMIC_ACQUIRE);
+
+    if (tail - head == b->sq_entries) {
+        // submission queue full: hand what we have to the kernel without waiting
+        uring_be_enter(b, b->to_submit, 0, 0, NULL, 0);
+        head = __atomic_load_n(b->sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head == b->sq_entries) {
+            return NULL;
+        }
+    }
+
+    unsigned idx             = tail & *b->sq_mask;
+    struct io_uring_sqe* sqe = &b->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    b->sq_array[idx] = idx;
+    __atomic_store_n(b->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    b->to_submit++;
+    return sqe;
+}
+
+static inline uint64_t uring_be_tag(uring_be_t* b, int fd) {
+    return ((uint64_t)b->gen[fd] << 32) | (uint32_t)fd;
+}
+
+static inline int uring_be_arm(uring_be_t* b, int fd) {
+    struct io_uring_sqe* sqe = uring_be_get_sqe(b);
+    if (sqe == NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = fd;
+    sqe->poll32_events = ((b->interest[fd] & EV_READ) ? POLLIN : 0) |
+                         ((b->interest[fd] & EV_WRITE) ? POLLOUT : 0);
+    sqe->user_data     = uring_be_tag(b, fd);
+    b->armed[fd]       = 1;
+    return 0;
+}
+
+static inline void uring_be_disarm(uring_be_t* b, int fd) {
+    if (b->armed[fd]) {
+        struct io_uring_sqe* sqe = uring_be_get_sqe(b);
+        if (sqe != NULL) {
+            sqe->opcode    = IORING_OP_POLL_REMOVE;
+            sqe->fd        = -1;
+            sqe->addr      = uring_be_tag(b, fd);
+            sqe->user_data = URING_IGNORE;
+        }
+        b->armed[fd] = 0;
+    }
+    b->gen[fd]++;
+}
+
+static inline int uring_be_add(uring_be_t* b, int fd, unsigned events) {
+    if (fd >= b->fd_cap) {
+        errno = EINVAL;
+        return -1;
+    }
+    b->gen[fd]++;
+    b->interest[fd] = events;
+    return uring_be_arm(b, fd);
+}
+
+static inline int uring_be_mod(uring_be_t* b, int fd, unsigned events) {
+    uring_be_disarm(b, fd);
+    b->interest[fd] = events;
+    return uring_be_arm(b, fd);
+}
+
+static inline void uring_be_del(uring_be_t* b, int fd) {
+    uring_be_disarm(b, fd);
+    b->interest[fd] = 0;
+}
+
+static inline int uring_be_wait(uring_be_t* b, ev_t* out, int max, int timeout_ms) {
+    for (int i = 0; i < b->n_rearm; i++) {
+        int fd = b->rearm[i];
+        if (b->interest[fd] != 0 && !b->armed[fd]) {
+            uring_be_arm(b, fd);
+        }
+    }
+    b->n_rearm = 0;
+
+    unsigned flags = IORING_ENTER_GETEVENTS;
+    unsigned min   = timeout_ms == 0 ? 0 : 1;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    void* argp   = NULL;
+    size_t argsz = 0;
+
+    if (timeout_ms > 0 && (b->features & IORING_FEAT_EXT_ARG)) {
+        memset(&arg, 0, sizeof(arg));
+        ts.tv_sec  = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        arg.ts     = (uint64_t)(uintptr_t)&ts;
+        argp       = &arg;
+        argsz      = sizeof(arg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+
+    // only block when nothing is already sitting in the completion queue
+    if (__atomic_load_n(b->cq_tail, __ATOMIC_ACQUIRE) != *b->cq_head) {
+        min = 0;
+    }
+    if (uring_be_enter(b, b->to_submit, min, flags, argp, argsz) == -1 && errno != ETIME) {
+        return -1;
+    }
+
+    int n         = 0;
+    unsigned head = *b->cq_head;
+    unsigned tail = __atomic_load_n(b->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail && n < max) {
+        struct io_uring_cqe* cqe = &b->cqes[head & *b->cq_mask];
+        head++;
+
+        if (cqe->user_data == URING_IGNORE) {
+            continue;
+        }
+        int fd       = (int)(uint32_t)cqe->user_data;
+        unsigned gen = (unsigned)(cqe->user_data >> 32);
+        if (fd < 0 || fd >= b->fd_cap || gen != b->gen[fd]) {
+            continue; // completion for a registration that no longer exists
+        }
+        b->armed[fd] = 0;
+        if (cqe->res < 0) {
+            continue;
+        }
+        out[n].fd     = fd;
+        out[n].events = ((cqe->res & POLLIN) ? EV_READ : 0) |
+                        ((cqe->res & POLLOUT) ? EV_WRITE : 0) |
+                        ((cqe->res & (POLLERR | POLLHUP)) ? EV_ERROR : 0);
+        n++;
+        b->rearm[b->n_rearm++] = fd;
+    }
+    __atomic_store_n(b->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+#endif
+#endif
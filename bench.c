@@ -0,0 +1,535 @@
+// Microbenchmarks of the reactor's hot-path primitives: slot allocation, fd -> slot lookup,
+// frame header encode / decode, frame parsing, output queue append / consume / flush, the
+// buffer pool, the store's lookup, histogram recording and the loop clock.
+//
+// Each case runs in batches sized to take about -m milliseconds, -r times after a warm-up
+// batch, the cases taking turns. The report gives the median time per operation and the
+// median absolute deviation (MAD) around it; the median is not moved by the odd preempted
+// batch the way a mean is. -o writes the results as JSON, and -b compares against such a
+// file. A case is flagged when its median is slower than the baseline's by more than -t
+// percent (10), by more than three MADs of either run and by at least BENCH_FLOOR_NS, since
+// cases that take a nanosecond or less move by more than their MAD between processes. The
+// exit status is then 1, so a script can gate on it.
+//
+//     cc -O2 -pthread bench.c -o bench
+//     ./bench -o baseline.json           # on the old build
+//     ./bench -b baseline.json           # on the new one; ./bench outq runs the matching cases only
+//
+// Pinning to a quiet CPU (-c) and a fixed clock speed make the numbers comparable between
+// runs; comparing across machines means nothing.
+
+#include "reactor.h"
+#include "kv.h"
+#include "hist.h"
+#include <sched.h>
+
+#define BENCH_MAX_CASES 32
+#define BENCH_MAX_RUNS 101
+#define SLOTS 1024
+#define PAYLOAD 64
+#define BENCH_FLOOR_NS 0.5
+
+// reactor.h's hooks; nothing here runs a loop
+static int reactor_dispatch(reactor_t* r, int slot, const proto_frame_t* frame) {
+    (void)r;
+    (void)slot;
+    (void)frame;
+    return 0;
+}
+
+static char* reactor_payload_buffer(reactor_t* r, int slot, proto_type_e type, size_t len) {
+    (void)r;
+    (void)slot;
+    (void)type;
+    (void)len;
+    return NULL;
+}
+
+static void reactor_on_close(reactor_t* r, int slot) {
+    (void)r;
+    (void)slot;
+}
+
+__attribute__((unused)) static int reactor_on_iteration(reactor_t* r) {
+    (void)r;
+    return -1;
+}
+
+static int reactor_on_chunk(reactor_t* r, int slot, const proto_chunk_t* chunk) {
+    (void)r;
+    (void)slot;
+    (void)chunk;
+    return 0;
+}
+
+typedef struct {
+    const char* path;     // -o
+    const char* baseline; // -b
+    double threshold;     // percent
+    int runs;
+    int batch_ms;
+    int cpu;
+    const char* filter;
+} options_t;
+
+// shared state the cases work on, built once
+typedef struct {
+    reactor_t r;
+    int devnull;
+    int fds[4096]; // open fds in random order, for lookups
+    char frames[64 * 1024];
+    size_t frames_len;
+    int n_frames;
+    char payload[PAYLOAD];
+    kv_t kv;
+    char keys[4096][16];
+    hist_t hist;
+} bench_t;
+
+// Runs n operations, returns something derived from them so nothing is optimized away.
+typedef uint64_t (*case_fn)(bench_t* b, long n);
+
+static volatile uint64_t sink;
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// ---- cases ---------------------------------------------------------------------------------
+
+// one op: take a slot off the free stack and give it back, 64 held at a time like a burst of
+// accepts followed by the closes
+static uint64_t case_slot_alloc(bench_t* b, long n) {
+    reactor_t* r = &b->r;
+    int held[64];
+    uint64_t acc = 0;
+
+    for (long i = 0; i < n; i += 64) {
+        for (int k = 0; k < 64; k++) {
+            held[k] = find_free_slot(r);
+            acc += (uint64_t)held[k];
+        }
+        for (int k = 63; k >= 0; k--) {
+            r->free_slots[r->n_free++] = held[k];
+        }
+    }
+    return acc;
+}
+
+static uint64_t case_fd_lookup(bench_t* b, long n) {
+    uint64_t acc = 0;
+
+    for (long i = 0; i < n; i++) {
+        acc += (uint64_t)find_slot_by_fd(&b->r, b->fds[i & 4095]);
+    }
+    return acc;
+}
+
+static uint64_t case_hdr_encode(bench_t* b, long n) {
+    char hdr[PROTO_HDR_SIZE];
+    uint64_t acc = 0;
+
+    (void)b;
+    for (long i = 0; i < n; i++) {
+        proto_encode_hdr(hdr, PROTO_DATA, (size_t)i & 0xfffff);
+        acc += (uint64_t)hdr[5];
+    }
+    return acc;
+}
+
+static uint64_t case_hdr_decode(bench_t* b, long n) {
+    proto_frame_t f = { 0 };
+    uint64_t acc = 0;
+
+    for (long i = 0; i < n; i++) {
+        // a header whose frame is not all there yet: only the header is looked at
+        acc += proto_parse(b->frames, PROTO_HDR_SIZE + (size_t)(i & 7), &f) + f.len;
+    }
+    return acc;
+}
+
+// one op: one frame out of a buffer of back-to-back 64-byte frames
+static uint64_t case_frame_parse(bench_t* b, long n) {
+    proto_frame_t f = { 0 };
+    uint64_t acc = 0;
+    size_t off   = 0;
+
+    for (long i = 0; i < n; i++) {
+        size_t used = proto_parse(b->frames + off, b->frames_len - off, &f);
+        acc += (uint64_t)f.type + (uint64_t)(unsigned char)f.payload[0];
+        off += used;
+        if (off == b->frames_len) {
+            off = 0;
+        }
+    }
+    return acc;
+}
+
+// one op: queue one reply (header + 64 bytes) through reactor_send_frame; the queue is drained
+// without a syscall every 256 replies
+static uint64_t case_send_frame(bench_t* b, long n) {
+    reactor_t* r     = &b->r;
+    clientstate_t* c = &r->clients[0];
+
+    for (long i = 0; i < n; i++) {
+        reactor_send_frame(r, 0, PROTO_DATA, b->payload, PAYLOAD);
+        if ((i & 255) == 255) {
+            reactor_tx_drained(r, c->tx.bytes);
+            outq_consume(&c->tx, &r->pool, c->tx.bytes);
+            c->dirty   = 0;
+            r->n_dirty = 0;
+        }
+    }
+    uint64_t left = c->tx.bytes;
+    reactor_tx_drained(r, c->tx.bytes);
+    outq_clear(&c->tx, &r->pool);
+    c->dirty   = 0;
+    r->n_dirty = 0;
+    return left;
+}
+
+// one op: one queued 72-byte reply, appended and then written out by outq_writev (to
+// /dev/null) in batches of 256, so the writev is shared the way the deferred flush shares it
+static uint64_t case_outq_flush(bench_t* b, long n) {
+    reactor_t* r  = &b->r;
+    outq_t* q     = &r->clients[1].tx;
+    char hdr[PROTO_HDR_SIZE];
+    uint64_t acc  = 0;
+    size_t offered;
+
+    proto_encode_hdr(hdr, PROTO_DATA, PAYLOAD);
+    for (long i = 0; i < n; i++) {
+        outq_append(q, &r->pool, hdr, sizeof(hdr));
+        outq_append(q, &r->pool, b->payload, PAYLOAD);
+        if ((i & 255) == 255 || i == n - 1) {
+            while (q->bytes > 0) {
+                ssize_t w = outq_writev(q, &r->pool, b->devnull, q->bytes, &offered);
+                if (w <= 0) {
+                    outq_clear(q, &r->pool);
+                    break;
+                }
+                acc += (uint64_t)w;
+            }
+        }
+    }
+    return acc;
+}
+
+static uint64_t case_bufpool(bench_t* b, long n) {
+    uint64_t acc = 0;
+
+    for (long i = 0; i < n; i++) {
+        char* p = bufpool_get(&b->r.pool, RX_DIRECT_MIN);
+        acc += (uint64_t)(uintptr_t)p;
+        bufpool_put(&b->r.pool, p, RX_DIRECT_MIN);
+    }
+    return acc;
+}
+
+static uint64_t case_kv_get(bench_t* b, long n) {
+    uint64_t acc = 0;
+
+    for (long i = 0; i < n; i++) {
+        const kv_rec_t* rec = kv_get(&b->kv, b->keys[(size_t)i & 4095], 9);
+        acc += rec != NULL ? rec->vlen : 0;
+    }
+    return acc;
+}
+
+static uint64_t case_hist_record(bench_t* b, long n) {
+    for (long i = 0; i < n; i++) {
+        hist_record(&b->hist, (uint64_t)i * 2654435761u >> 12);
+    }
+    return b->hist.total;
+}
+
+static uint64_t case_clk_now(bench_t* b, long n) {
+    uint64_t acc = 0;
+
+    (void)b;
+    clk_tick();
+    for (long i = 0; i < n; i++) {
+        acc += clk_now();
+    }
+    return acc;
+}
+
+static uint64_t case_clk_read(bench_t* b, long n) {
+    uint64_t acc = 0;
+
+    (void)b;
+    for (long i = 0; i < n; i++) {
+        acc += clk_read();
+    }
+    return acc;
+}
+
+static const struct {
+    const char* name;
+    case_fn fn;
+} cases[] = {
+    { "slot_alloc_free", case_slot_alloc },
+    { "fd_lookup", case_fd_lookup },
+    { "hdr_encode", case_hdr_encode },
+    { "hdr_decode", case_hdr_decode },
+    { "frame_parse", case_frame_parse },
+    { "send_frame", case_send_frame },
+    { "outq_append_flush", case_outq_flush },
+    { "bufpool_get_put", case_bufpool },
+    { "kv_get", case_kv_get },
+    { "hist_record", case_hist_record },
+    { "clk_now", case_clk_now },
+    { "clk_read", case_clk_read },
+};
+
+#define N_CASES ((int)(sizeof(cases) / sizeof(cases[0])))
+
+static int bench_init(bench_t* b) {
+    memset(b, 0, sizeof(*b));
+    if (init_clients(&b->r, SLOTS) == -1 || (b->devnull = open("/dev/null", O_WRONLY | O_CLOEXEC)) == -1) {
+        return -1;
+    }
+
+    // slots 0..SLOTS/2 connected on made-up fds, looked up in random order
+    for (int i = 0; i < SLOTS / 2; i++) {
+        int slot  = find_free_slot(&b->r);
+        int fd    = 16 + i * 2;
+        if (fd >= b->r.fd_cap) {
+            return -1;
+        }
+        b->r.clients[slot].fd    = fd;
+        b->r.clients[slot].state = STATE_CONNECTED;
+        b->r.fd_slot[fd]         = slot;
+    }
+    for (int i = 0; i < 4096; i++) {
+        b->fds[i] = 16 + (int)(rng() % (SLOTS / 2)) * 2;
+    }
+
+    memset(b->payload, 'x', sizeof(b->payload));
+    while (b->frames_len + PROTO_HDR_SIZE + PAYLOAD <= sizeof(b->frames)) {
+        proto_encode_hdr(b->frames + b->frames_len, PROTO_DATA, PAYLOAD);
+        memcpy(b->frames + b->frames_len + PROTO_HDR_SIZE, b->payload, PAYLOAD);
+        b->frames_len += PROTO_HDR_SIZE + PAYLOAD;
+        b->n_frames++;
+    }
+
+    if (kv_init(&b->kv, 0) == -1) {
+        return -1;
+    }
+    for (int i = 0; i < 100000; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "key%06d", i);
+        if (kv_set(&b->kv, key, 9, b->payload, PAYLOAD) == -1) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < 4096; i++) {
+        snprintf(b->keys[i], sizeof(b->keys[i]), "key%06d", (int)(rng() % 100000));
+    }
+    return 0;
+}
+
+typedef struct {
+    const char* name;
+    int index; // into cases[]
+    long n;    // operations per batch
+    double t[BENCH_MAX_RUNS];
+    double median; // ns per op
+    double mad;
+    double min;
+    int runs;
+} result_t;
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double median(double* v, int n) {
+    qsort(v, (size_t)n, sizeof(double), cmp_double);
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static double run_once(bench_t* b, case_fn fn, long n) {
+    uint64_t t0 = clk_gettime(CLOCK_MONOTONIC);
+    sink        = fn(b, n);
+    return (double)(clk_gettime(CLOCK_MONOTONIC) - t0) / (double)n;
+}
+
+// grow the batch until it takes batch_ms, which also warms caches and the branch predictor
+static void calibrate(bench_t* b, const options_t* o, result_t* res) {
+    res->n = 64;
+    while (run_once(b, cases[res->index].fn, res->n) * (double)res->n < o->batch_ms * 1e6 && res->n < (1L << 40)) {
+        res->n *= 2;
+    }
+}
+
+static void summarize(result_t* res) {
+    double dev[BENCH_MAX_RUNS];
+
+    res->median = median(res->t, res->runs);
+    res->min    = res->t[0];
+    for (int k = 0; k < res->runs; k++) {
+        dev[k] = res->t[k] > res->median ? res->t[k] - res->median : res->median - res->t[k];
+    }
+    res->mad = median(dev, res->runs);
+}
+
+static int write_json(const char* path, const result_t* res, int n) {
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    fprintf(f, "{\n  \"unit\": \"ns/op\",\n  \"cases\": {\n");
+    for (int i = 0; i < n; i++) {
+        fprintf(f, "    \"%s\": {\"median\": %.3f, \"mad\": %.3f, \"min\": %.3f, \"runs\": %d}%s\n",
+            res[i].name,
+            res[i].median,
+            res[i].mad,
+            res[i].min,
+            res[i].runs,
+            i + 1 < n ? "," : "");
+    }
+    fprintf(f, "  }\n}\n");
+    return fclose(f);
+}
+
+// Reads back what write_json wrote: one case per line.
+static int read_json(const char* path, result_t* res, char names[][64]) {
+    char line[512];
+    int n = 0;
+
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL && n < BENCH_MAX_CASES) {
+        if (sscanf(line, " \"%63[^\"]\": {\"median\": %lf, \"mad\": %lf, \"min\": %lf, \"runs\": %d", names[n],
+                &res[n].median, &res[n].mad, &res[n].min, &res[n].runs) == 5) {
+            res[n].name = names[n];
+            n++;
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-r runs] [-m batch_ms] [-c cpu] [-o out.json] [-b baseline.json [-t percent]] [case...]\n",
+        prog);
+}
+
+int main(int argc, char** argv) {
+    options_t o = { NULL, NULL, 10.0, 21, 10, -1, NULL };
+    static bench_t b;
+    result_t res[BENCH_MAX_CASES], base[BENCH_MAX_CASES];
+    char base_names[BENCH_MAX_CASES][64];
+    int n_base     = 0;
+    int n_res      = 0;
+    int regressed  = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:m:c:o:b:t:h")) != -1) {
+        switch (opt) {
+        case 'r':
+            o.runs = atoi(optarg);
+            break;
+        case 'm':
+            o.batch_ms = atoi(optarg);
+            break;
+        case 'c':
+            o.cpu = atoi(optarg);
+            break;
+        case 'o':
+            o.path = optarg;
+            break;
+        case 'b':
+            o.baseline = optarg;
+            break;
+        case 't':
+            o.threshold = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (o.runs < 3 || o.runs > BENCH_MAX_RUNS || o.batch_ms < 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+#ifdef __linux__
+    if (o.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(o.cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+            perror("sched_setaffinity");
+        }
+    }
+#endif
+    if (clk_init("auto") == -1 || bench_init(&b) == -1) {
+        perror("bench setup");
+        exit(EXIT_FAILURE);
+    }
+    if (o.baseline != NULL && (n_base = read_json(o.baseline, base, base_names)) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%-20s %10s %8s %10s", "case", "ns/op", "mad", "min");
+    if (n_base > 0) {
+        printf(" %10s %8s", "baseline", "change");
+    }
+    printf("\n");
+    for (int i = 0; i < N_CASES; i++) {
+        // names on the command line pick cases by substring
+        int wanted = optind == argc;
+        for (int a = optind; a < argc; a++) {
+            wanted |= strstr(cases[i].name, argv[a]) != NULL;
+        }
+        if (wanted) {
+            res[n_res].name  = cases[i].name;
+            res[n_res].index = i;
+            res[n_res].runs  = o.runs;
+            calibrate(&b, &o, &res[n_res++]);
+        }
+    }
+    // Run k of every case before run k + 1 of any: a stretch where the machine is slow, a
+    // frequency change or a noisy neighbour, lands on all cases instead of skewing one.
+    for (int k = 0; k < o.runs; k++) {
+        for (int i = 0; i < n_res; i++) {
+            res[i].t[k] = run_once(&b, cases[res[i].index].fn, res[i].n);
+        }
+    }
+
+    for (int i = 0; i < n_res; i++) {
+        result_t* r = &res[i];
+        summarize(r);
+        printf("%-20s %10.2f %8.2f %10.2f", r->name, r->median, r->mad, r->min);
+
+        for (int k = 0; k < n_base; k++) {
+            if (strcmp(base[k].name, r->name) != 0) {
+                continue;
+            }
+            double change = (r->median - base[k].median) / base[k].median * 100;
+            double noise  = 3 * (r->mad > base[k].mad ? r->mad : base[k].mad);
+            noise         = noise > BENCH_FLOOR_NS ? noise : BENCH_FLOOR_NS;
+            int slower    = change > o.threshold && r->median - base[k].median > noise;
+            printf(" %10.2f %+7.1f%%%s", base[k].median, change, slower ? "  REGRESSED" : "");
+            regressed |= slower;
+        }
+        printf("\n");
+    }
+    if (o.path != NULL && write_json(o.path, res, n_res) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    return regressed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+// Power-of-two size-class buffer pool for frame payloads.
+//
+// Freed buffers go on a per-class free list (the list link lives inside the free buffer
+// itself) so a steady stream of large frames stops hitting malloc once the pool is warm.
+// Requests above the largest class fall through to plain malloc/free.
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#define BUFPOOL_MIN_SHIFT 12 // 4 KiB
+#define BUFPOOL_MAX_SHIFT 20 // 1 MiB
+#define BUFPOOL_CLASSES (BUFPOOL_MAX_SHIFT - BUFPOOL_MIN_SHIFT + 1)
+#define BUFPOOL_MAX_CACHED 64 // per class, anything beyond that is given back to malloc
+
+typedef struct bufpool_node {
+    struct bufpool_node* next;
+} bufpool_node_t;
+
+typedef struct {
+    bufpool_node_t* free_list[BUFPOOL_CLASSES];
+    int n_cached[BUFPOOL_CLASSES];
+} bufpool_t;
+
+// size class for len, or -1 when len is too big to be pooled
+static inline int bufpool_class(size_t len) {
+    int c = 0;
+    while (((size_t)1 << (BUFPOOL_MIN_SHIFT + c)) < len) {
+        if (++c == BUFPOOL_CLASSES) {
+            return -1;
+        }
+    }
+    return c;
+}
+
+static inline void* bufpool_get(bufpool_t* pool, size_t len) {
+    int c = bufpool_class(len);
+    if (c == -1) {
+        return malloc(len);
+    }
+    bufpool_node_t* node = pool->free_list[c];
+    if (node != NULL) {
+        pool->free_list[c] = node->next;
+        pool->n_cached[c]--;
+        return node;
+    }
+    return malloc((size_t)1 << (BUFPOOL_MIN_SHIFT + c));
+}
+
+// len must be the length the buffer was requested with
+static inline void bufpool_put(bufpool_t* pool, void* buf, size_t len) {
+    int c = bufpool_class(len);
+    if (c == -1 || pool->n_cached[c] == BUFPOOL_MAX_CACHED) {
+        free(buf);
+        return;
+    }
+    bufpool_node_t* node = buf;
+    node->next           = pool->free_list[c];
+    pool->free_list[c]   = node;
+    pool->n_cached[c]++;
+}
+
+static inline void bufpool_destroy(bufpool_t* pool) {
+    for (int c = 0; c < BUFPOOL_CLASSES; c++) {
+        while (pool->free_list[c] != NULL) {
+            bufpool_node_t* node = pool->free_list[c];
+            pool->free_list[c]   = node->next;
+            free(node);
+        }
+        pool->n_cached[c] = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+// Traffic capture (reactor.c's -Q path): every frame the server receives, with its arrival
+// time and connection, goes into one memory-mapped file that replay.c plays back against any
+// server.
+//
+// The file is created at its full size (sparse until written) and mapped shared. Loops never
+// write to the same place: each claims CAP_CHUNK bytes at a time with one atomic add on the
+// header's `used` and fills its chunk with plain stores, so there is no lock and one atomic per
+// chunk of traffic. What a loop leaves of a chunk stays zero, and readers skip from a zero
+// record to the next chunk. Once the file is full capture stops, counting what it drops.
+//
+// Records follow the order chunks were claimed in, so they are in time order per loop only;
+// the reader sorts them. A frame is kept whole, header and payload, except one streamed to
+// reactor_on_chunk (RX_STREAM_MIN and up), which is kept as its header and replayed as zeros.
+// Host byte order, the capture is meant to be replayed on the machine that took it.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "proto.h"
+#include "clock.h"
+
+#define CAP_MAGIC "NETCAP01"
+#define CAP_HDR_SIZE 4096 // chunks start page aligned
+#define CAP_CHUNK (64 * 1024)
+
+enum { CAP_PAD, CAP_OPEN, CAP_FRAME, CAP_CLOSE };
+
+typedef struct {
+    char magic[8];
+    uint32_t chunk;
+    uint32_t loops;
+    uint64_t start_ns; // wall clock when the capture began, record times count from there
+    uint64_t capacity; // bytes of records the file has room for
+    uint64_t used;     // bytes claimed, atomically; may overshoot capacity once full
+    uint64_t dropped;  // records that found the file full
+    uint32_t next_conn;
+} cap_hdr_t;
+
+typedef struct {
+    uint64_t t_ns; // since the capture began
+    uint32_t conn; // numbered from 1 across all loops
+    uint16_t kind;
+    uint16_t loop;
+    uint32_t len;       // bytes after the record: the frame as received, or its header alone
+    uint32_t frame_len; // payload length of the frame
+} cap_rec_t;
+
+// the file, shared by every loop
+typedef struct {
+    int fd;
+    cap_hdr_t* hdr;
+    char* base;
+    size_t map_len;
+    uint64_t origin_ns; // clk_read() at start_ns
+} cap_file_t;
+
+// one loop's writer, only ever touched by that loop's thread
+typedef struct {
+    cap_file_t* f;
+    char* pos; // free space left in the loop's current chunk
+    char* end;
+    uint32_t* conn; // per slot, 0 until the connection's first frame
+    int loop;
+    int full;
+} cap_writer_t;
+
+static inline size_t cap_rec_size(const cap_rec_t* rec) {
+    return (sizeof(cap_rec_t) + rec->len + 7) & ~(size_t)7;
+}
+
+static inline int cap_create(cap_file_t* f, const char* path, size_t capacity) {
+    struct timespec ts;
+
+    capacity = (capacity + CAP_CHUNK - 1) / CAP_CHUNK * CAP_CHUNK;
+    f->map_len = CAP_HDR_SIZE + capacity;
+    f->fd      = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (f->fd == -1 || ftruncate(f->fd, (off_t)f->map_len) == -1) {
+        perror("capture file");
+        return -1;
+    }
+    char* map = mmap(NULL, f->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap capture");
+        return -1;
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    f->hdr       = (cap_hdr_t*)map;
+    f->base      = map + CAP_HDR_SIZE;
+    f->origin_ns = clk_read(); // the writers' timeline, see clock.h
+    memcpy(f->hdr->magic, CAP_MAGIC, sizeof(f->hdr->magic));
+    f->hdr->chunk    = CAP_CHUNK;
+    f->hdr->start_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    f->hdr->capacity = capacity;
+    return 0;
+}
+
+// After the loops are done: cuts the file down to what was written.
+static inline void cap_close(cap_file_t* f) {
+    uint64_t used = f->hdr->used < f->hdr->capacity ? f->hdr->used : f->hdr->capacity;
+
+    printf("capture: %u connections, %llu bytes of records, %llu dropped for lack of room\n",
+        f->hdr->next_conn,
+        (unsigned long long)used,
+        (unsigned long long)f->hdr->dropped);
+    munmap(f->hdr, f->map_len);
+    if (ftruncate(f->fd, (off_t)(CAP_HDR_SIZE + used)) == -1) {
+        perror("truncate capture");
+    }
+    close(f->fd);
+}
+
+static inline int cap_writer_init(cap_writer_t* w, cap_file_t* f, int loop, int max_clients) {
+    memset(w, 0, sizeof(*w));
+    w->f    = f;
+    w->loop = loop;
+    w->conn = calloc((size_t)max_clients, sizeof(uint32_t));
+    __atomic_fetch_add(&f->hdr->loops, 1, __ATOMIC_RELAXED);
+    return w->conn == NULL ? -1 : 0;
+}
+
+// Room for n more bytes (a multiple of 8), from a new chunk if the current one is short.
+// NULL once the file is full.
+static inline char* cap_reserve(cap_writer_t* w, size_t n) {
+    if (w->end - w->pos < (ptrdiff_t)n) {
+        // a record bigger than a chunk gets a run of whole chunks of its own
+        size_t need   = (n + CAP_CHUNK - 1) / CAP_CHUNK * CAP_CHUNK;
+        uint64_t off  = w->full ? 0 : __atomic_fetch_add(&w->f->hdr->used, need, __ATOMIC_RELAXED);
+        if (w->full || off + need > w->f->hdr->capacity) {
+            w->full = 1;
+            __atomic_fetch_add(&w->f->hdr->dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        w->pos = w->f->base + off;
+        w->end = w->pos + need;
+#ifdef MADV_POPULATE_WRITE
+        // one call maps the whole chunk instead of a page fault every 4 KB of records
+        madvise(w->pos, need, MADV_POPULATE_WRITE);
+#endif
+    }
+    char* p = w->pos;
+    w->pos += n;
+    return p;
+}
+
+static inline void cap_put(cap_writer_t* w, int kind, uint32_t conn, const proto_frame_t* f, int whole) {
+    // the loop's wakeup time: frames read in one go share it
+    cap_rec_t rec = { clk_now() - w->f->origin_ns, conn, (uint16_t)kind, (uint16_t)w->loop, 0, 0 };
+
+    if (f != NULL) {
+        rec.len       = (uint32_t)(PROTO_HDR_SIZE + (whole ? f->len : 0));
+        rec.frame_len = (uint32_t)f->len;
+    }
+    char* p = cap_reserve(w, cap_rec_size(&rec));
+    if (p == NULL) {
+        return;
+    }
+    memcpy(p, &rec, sizeof(rec));
+    if (f != NULL) {
+        proto_encode_hdr(p + sizeof(rec), f->type, f->len);
+        if (whole) {
+            memcpy(p + sizeof(rec) + PROTO_HDR_SIZE, f->payload, f->len);
+        }
+    }
+}
+
+// A frame received on slot; whole = 0 keeps only its header.
+static inline void cap_frame(cap_writer_t* w, int slot, const proto_frame_t* f, int whole) {
+    if (w->conn[slot] == 0) {
+        w->conn[slot] = __atomic_add_fetch(&w->f->hdr->next_conn, 1, __ATOMIC_RELAXED);
+        cap_put(w, CAP_OPEN, w->conn[slot], NULL, 0);
+    }
+    cap_put(w, CAP_FRAME, w->conn[slot], f, whole);
+}
+
+static inline void cap_conn_closed(cap_writer_t* w, int slot) {
+    if (w->conn[slot] != 0) {
+        cap_put(w, CAP_CLOSE, w->conn[slot], NULL, 0);
+        w->conn[slot] = 0;
+    }
+}
+
+// ---- reading -------------------------------------------------------------------------------
+
+typedef struct {
+    const cap_hdr_t* hdr;
+    const char* base;
+    size_t pos;
+    size_t end;
+    size_t map_len;
+} cap_reader_t;
+
+static inline int cap_open(cap_reader_t* rd, const char* path) {
+    struct stat st;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror(path);
+        return -1;
+    }
+    if ((size_t)st.st_size < CAP_HDR_SIZE) {
+        fprintf(stderr, "%s is not a capture\n", path);
+        close(fd);
+        return -1;
+    }
+    char* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap capture");
+        return -1;
+    }
+    rd->hdr     = (const cap_hdr_t*)map;
+    rd->base    = map + CAP_HDR_SIZE;
+    rd->map_len = (size_t)st.st_size;
+    rd->pos     = 0;
+    rd->end     = rd->hdr->used < rd->hdr->capacity ? rd->hdr->used : rd->hdr->capacity;
+    if (memcmp(rd->hdr->magic, CAP_MAGIC, sizeof(rd->hdr->magic)) != 0 || rd->hdr->chunk != CAP_CHUNK) {
+        fprintf(stderr, "%s is not a capture this build can read\n", path);
+        munmap(map, rd->map_len);
+        return -1;
+    }
+    // a capture the server never got to close is still at full size, and the records in it
+    // are all there
+    if (rd->end > rd->map_len - CAP_HDR_SIZE) {
+        rd->end = rd->map_len - CAP_HDR_SIZE;
+    }
+    return 0;
+}
+
+// The next record in file order, NULL at the end.
+static inline const cap_rec_t* cap_next(cap_reader_t* rd) {
+    while (rd->pos + sizeof(cap_rec_t) <= rd->end) {
+        size_t left          = CAP_CHUNK - rd->pos % CAP_CHUNK;
+        const cap_rec_t* rec = (const cap_rec_t*)(rd->base + rd->pos);
+        if (left < sizeof(cap_rec_t) || rec->kind == CAP_PAD) {
+            rd->pos += left;
+            continue;
+        }
+        if (rd->pos + cap_rec_size(rec) > rd->end) {
+            return NULL; // cut short
+        }
+        rd->pos += cap_rec_size(rec);
+        return rec;
+    }
+    return NULL;
+}
+
+static inline const char* cap_rec_frame(const cap_rec_t* rec) {
+    return (const char*)(rec + 1);
+}
+
+static inline void cap_close_reader(cap_reader_t* rd) {
+    munmap((void*)rd->hdr, rd->map_len);
+}
+
+#endif
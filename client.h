@@ -0,0 +1,453 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+// Client library for servers speaking proto.h frames (reactor.c, and server.c's protocol).
+//
+// A client_t keeps a pool of persistent connections to one server. Every request gets an id
+// and goes onto the least busy connection, behind whatever that connection already carries:
+// requests are pipelined, and since the server answers each connection in order, a reply
+// belongs to the oldest unanswered request of its connection, so ids never need to go on the
+// wire. Nothing is written when a request is made; client_poll() flushes every connection's
+// queue with one writev, so a burst of requests leaves as one batch.
+//
+// Two ways to use it, on a single thread:
+//   callbacks   client_send() queues a request and returns its id, client_poll() runs the
+//               callbacks of the replies that came in. The reply only lives during the call.
+//   coroutines  client_go() starts a function as a coroutine, client_run() drives them all.
+//               Inside one, client_call() looks blocking but only suspends that coroutine
+//               until its reply arrives, so a hundred of them keep a hundred requests in
+//               flight. Outside a coroutine client_call() simply blocks.
+//
+// A connection that fails takes its unanswered requests with it (their callbacks get a NULL
+// reply, client_call returns -1) and is reopened by the next request that lands on it.
+// Connecting is blocking; everything after that is not.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <ucontext.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "proto.h"
+#include "bufpool.h"
+#include "outq.h"
+
+#define CLIENT_MAX_POOL 64
+#define CLIENT_RX_INITIAL (64 * 1024)
+#define CLIENT_STACK_SIZE (128 * 1024)
+
+typedef struct client client_t;
+
+// reply is NULL when the request failed with its connection
+typedef void (*client_cb)(client_t* c, uint64_t id, const proto_frame_t* reply, void* arg);
+
+typedef struct client_req {
+    struct client_req* next;
+    uint64_t id;
+    client_cb cb;
+    void* arg;
+} client_req_t;
+
+typedef struct {
+    int fd; // -1 while closed
+    outq_t tx;
+    char* rx;
+    size_t rx_len;
+    size_t rx_cap;
+    client_req_t* head; // unanswered, in the order they were queued
+    client_req_t* tail;
+    int pending;
+} client_conn_t;
+
+typedef struct client_co {
+    ucontext_t ctx;
+    struct client_co* next;
+    client_t* client;
+    void (*fn)(client_t*, void*);
+    void* arg;
+    char* stack;
+    int ready; // runnable: just started, or its reply is in
+    int done;
+
+    // where client_call wants its reply
+    char* reply_buf;
+    size_t reply_cap;
+    size_t reply_len;
+    proto_type_e reply_type;
+    int failed;
+} client_co_t;
+
+struct client {
+    struct sockaddr_in addr;
+    client_conn_t conns[CLIENT_MAX_POOL];
+    int pool_size;
+    uint64_t next_id;
+    bufpool_t pool;
+    client_req_t* free_reqs;
+
+    ucontext_t sched;
+    client_co_t* current; // running coroutine, NULL in the scheduler
+    client_co_t* cos;     // every coroutine that has not finished
+};
+
+static inline int client_init(client_t* c, const char* host, int port, int pool_size) {
+    memset(c, 0, sizeof(*c));
+    c->addr.sin_family = AF_INET;
+    c->addr.sin_port   = htons(port);
+    if (inet_pton(AF_INET, host, &c->addr.sin_addr) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    c->pool_size = pool_size < 1 ? 1 : pool_size > CLIENT_MAX_POOL ? CLIENT_MAX_POOL : pool_size;
+    c->next_id   = 1;
+    for (int i = 0; i < CLIENT_MAX_POOL; i++) {
+        c->conns[i].fd = -1;
+    }
+    return 0;
+}
+
+static inline client_req_t* client_req_get(client_t* c) {
+    client_req_t* q = c->free_reqs;
+    if (q != NULL) {
+        c->free_reqs = q->next;
+        return q;
+    }
+    return malloc(sizeof(client_req_t));
+}
+
+static inline void client_req_put(client_t* c, client_req_t* q) {
+    q->next      = c->free_reqs;
+    c->free_reqs = q;
+}
+
+static inline int client_connect(client_t* c, client_conn_t* k) {
+    int one = 1;
+    int fd  = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd == -1) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&c->addr, sizeof(c->addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    if (k->rx == NULL) {
+        k->rx_cap = CLIENT_RX_INITIAL;
+        k->rx     = malloc(k->rx_cap);
+        if (k->rx == NULL) {
+            close(fd);
+            return -1;
+        }
+    }
+    k->fd     = fd;
+    k->rx_len = 0;
+    return 0;
+}
+
+// Closes the connection and fails everything still waiting on it.
+static inline void client_fail(client_t* c, client_conn_t* k) {
+    client_req_t* q = k->head;
+
+    close(k->fd);
+    k->fd      = -1;
+    k->head    = NULL;
+    k->tail    = NULL;
+    k->pending = 0;
+    k->rx_len  = 0;
+    outq_clear(&k->tx, &c->pool);
+    while (q != NULL) {
+        client_req_t* next = q->next;
+        q->cb(c, q->id, NULL, q->arg);
+        client_req_put(c, q);
+        q = next;
+    }
+}
+
+// Queues a request. Returns its id, or 0 when no connection could be opened.
+static inline uint64_t client_send(client_t* c, proto_type_e type, const void* payload, size_t len,
+    client_cb cb, void* arg) {
+    client_conn_t* k = &c->conns[0];
+    char hdr[PROTO_HDR_SIZE];
+
+    for (int i = 1; i < c->pool_size; i++) {
+        if (c->conns[i].pending < k->pending) {
+            k = &c->conns[i];
+        }
+    }
+    if (k->fd == -1 && client_connect(c, k) == -1) {
+        return 0;
+    }
+    client_req_t* q = client_req_get(c);
+    if (q == NULL) {
+        return 0;
+    }
+    proto_encode_hdr(hdr, type, len);
+    size_t before = k->tx.bytes;
+    if (outq_append(&k->tx, &c->pool, hdr, sizeof(hdr)) == -1 ||
+        (len > 0 && outq_append(&k->tx, &c->pool, payload, len) == -1)) {
+        outq_truncate(&k->tx, &c->pool, before); // a header without its payload would desync the stream
+        client_req_put(c, q);
+        return 0;
+    }
+    q->next = NULL;
+    q->id   = c->next_id++;
+    q->cb   = cb;
+    q->arg  = arg;
+    if (k->tail != NULL) {
+        k->tail->next = q;
+    } else {
+        k->head = q;
+    }
+    k->tail = q;
+    k->pending++;
+    return q->id;
+}
+
+// requests waiting for a reply, over the whole pool
+static inline int client_pending(const client_t* c) {
+    int n = 0;
+    for (int i = 0; i < c->pool_size; i++) {
+        n += c->conns[i].pending;
+    }
+    return n;
+}
+
+static inline void client_flush_conn(client_t* c, client_conn_t* k) {
+    while (k->tx.bytes > 0) {
+        size_t offered;
+        ssize_t n = outq_writev(&k->tx, &c->pool, k->fd, k->tx.bytes, &offered);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                client_fail(c, k);
+            }
+            return;
+        }
+        if ((size_t)n < offered) {
+            return;
+        }
+    }
+}
+
+// Reads what the connection has and runs the callbacks of every complete reply.
+// Returns the number of replies.
+static inline int client_read_conn(client_t* c, client_conn_t* k) {
+    proto_frame_t frame;
+    size_t len;
+    int replies = 0;
+
+    for (;;) {
+        if (k->rx_len == k->rx_cap) {
+            // only reached with a partial frame bigger than the buffer, size it to the frame
+            size_t need = k->rx_cap * 2;
+            if (proto_parse(k->rx, k->rx_len, &frame) == 0 && k->rx_len >= PROTO_HDR_SIZE &&
+                PROTO_HDR_SIZE + frame.len > need) {
+                need = PROTO_HDR_SIZE + frame.len;
+            }
+            char* bigger = realloc(k->rx, need);
+            if (bigger == NULL) {
+                client_fail(c, k);
+                return replies;
+            }
+            k->rx     = bigger;
+            k->rx_cap = need;
+        }
+        ssize_t n = read(k->fd, k->rx + k->rx_len, k->rx_cap - k->rx_len);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            client_fail(c, k);
+            return replies;
+        }
+        if (n < 0) {
+            return replies;
+        }
+        k->rx_len += (size_t)n;
+
+        size_t off = 0;
+        while ((len = proto_parse(k->rx + off, k->rx_len - off, &frame)) > 0) {
+            client_req_t* q = k->head;
+            off += len;
+            if (q == NULL) {
+                client_fail(c, k); // a reply nobody asked for, the stream cannot be trusted
+                return replies;
+            }
+            k->head = q->next;
+            if (k->head == NULL) {
+                k->tail = NULL;
+            }
+            k->pending--;
+            q->cb(c, q->id, &frame, q->arg);
+            client_req_put(c, q);
+            replies++;
+        }
+        memmove(k->rx, k->rx + off, k->rx_len - off);
+        k->rx_len -= off;
+    }
+}
+
+// Writes out every queued request, waits up to timeout_ms (-1: no limit) for replies and
+// runs their callbacks. Returns the number of replies handled, -1 on a poll error.
+static inline int client_poll(client_t* c, int timeout_ms) {
+    struct pollfd pfd[CLIENT_MAX_POOL];
+    int map[CLIENT_MAX_POOL];
+    int n = 0;
+
+    for (int i = 0; i < c->pool_size; i++) {
+        client_conn_t* k = &c->conns[i];
+        if (k->fd == -1) {
+            continue;
+        }
+        client_flush_conn(c, k);
+        if (k->fd != -1 && k->pending > 0) {
+            pfd[n].fd     = k->fd;
+            pfd[n].events = POLLIN | (k->tx.bytes > 0 ? POLLOUT : 0);
+            map[n++]      = i;
+        }
+    }
+    if (n == 0) {
+        return 0;
+    }
+    if (poll(pfd, (nfds_t)n, timeout_ms) == -1) {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    int replies = 0;
+    for (int j = 0; j < n; j++) {
+        client_conn_t* k = &c->conns[map[j]];
+        if (pfd[j].revents & (POLLIN | POLLERR | POLLHUP)) {
+            replies += client_read_conn(c, k);
+        }
+        if (k->fd != -1 && (pfd[j].revents & POLLOUT)) {
+            client_flush_conn(c, k);
+        }
+    }
+    return replies;
+}
+
+// ---- coroutines --------------------------------------------------------------------------
+
+static void client_co_entry(unsigned lo, unsigned hi) {
+    // makecontext only passes ints, so the pointer comes in two halves
+    client_co_t* co = (client_co_t*)(((uintptr_t)hi << 16 << 16) | (uintptr_t)lo);
+
+    co->fn(co->client, co->arg);
+    co->done = 1;
+}
+
+// Starts fn(c, arg) as a coroutine; it first runs inside client_run. Returns -1 on failure.
+static inline int client_go(client_t* c, void (*fn)(client_t*, void*), void* arg) {
+    client_co_t* co = calloc(1, sizeof(client_co_t));
+    if (co == NULL || (co->stack = malloc(CLIENT_STACK_SIZE)) == NULL || getcontext(&co->ctx) == -1) {
+        free(co);
+        return -1;
+    }
+    co->ctx.uc_stack.ss_sp   = co->stack;
+    co->ctx.uc_stack.ss_size = CLIENT_STACK_SIZE;
+    co->ctx.uc_link          = &c->sched;
+    co->client               = c;
+    co->fn                   = fn;
+    co->arg                  = arg;
+    co->ready                = 1;
+    uintptr_t p              = (uintptr_t)co;
+    makecontext(&co->ctx, (void (*)(void))client_co_entry, 2, (unsigned)p, (unsigned)(p >> 16 >> 16));
+    co->next = c->cos;
+    c->cos   = co;
+    return 0;
+}
+
+static void client_co_reply(client_t* c, uint64_t id, const proto_frame_t* reply, void* arg) {
+    client_co_t* co = arg;
+
+    (void)c;
+    (void)id;
+    co->ready  = 1;
+    co->failed = reply == NULL;
+    if (reply != NULL) {
+        co->reply_type = reply->type;
+        co->reply_len  = reply->len;
+        memcpy(co->reply_buf, reply->payload, reply->len < co->reply_cap ? reply->len : co->reply_cap);
+    }
+}
+
+// Sends a request and waits for its reply: suspends the calling coroutine, or blocks when
+// called outside one. Up to reply_cap payload bytes are copied to reply; returns the full
+// reply length (larger than reply_cap if it was cut short), -1 on failure.
+static inline ssize_t client_call(client_t* c, proto_type_e type, const void* payload, size_t len,
+    void* reply, size_t reply_cap, proto_type_e* reply_type) {
+    client_co_t local = { 0 };
+    client_co_t* co   = c->current != NULL ? c->current : &local;
+
+    co->reply_buf = reply;
+    co->reply_cap = reply_cap;
+    co->ready     = 0;
+    if (client_send(c, type, payload, len, client_co_reply, co) == 0) {
+        return -1;
+    }
+    while (!co->ready) {
+        if (c->current != NULL) {
+            swapcontext(&co->ctx, &c->sched);
+        } else if (client_poll(c, -1) == -1) {
+            return -1;
+        }
+    }
+    if (co->failed) {
+        return -1;
+    }
+    if (reply_type != NULL) {
+        *reply_type = co->reply_type;
+    }
+    return (ssize_t)co->reply_len;
+}
+
+// Runs coroutines until all of them have returned. Each round resumes whichever ones are
+// ready, then one client_poll sends everything they queued in a single batch per connection.
+static inline int client_run(client_t* c) {
+    while (c->cos != NULL) {
+        for (client_co_t** pp = &c->cos; *pp != NULL;) {
+            client_co_t* co = *pp;
+            if (co->ready) {
+                c->current = co;
+                swapcontext(&c->sched, &co->ctx);
+                c->current = NULL;
+            }
+            if (co->done) {
+                *pp = co->next;
+                free(co->stack);
+                free(co);
+            } else {
+                pp = &co->next;
+            }
+        }
+        if (c->cos != NULL && client_poll(c, -1) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static inline void client_destroy(client_t* c) {
+    for (int i = 0; i < c->pool_size; i++) {
+        if (c->conns[i].fd != -1) {
+            client_fail(c, &c->conns[i]);
+        }
+        free(c->conns[i].rx);
+    }
+    while (c->free_reqs != NULL) {
+        client_req_t* q = c->free_reqs;
+        c->free_reqs    = q->next;
+        free(q);
+    }
+    bufpool_destroy(&c->pool);
+}
+
+#endif
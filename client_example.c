@@ -0,0 +1,142 @@
+// Example use of client.h against the reactor (or anything speaking proto.h frames).
+//
+// Runs the same number of requests three ways and prints the rate of each:
+//   callbacks    every request queued up front, replies counted by a callback
+//   coroutines   -k coroutines, each doing client_call() in a loop
+//   one-shot     server.c's model, a fresh connection per request, for comparison
+//
+//     cc -O2 client_example.c -o client_example && ./client_example -p 9090 -n 100000
+
+#include "client.h"
+#include <time.h>
+
+typedef struct {
+    int requests;
+    int replies;
+    int failures;
+} tally_t;
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void on_reply(client_t* c, uint64_t id, const proto_frame_t* reply, void* arg) {
+    tally_t* t = arg;
+
+    (void)c;
+    (void)id;
+    if (reply == NULL) {
+        t->failures++;
+    } else {
+        t->replies++;
+    }
+}
+
+static void worker(client_t* c, void* arg) {
+    tally_t* t = arg;
+    char payload[64];
+    unsigned int ack;
+
+    memset(payload, 'x', sizeof(payload));
+    while (t->requests > 0) {
+        t->requests--;
+        if (client_call(c, PROTO_DATA, payload, sizeof(payload), &ack, sizeof(ack), NULL) == -1) {
+            t->failures++;
+        } else {
+            t->replies++;
+        }
+    }
+}
+
+static int one_shot(const char* host, int port) {
+    client_t c;
+    unsigned int version;
+
+    if (client_init(&c, host, port, 1) == -1) {
+        return -1;
+    }
+    ssize_t n = client_call(&c, PROTO_HELLO, NULL, 0, &version, sizeof(version), NULL);
+    client_destroy(&c);
+    return n == -1 ? -1 : 0;
+}
+
+int main(int argc, char** argv) {
+    const char* host = "127.0.0.1";
+    int port         = 9090;
+    int requests     = 100000;
+    int pool         = 4;
+    int coroutines   = 64;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:p:n:c:k:h")) != -1) {
+        switch (opt) {
+        case 'H':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'n':
+            requests = atoi(optarg);
+            break;
+        case 'c':
+            pool = atoi(optarg);
+            break;
+        case 'k':
+            coroutines = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-H host] [-p port] [-n requests] [-c pool_size] [-k coroutines]\n", argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    client_t c;
+    if (client_init(&c, host, port, pool) == -1) {
+        fprintf(stderr, "bad address %s\n", host);
+        exit(EXIT_FAILURE);
+    }
+
+    tally_t t = { requests, 0, 0 };
+    double t0 = now_sec();
+    for (int i = 0; i < requests; i++) {
+        if (client_send(&c, PROTO_HELLO, NULL, 0, on_reply, &t) == 0) {
+            perror("client_send");
+            exit(EXIT_FAILURE);
+        }
+    }
+    while (client_pending(&c) > 0) {
+        if (client_poll(&c, 1000) == -1) {
+            perror("poll");
+            break;
+        }
+    }
+    double t1 = now_sec();
+    printf("callbacks:  %d replies, %d failed, %.0f req/s over %d connections\n",
+        t.replies, t.failures, t.replies / (t1 - t0), pool);
+
+    tally_t w = { requests, 0, 0 };
+    for (int i = 0; i < coroutines; i++) {
+        if (client_go(&c, worker, &w) == -1) {
+            perror("client_go");
+            exit(EXIT_FAILURE);
+        }
+    }
+    client_run(&c);
+    double t2 = now_sec();
+    printf("coroutines: %d replies, %d failed, %.0f req/s with %d coroutines\n",
+        w.replies, w.failures, w.replies / (t2 - t1), coroutines);
+    client_destroy(&c);
+
+    // a tenth of the requests is plenty to see the difference
+    int shots = requests / 10;
+    int ok    = 0;
+    for (int i = 0; i < shots; i++) {
+        ok += one_shot(host, port) == 0;
+    }
+    double t3 = now_sec();
+    printf("one-shot:   %d replies, %.0f req/s with a connection per request\n", ok, ok / (t3 - t2));
+    return 0;
+}
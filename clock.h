@@ -0,0 +1,174 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+// Time for the loops. A loop reads the clock once when it wakes up (clk_tick) and everything
+// it runs until the next wakeup uses that value (clk_now). That is one load from a
+// thread-local, where clock_gettime would be called per frame. Values are nanoseconds in
+// CLOCK_MONOTONIC's timeline whatever the source, so they mix with clock_gettime readings
+// taken elsewhere, a viewer's say.
+//
+// Sources, picked once by clk_init (reactor.c's -T):
+//   tsc     the CPU's timestamp counter, scaled to nanoseconds. Only used when the counter is
+//           invariant (constant_tsc and nonstop_tsc), so it ticks at one rate on every core
+//           through frequency changes and idle states. Each thread re-anchors to
+//           CLOCK_MONOTONIC once a second, so calibration error and NTP slewing never add up
+//           to more than a second's worth.
+//   mono    clock_gettime(CLOCK_MONOTONIC), through the vDSO.
+//   coarse  CLOCK_MONOTONIC_COARSE: the kernel's last tick, 1-4 ms resolution. Cheapest, and
+//           good enough for timeouts and idle eviction but not for latencies.
+// auto is tsc where it can be trusted, else mono.
+//
+// clockbench.c measures what each costs per timestamp.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define CLK_CALIBRATE_MS 20
+#define CLK_REANCHOR_NS 1000000000ull
+
+enum { CLK_MONO, CLK_TSC, CLK_COARSE };
+
+// process-wide, written by clk_init before any loop starts
+static int clk_source          = CLK_MONO;
+static uint64_t clk_mult       = 0; // nanoseconds per tick << 32
+static double clk_ticks_per_ns = 0;
+
+// per thread
+typedef struct {
+    uint64_t tsc0; // anchor: counter and monotonic time read together
+    uint64_t ns0;
+    uint64_t last; // last value handed out, time never goes backwards
+    uint64_t now;  // cached by clk_tick
+} clk_local_t;
+
+static __thread clk_local_t clk_local;
+
+static inline uint64_t clk_tsc() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline uint64_t clk_gettime(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Counter ticks per nanosecond, measured against CLOCK_MONOTONIC over CLK_CALIBRATE_MS.
+static inline double clk_calibrate() {
+    struct timespec nap = { 0, CLK_CALIBRATE_MS * 1000000L };
+
+    if (clk_ticks_per_ns == 0) {
+        uint64_t ns0 = clk_gettime(CLOCK_MONOTONIC);
+        uint64_t t0  = clk_tsc();
+        nanosleep(&nap, NULL);
+        uint64_t t1  = clk_tsc();
+        uint64_t ns1 = clk_gettime(CLOCK_MONOTONIC);
+        clk_ticks_per_ns = (double)(t1 - t0) / (double)(ns1 - ns0);
+    }
+    return clk_ticks_per_ns;
+}
+
+// The counter runs at one rate on every core, whatever the CPU does.
+static inline int clk_tsc_invariant() {
+#if defined(__x86_64__) && defined(__linux__)
+    char line[4096];
+    int constant = 0, nonstop = 0;
+
+    FILE* f = fopen("/proc/cpuinfo", "r");
+    if (f == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "flags", 5) == 0) {
+            constant = strstr(line, " constant_tsc") != NULL;
+            nonstop  = strstr(line, " nonstop_tsc") != NULL;
+            break;
+        }
+    }
+    fclose(f);
+    return constant && nonstop;
+#else
+    return 0;
+#endif
+}
+
+// name: "auto", "tsc", "mono" or "coarse". Returns -1 for an unknown name, or tsc asked for
+// where the counter cannot be trusted.
+static inline int clk_init(const char* name) {
+    if (strcmp(name, "mono") == 0) {
+        clk_source = CLK_MONO;
+    } else if (strcmp(name, "coarse") == 0) {
+        clk_source = CLK_COARSE;
+    } else if (strcmp(name, "tsc") == 0 || strcmp(name, "auto") == 0) {
+        if (!clk_tsc_invariant()) {
+            clk_source = CLK_MONO;
+            return strcmp(name, "auto") == 0 ? 0 : -1;
+        }
+        clk_source = CLK_TSC;
+        clk_mult   = (uint64_t)((double)(1ull << 32) / clk_calibrate());
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static inline const char* clk_source_name() {
+    return clk_source == CLK_TSC ? "tsc" : clk_source == CLK_COARSE ? "coarse" : "mono";
+}
+
+// The source read now.
+static inline uint64_t clk_read() {
+    clk_local_t* l = &clk_local;
+    uint64_t ns;
+
+    if (clk_source == CLK_MONO) {
+        return clk_gettime(CLOCK_MONOTONIC);
+    }
+    if (clk_source == CLK_COARSE) {
+        return clk_gettime(CLOCK_MONOTONIC_COARSE);
+    }
+    uint64_t t = clk_tsc();
+#ifdef __SIZEOF_INT128__
+    ns = l->ns0 + (uint64_t)(((unsigned __int128)(t - l->tsc0) * clk_mult) >> 32);
+#else
+    ns = l->ns0 + (uint64_t)((double)(t - l->tsc0) / clk_ticks_per_ns);
+#endif
+    if (l->ns0 == 0 || ns - l->ns0 >= CLK_REANCHOR_NS) {
+        l->tsc0 = clk_tsc();
+        l->ns0  = clk_gettime(CLOCK_MONOTONIC);
+        ns      = l->ns0;
+    }
+    if (ns < l->last) {
+        ns = l->last; // a re-anchor that landed behind the scaled counter
+    }
+    l->last = ns;
+    return ns;
+}
+
+// Called by the loop when it wakes up.
+static inline uint64_t clk_tick() {
+    clk_local.now = clk_read();
+    return clk_local.now;
+}
+
+// When this thread's loop last woke up; on a thread without a loop, simply the time.
+static inline uint64_t clk_now() {
+    return clk_local.now != 0 ? clk_local.now : clk_read();
+}
+
+#endif
@@ -0,0 +1,165 @@
+// What a timestamp costs: every clock the loops could read (clock.h), in nanoseconds per
+// read and with the smallest step each one shows, and then the case that matters, an
+// iteration handling -e events that all want the time. Read per event, or once per
+// wakeup and cached.
+//
+//     cc -O2 clockbench.c -o clockbench && ./clockbench -n 20000000 -e 64
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "clock.h"
+
+typedef struct {
+    long reads;
+    int events;
+} options_t;
+
+// keeps the compiler from dropping reads whose value nobody looks at
+static volatile uint64_t sink;
+
+typedef uint64_t (*read_fn)(void);
+
+static uint64_t read_mono() {
+    return clk_gettime(CLOCK_MONOTONIC);
+}
+
+static uint64_t read_coarse() {
+    return clk_gettime(CLOCK_MONOTONIC_COARSE);
+}
+
+static uint64_t read_realtime() {
+    return clk_gettime(CLOCK_REALTIME);
+}
+
+static uint64_t read_time() {
+    return (uint64_t)time(NULL);
+}
+
+static uint64_t read_tsc() {
+    return clk_tsc();
+}
+
+static uint64_t read_clk() {
+    return clk_read();
+}
+
+static uint64_t read_cached() {
+    return clk_now();
+}
+
+static double per_read(read_fn fn, long n) {
+    uint64_t acc = 0;
+    uint64_t t0  = clk_gettime(CLOCK_MONOTONIC);
+
+    for (long i = 0; i < n; i++) {
+        acc += fn();
+    }
+    sink = acc;
+    return (double)(clk_gettime(CLOCK_MONOTONIC) - t0) / (double)n;
+}
+
+// smallest amount the clock moves by, in its own unit: how far it jumps once it changes at
+// all. 0 when it never changed, as a cached value does not.
+static uint64_t step(read_fn fn) {
+    uint64_t best = 0;
+
+    for (int i = 0; i < 20; i++) {
+        uint64_t a = fn();
+        uint64_t b = a;
+        for (long spin = 0; b == a && spin < 10000000; spin++) {
+            b = fn();
+        }
+        if (b > a && (best == 0 || b - a < best)) {
+            best = b - a;
+        }
+    }
+    return best;
+}
+
+// n events in batches of `events`, each event taking a timestamp and doing a little work
+static double per_event(long n, int events, int cached) {
+    uint64_t acc = 0;
+    uint64_t t0  = clk_gettime(CLOCK_MONOTONIC);
+
+    for (long i = 0; i < n; i += events) {
+        if (cached) {
+            clk_tick();
+        }
+        for (int e = 0; e < events; e++) {
+            acc += (cached ? clk_now() : clk_read()) ^ (uint64_t)e;
+        }
+    }
+    sink = acc;
+    return (double)(clk_gettime(CLOCK_MONOTONIC) - t0) / (double)n;
+}
+
+int main(int argc, char** argv) {
+    options_t o = { 20000000, 64 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:e:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            o.reads = atol(optarg);
+            break;
+        case 'e':
+            o.events = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n reads] [-e events_per_wakeup]\n", argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (o.reads < 1 || o.events < 1) {
+        fprintf(stderr, "-n and -e must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int tsc = clk_tsc_invariant();
+    printf("TSC %s, %.3f ticks/ns\n\n", tsc ? "invariant" : "not invariant, the tsc source is unavailable",
+        clk_calibrate());
+    printf("%-34s %10s %12s\n", "read", "ns/read", "step");
+
+    struct {
+        const char* name;
+        read_fn fn;
+        const char* unit;
+        const char* source; // clk_init name it needs, NULL for none
+    } reads[] = {
+        { "clock_gettime(MONOTONIC)", read_mono, "ns", NULL },
+        { "clock_gettime(MONOTONIC_COARSE)", read_coarse, "ns", NULL },
+        { "clock_gettime(REALTIME)", read_realtime, "ns", NULL },
+        { "time()", read_time, "s", NULL },
+        { "rdtsc / cntvct", read_tsc, "ticks", NULL },
+        { "clk_read, tsc source", read_clk, "ns", "tsc" },
+        { "clk_read, mono source", read_clk, "ns", "mono" },
+        { "clk_read, coarse source", read_clk, "ns", "coarse" },
+        { "clk_now, cached", read_cached, "ns", "mono" },
+    };
+    for (size_t i = 0; i < sizeof(reads) / sizeof(reads[0]); i++) {
+        if (reads[i].source != NULL && clk_init(reads[i].source) == -1) {
+            printf("%-34s %10s\n", reads[i].name, "n/a");
+            continue;
+        }
+        clk_tick();
+        double ns  = per_read(reads[i].fn, o.reads);
+        uint64_t d = reads[i].fn == read_time ? 1 : step(reads[i].fn); // time() would take seconds
+        if (d == 0) {
+            printf("%-34s %10.2f %12s\n", reads[i].name, ns, "-");
+        } else {
+            printf("%-34s %10.2f %9llu %s\n", reads[i].name, ns, (unsigned long long)d, reads[i].unit);
+        }
+    }
+
+    printf("\n%d events per wakeup, each taking a timestamp:\n", o.events);
+    printf("%-34s %10s\n", "", "ns/event");
+    const char* sources[] = { "tsc", "mono", "coarse" };
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        if (clk_init(sources[i]) == -1) {
+            continue;
+        }
+        printf("%-6s read per event %20.2f\n", sources[i], per_event(o.reads, o.events, 0));
+        printf("%-6s read per wakeup, cached %12.2f\n", sources[i], per_event(o.reads, o.events, 1));
+    }
+    return EXIT_SUCCESS;
+}
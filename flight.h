@@ -0,0 +1,129 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+// Per-connection flight recorder (reactor.c's -E): the last FLIGHT_EVENTS things that
+// happened on each TCP connection (accept, reads and their sizes, frames parsed, writes,
+// short writes, EAGAINs, close), stamped with the CPU's timestamp counter.
+//
+// One ring per slot, overwritten in a circle. Recording is a counter read and a few stores,
+// with no syscall and no branch beyond "is the recorder on". The ring is
+// never locked: a reader, possibly on another loop's thread, copies it and then drops what
+// the writer may have overwritten during the copy, so dumping never stops the loop.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "clock.h"
+
+#define FLIGHT_EVENTS 64 // power of two
+
+typedef enum {
+    FL_NONE,
+    FL_ACCEPT,   // arg: fd
+    FL_CONNECT,  // a socket the program opened itself (reactor_adopt), arg: fd
+    FL_READ,     // arg: bytes
+    FL_EOF,
+    FL_READ_EAGAIN,
+    FL_FRAME,    // arg: payload bytes, type: frame type
+    FL_WRITE,    // arg: bytes, everything offered went out
+    FL_WRITE_SHORT, // arg: bytes, the socket buffer filled up
+    FL_WRITE_EAGAIN,
+    FL_CLOSE,
+} flight_kind_e;
+
+typedef struct {
+    uint64_t tsc;
+    uint32_t arg;
+    uint16_t kind;
+    uint16_t type;
+} flight_event_t;
+
+typedef struct {
+    uint64_t head; // events ever recorded; the next goes to ev[head % FLIGHT_EVENTS]
+    flight_event_t ev[FLIGHT_EVENTS];
+} flight_ring_t;
+
+static inline void flight_record(flight_ring_t* f, flight_kind_e kind, uint32_t arg, uint16_t type) {
+    uint64_t h        = f->head;
+    flight_event_t* e = &f->ev[h & (FLIGHT_EVENTS - 1)];
+
+    e->tsc  = clk_tsc();
+    e->arg  = arg;
+    e->kind = (uint16_t)kind;
+    e->type = type;
+    __atomic_store_n(&f->head, h + 1, __ATOMIC_RELEASE);
+}
+
+// Copies the ring's consistent part into out, oldest first, and returns how many events that
+// is. Safe against the owning loop writing meanwhile.
+static inline int flight_snapshot(const flight_ring_t* f, flight_event_t* out) {
+    uint64_t h1 = __atomic_load_n(&f->head, __ATOMIC_ACQUIRE);
+    flight_event_t copy[FLIGHT_EVENTS];
+
+    memcpy(copy, f->ev, sizeof(copy));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t h2 = __atomic_load_n(&f->head, __ATOMIC_RELAXED);
+
+    // events from h2 - FLIGHT_EVENTS on may have been overwritten, the one at h2 may be half done
+    uint64_t from = h1 > FLIGHT_EVENTS ? h1 - FLIGHT_EVENTS : 0;
+    if (h2 + 1 > FLIGHT_EVENTS && from < h2 + 1 - FLIGHT_EVENTS) {
+        from = h2 + 1 - FLIGHT_EVENTS;
+    }
+    int n = 0;
+    for (uint64_t i = from; i < h1; i++) {
+        out[n++] = copy[i & (FLIGHT_EVENTS - 1)];
+    }
+    return n;
+}
+
+static inline const char* flight_kind_name(unsigned kind) {
+    static const char* names[] = { "-", "accept", "connect", "read", "eof", "read EAGAIN", "frame",
+        "write", "short write", "write EAGAIN", "close" };
+    return kind < sizeof(names) / sizeof(names[0]) ? names[kind] : "?";
+}
+
+// Formats the events of the connection now in the slot (from its accept on) into out, one
+// line each with its age and the gap since the event before. Returns the length.
+static inline size_t flight_format(const flight_ring_t* f, char* out, size_t cap) {
+    flight_event_t ev[FLIGHT_EVENTS];
+    int n          = flight_snapshot(f, ev);
+    int first      = 0;
+    double per_us  = clk_calibrate() * 1000;
+    uint64_t now   = clk_tsc();
+    size_t len     = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (ev[i].kind == FL_ACCEPT || ev[i].kind == FL_CONNECT) {
+            first = i;
+        }
+    }
+    len += (size_t)snprintf(out + len, cap - len, "%12s %12s  event\n", "age us", "gap us");
+    for (int i = first; i < n && len < cap; i++) {
+        len += (size_t)snprintf(out + len, cap - len, "%12.1f %12.1f  %s",
+            (double)(now - ev[i].tsc) / per_us,
+            i > first ? (double)(ev[i].tsc - ev[i - 1].tsc) / per_us : 0.0,
+            flight_kind_name(ev[i].kind));
+        if (len >= cap) {
+            break;
+        }
+        switch (ev[i].kind) {
+        case FL_FRAME:
+            len += (size_t)snprintf(out + len, cap - len, " type %u, %u bytes\n", ev[i].type, ev[i].arg);
+            break;
+        case FL_ACCEPT:
+        case FL_CONNECT:
+            len += (size_t)snprintf(out + len, cap - len, " fd %u\n", ev[i].arg);
+            break;
+        case FL_READ:
+        case FL_WRITE:
+        case FL_WRITE_SHORT:
+            len += (size_t)snprintf(out + len, cap - len, " %u bytes\n", ev[i].arg);
+            break;
+        default:
+            len += (size_t)snprintf(out + len, cap - len, "\n");
+        }
+    }
+    return len < cap ? len : cap - 1;
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef HIST_H
+#define HIST_H
+
+// Log-linear latency histogram: values below 16 get their own bucket, above that every power
+// of two is split into 16 sub-buckets, so any recorded value is off by at most 1/16 (~6%).
+// Recording is a couple of instructions and the whole thing is a flat array, cheap enough to
+// keep one per connection.
+
+#include <stdint.h>
+#include <string.h>
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+typedef struct {
+    uint64_t count[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} hist_t;
+
+static inline int hist_bucket(uint64_t v) {
+    if (v < HIST_SUB) {
+        return (int)v;
+    }
+    int msb = 63 - __builtin_clzll(v);
+    int sub = (int)((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+// smallest value that falls into bucket b
+static inline uint64_t hist_bucket_value(int b) {
+    if (b < HIST_SUB) {
+        return (uint64_t)b;
+    }
+    int msb = b / HIST_SUB + HIST_SUB_BITS - 1;
+    int sub = b % HIST_SUB;
+    return (uint64_t)(HIST_SUB + sub) << (msb - HIST_SUB_BITS);
+}
+
+static inline void hist_record(hist_t* h, uint64_t v) {
+    h->count[hist_bucket(v)]++;
+    h->total++;
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+static inline void hist_merge(hist_t* dst, const hist_t* src) {
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        dst->count[b] += src->count[b];
+    }
+    dst->total += src->total;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+// p in [0, 1]; 0 for an empty histogram
+static inline uint64_t hist_percentile(const hist_t* h, double p) {
+    if (h->total == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(p * (double)h->total);
+    if (target >= h->total) {
+        return h->max;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->count[b];
+        if (seen > target) {
+            return hist_bucket_value(b);
+        }
+    }
+    return h->max;
+}
+
+#endif
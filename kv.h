@@ -0,0 +1,281 @@
+#ifndef KV_H
+#define KV_H
+
+// In-memory key/value store behind PROTO_SET, PROTO_GET and PROTO_DEL (reactor.c's -J mode).
+//
+// Open addressing with linear probing over a power-of-two table of (hash, record) slots. A
+// record holds its key and value back to back in one allocation, so a lookup touches the
+// table and then one block. Deleted slots stay tombstones until the next rehash.
+//
+// Records loaded from a snapshot (snapshot.h) are not copied: they point into the snapshot's
+// read-only mapping, and are only ever replaced, never freed or written to.
+//
+// Payload layouts, also what the persistence log (wal.h) stores:
+//   PROTO_SET  16-bit key length (network order), key, value
+//   PROTO_GET  key
+//   PROTO_DEL  key
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include "proto.h"
+
+#define KV_MIN_SLOTS 1024
+#define KV_MAX_KEY 0xffff
+
+typedef struct {
+    uint32_t vlen;
+    uint16_t klen;
+    char data[]; // key, then value
+} kv_rec_t;
+
+// a slot whose record was deleted; probing goes on past it, inserts may reuse it
+#define KV_TOMBSTONE ((kv_rec_t*)1)
+
+typedef struct {
+    uint64_t hash;
+    kv_rec_t* rec; // NULL when never used
+} kv_slot_t;
+
+typedef struct {
+    kv_slot_t* slots;
+    size_t cap;   // power of two
+    size_t count; // live records
+    size_t used;  // live records plus tombstones
+    size_t bytes; // key and value bytes held
+    char* map;    // snapshot the table may point into, see kv_owns
+    size_t map_len;
+} kv_t;
+
+static inline const char* kv_value(const kv_rec_t* rec) {
+    return rec->data + rec->klen;
+}
+
+// FNV-1a with a final avalanche, the table index comes from the low bits
+static inline uint64_t kv_hash(const void* p, size_t n) {
+    const unsigned char* b = p;
+    uint64_t h             = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ b[i]) * 0x100000001b3ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline int kv_init(kv_t* kv, size_t cap) {
+    size_t n = KV_MIN_SLOTS;
+    while (n < cap) {
+        n <<= 1;
+    }
+    memset(kv, 0, sizeof(*kv));
+    kv->slots = calloc(n, sizeof(kv_slot_t));
+    if (kv->slots == NULL) {
+        return -1;
+    }
+    kv->cap = n;
+    return 0;
+}
+
+// 0 for a record living in the snapshot mapping
+static inline int kv_owns(const kv_t* kv, const kv_rec_t* rec) {
+    return (const char*)rec < kv->map || (const char*)rec >= kv->map + kv->map_len;
+}
+
+static inline void kv_free_rec(kv_t* kv, kv_rec_t* rec) {
+    if (kv_owns(kv, rec)) {
+        free(rec);
+    }
+}
+
+static inline void kv_destroy(kv_t* kv) {
+    for (size_t i = 0; i < kv->cap; i++) {
+        if (kv->slots[i].rec != NULL && kv->slots[i].rec != KV_TOMBSTONE) {
+            kv_free_rec(kv, kv->slots[i].rec);
+        }
+    }
+    free(kv->slots);
+    if (kv->map != NULL) {
+        munmap(kv->map, kv->map_len);
+    }
+    memset(kv, 0, sizeof(*kv));
+}
+
+// Index of the slot holding key, or -1. *insert is set to where the key would go.
+static inline long kv_find(const kv_t* kv, const char* key, size_t klen, uint64_t h, size_t* insert) {
+    size_t mask = kv->cap - 1;
+    long tomb   = -1;
+
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        kv_rec_t* rec = kv->slots[i].rec;
+        if (rec == NULL) {
+            *insert = tomb != -1 ? (size_t)tomb : i;
+            return -1;
+        }
+        if (rec == KV_TOMBSTONE) {
+            if (tomb == -1) {
+                tomb = (long)i;
+            }
+            continue;
+        }
+        if (kv->slots[i].hash == h && rec->klen == klen && memcmp(rec->data, key, klen) == 0) {
+            return (long)i;
+        }
+    }
+}
+
+// Rehashes into a table twice the size, or the same size when it is mostly tombstones.
+static inline int kv_rehash(kv_t* kv) {
+    size_t cap       = kv->count * 2 >= kv->cap ? kv->cap * 2 : kv->cap;
+    kv_slot_t* slots = calloc(cap, sizeof(kv_slot_t));
+    if (slots == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < kv->cap; i++) {
+        kv_slot_t s = kv->slots[i];
+        if (s.rec == NULL || s.rec == KV_TOMBSTONE) {
+            continue;
+        }
+        size_t j = s.hash & (cap - 1);
+        while (slots[j].rec != NULL) {
+            j = (j + 1) & (cap - 1);
+        }
+        slots[j] = s;
+    }
+    free(kv->slots);
+    kv->slots = slots;
+    kv->cap   = cap;
+    kv->used  = kv->count;
+    return 0;
+}
+
+static inline const kv_rec_t* kv_get(const kv_t* kv, const char* key, size_t klen) {
+    size_t insert;
+    long i = kv_find(kv, key, klen, kv_hash(key, klen), &insert);
+    return i == -1 ? NULL : kv->slots[i].rec;
+}
+
+// Stores rec, whose key hashes to h, replacing (and freeing) any previous record. Returns -1
+// when the table cannot grow, rec then still belongs to the caller.
+static inline int kv_put(kv_t* kv, kv_rec_t* rec, uint64_t h) {
+    size_t insert = 0;
+
+    // at most three quarters full, tombstones included, so probes stay short
+    if ((kv->used + 1) * 4 > kv->cap * 3 && kv_rehash(kv) == -1) {
+        return -1;
+    }
+    long i = kv_find(kv, rec->data, rec->klen, h, &insert);
+    if (i != -1) {
+        kv->bytes -= kv->slots[i].rec->klen + kv->slots[i].rec->vlen;
+        kv_free_rec(kv, kv->slots[i].rec);
+        insert = (size_t)i;
+    } else {
+        if (kv->slots[insert].rec == NULL) {
+            kv->used++;
+        }
+        kv->count++;
+    }
+    kv->slots[insert].hash = h;
+    kv->slots[insert].rec  = rec;
+    kv->bytes += rec->klen + rec->vlen;
+    return 0;
+}
+
+static inline int kv_set(kv_t* kv, const char* key, size_t klen, const char* val, size_t vlen) {
+    if (klen > KV_MAX_KEY || vlen > UINT32_MAX) {
+        return -1;
+    }
+    kv_rec_t* rec = malloc(sizeof(kv_rec_t) + klen + vlen);
+    if (rec == NULL) {
+        return -1;
+    }
+    rec->klen = (uint16_t)klen;
+    rec->vlen = (uint32_t)vlen;
+    memcpy(rec->data, key, klen);
+    memcpy(rec->data + klen, val, vlen);
+    if (kv_put(kv, rec, kv_hash(key, klen)) == -1) {
+        free(rec);
+        return -1;
+    }
+    return 0;
+}
+
+// Returns 1 if the key was there.
+static inline int kv_del(kv_t* kv, const char* key, size_t klen) {
+    size_t insert;
+    long i = kv_find(kv, key, klen, kv_hash(key, klen), &insert);
+    if (i == -1) {
+        return 0;
+    }
+    kv->bytes -= kv->slots[i].rec->klen + kv->slots[i].rec->vlen;
+    kv_free_rec(kv, kv->slots[i].rec);
+    kv->slots[i].rec = KV_TOMBSTONE;
+    kv->count--;
+    return 1;
+}
+
+static inline int kv_is_mutation(proto_type_e type) {
+    return type == PROTO_SET || type == PROTO_DEL;
+}
+
+// Splits a PROTO_SET payload. Returns -1 when it is malformed.
+static inline int kv_parse_set(const proto_frame_t* f, const char** key, size_t* klen, const char** val, size_t* vlen) {
+    uint16_t n;
+
+    if (f->len < sizeof(n)) {
+        return -1;
+    }
+    memcpy(&n, f->payload, sizeof(n));
+    *klen = ntohs(n);
+    if (*klen > f->len - sizeof(n)) {
+        return -1;
+    }
+    *key  = f->payload + sizeof(n);
+    *val  = *key + *klen;
+    *vlen = f->len - sizeof(n) - *klen;
+    return 0;
+}
+
+// The key a store frame is about, -1 for frames that carry none.
+static inline int kv_frame_key(const proto_frame_t* f, const char** key, size_t* klen) {
+    const char* val;
+    size_t vlen;
+
+    switch (f->type) {
+    case PROTO_SET:
+        return kv_parse_set(f, key, klen, &val, &vlen);
+    case PROTO_GET:
+    case PROTO_DEL:
+        if (f->len > KV_MAX_KEY) {
+            return -1;
+        }
+        *key  = f->payload;
+        *klen = f->len;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+// Applies a PROTO_SET or PROTO_DEL. Returns what kv_set / kv_del return, or -1 for a
+// malformed frame.
+static inline int kv_apply(kv_t* kv, const proto_frame_t* f) {
+    const char *key, *val;
+    size_t klen, vlen;
+
+    if (f->type == PROTO_SET) {
+        if (kv_parse_set(f, &key, &klen, &val, &vlen) == -1) {
+            return -1;
+        }
+        return kv_set(kv, key, klen, val, vlen);
+    }
+    if (f->type == PROTO_DEL && kv_frame_key(f, &key, &klen) == 0) {
+        return kv_del(kv, key, klen);
+    }
+    return -1;
+}
+
+#endif
@@ -0,0 +1,491 @@
+#ifndef L7_H
+#define L7_H
+
+// Frame-aware load-balancing proxy, used by reactor.c's -L mode through its hooks.
+//
+// Client frames are parsed as usual and each one is forwarded whole to a backend: PROTO_DATA
+// by consistent hashing of its key (the first L7_KEY_MAX payload bytes), every other type to
+// backend (type % backends). Each backend has a pool of pool_size persistent upstream
+// connections, opened by the first requests that need them and adopted by the reactor like
+// any client, and requests from all clients are pipelined over them. The backends answer in
+// order on each connection, so an upstream connection only keeps a FIFO of the requests it
+// carries and every reply goes to the request at its head.
+//
+// One client's requests can go to different backends and come back in any order; a reply
+// that overtakes an earlier request of the same client is held until that one is answered,
+// so a client always sees its replies in request order. Requests in flight per client are
+// capped at L7_CLIENT_INFLIGHT by no longer reading from it.
+//
+// Only the frame types any client may send a backend are forwarded (l7_proxied). Anything
+// else, a REPLICATE or SNAPSHOT say, never reaches a backend: the proxy answers it itself with
+// a PROTO_ADMIN text, in its turn among the client's replies.
+//
+// A lost upstream connection takes the clients waiting on it down with it; they are closed at
+// the end of the iteration (reactor_close_later). Only a failed connect or a socket error
+// has its backend skipped for L7_RETRY_SECS; a backend closing a connection in an orderly
+// way, an idle timeout say, just leaves a free place in the pool for the next request to
+// reconnect.
+// Payloads streamed through reactor_on_chunk (over RX_STREAM_MIN) are not proxied.
+//
+// Included by the program after reactor.h.
+
+#include <time.h>
+#include <stdint.h>
+
+#define L7_MAX_BACKENDS 16
+#define L7_MAX_POOL 8
+#define L7_VNODES 64 // points per backend on the hash ring
+#define L7_KEY_MAX 16
+#define L7_CLIENT_INFLIGHT 256
+#define L7_RETRY_SECS 1
+
+typedef struct l7_req {
+    struct l7_req* next_up;     // on the upstream connection, in send order
+    struct l7_req* next_client; // on the client, in request order
+    int client;                 // slot, -1 once the client is gone
+    int answered;               // off the upstream FIFO: reply arrived, or the upstream was lost
+    char* reply;                // whole reply frame, held while an earlier request is unanswered
+    size_t reply_len;
+} l7_req_t;
+
+typedef struct {
+    struct sockaddr_in addr;
+    int conns[L7_MAX_POOL]; // slots, -1 while not connected
+    time_t down_until;
+} l7_backend_t;
+
+typedef struct {
+    uint64_t point;
+    int backend;
+} l7_vnode_t;
+
+typedef struct {
+    int backend;   // upstream connection to this backend, -1 for a client
+    int pool_idx;
+    l7_req_t* head; // client: unanswered or held, in request order; upstream: awaiting a reply
+    l7_req_t* tail;
+    int inflight;
+} l7_slot_t;
+
+typedef struct {
+    l7_backend_t backends[L7_MAX_BACKENDS];
+    int n_backends;
+    int pool_size;
+    int by_key; // PROTO_DATA goes through the hash ring, otherwise everything routes by type
+    l7_vnode_t ring[L7_MAX_BACKENDS * L7_VNODES];
+    int n_vnodes;
+    l7_slot_t* slots;
+    l7_req_t* free_reqs;
+} l7_t;
+
+// FNV-1a with a final avalanche, so keys that differ only in their last byte spread out
+static inline uint64_t l7_hash(const void* p, size_t n) {
+    const unsigned char* b = p;
+    uint64_t h             = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ b[i]) * 0x100000001b3ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline time_t l7_now() {
+    return (time_t)(clk_now() / 1000000000ull);
+}
+
+static int l7_vnode_cmp(const void* a, const void* b) {
+    uint64_t x = ((const l7_vnode_t*)a)->point;
+    uint64_t y = ((const l7_vnode_t*)b)->point;
+    return x < y ? -1 : x > y;
+}
+
+// Parses "host:port,host:port,..." into l. Returns -1 on a malformed list.
+static inline int l7_parse_backends(l7_t* l, const char* list) {
+    char host[64];
+    int port, used;
+
+    l->n_backends = 0;
+    while (*list != '\0') {
+        if (l->n_backends == L7_MAX_BACKENDS ||
+            sscanf(list, "%63[^:]:%d%n", host, &port, &used) != 2) {
+            return -1;
+        }
+        l7_backend_t* be = &l->backends[l->n_backends++];
+        memset(be, 0, sizeof(*be));
+        be->addr.sin_family = AF_INET;
+        be->addr.sin_port   = htons(port);
+        if (inet_pton(AF_INET, host, &be->addr.sin_addr) != 1) {
+            return -1;
+        }
+        list += used;
+        if (*list == ',') {
+            list++;
+        }
+    }
+    return l->n_backends > 0 ? 0 : -1;
+}
+
+// Sets up one loop's proxy state from a template holding the backends and options.
+static inline int l7_init(l7_t* l, const l7_t* conf, int max_clients) {
+    *l = *conf;
+    if (l->pool_size < 1 || l->pool_size > L7_MAX_POOL) {
+        l->pool_size = 2;
+    }
+    l->slots     = calloc((size_t)max_clients, sizeof(l7_slot_t));
+    l->free_reqs = NULL;
+    if (l->slots == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < max_clients; i++) {
+        l->slots[i].backend = -1;
+    }
+    for (int b = 0; b < l->n_backends; b++) {
+        for (int i = 0; i < L7_MAX_POOL; i++) {
+            l->backends[b].conns[i] = -1;
+        }
+    }
+
+    // every backend owns L7_VNODES points, so removing one only moves the keys it owned
+    l->n_vnodes = 0;
+    for (int b = 0; b < l->n_backends; b++) {
+        for (int v = 0; v < L7_VNODES; v++) {
+            struct {
+                struct sockaddr_in addr;
+                int v;
+            } id;
+            memset(&id, 0, sizeof(id));
+            id.addr = l->backends[b].addr;
+            id.v    = v;
+            l->ring[l->n_vnodes].point   = l7_hash(&id, sizeof(id));
+            l->ring[l->n_vnodes].backend = b;
+            l->n_vnodes++;
+        }
+    }
+    qsort(l->ring, (size_t)l->n_vnodes, sizeof(l7_vnode_t), l7_vnode_cmp);
+    return 0;
+}
+
+static inline l7_req_t* l7_req_get(l7_t* l) {
+    l7_req_t* q = l->free_reqs;
+    if (q != NULL) {
+        l->free_reqs = q->next_up;
+    } else {
+        q = malloc(sizeof(l7_req_t));
+    }
+    return q;
+}
+
+static inline void l7_req_put(reactor_t* r, l7_t* l, l7_req_t* q) {
+    if (q->reply != NULL) {
+        bufpool_put(&r->pool, q->reply, q->reply_len);
+    }
+    q->next_up   = l->free_reqs;
+    l->free_reqs = q;
+}
+
+// Frame types forwarded to the backends.
+static inline int l7_proxied(proto_type_e type) {
+    switch (type) {
+    case PROTO_HELLO:
+    case PROTO_DATA:
+    case PROTO_SET:
+    case PROTO_GET:
+    case PROTO_DEL:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Backend for a frame, -1 if every candidate is down. The type is whatever the client sent,
+// so it is only ever used unsigned.
+static inline int l7_route(l7_t* l, const proto_frame_t* f) {
+    time_t now = l7_now();
+
+    if (l->by_key && f->type == PROTO_DATA) {
+        uint64_t h = l7_hash(f->payload, f->len < L7_KEY_MAX ? f->len : L7_KEY_MAX);
+        int lo     = 0;
+        int hi     = l->n_vnodes;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (l->ring[mid].point < h) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        // clockwise from the key's point to the first backend that is up
+        for (int k = 0; k < l->n_vnodes; k++) {
+            int b = l->ring[(lo + k) % l->n_vnodes].backend;
+            if (l->backends[b].down_until <= now) {
+                return b;
+            }
+        }
+        return -1;
+    }
+    for (int k = 0; k < l->n_backends; k++) {
+        int b = (int)(((uint32_t)f->type + (uint32_t)k) % (uint32_t)l->n_backends);
+        if (l->backends[b].down_until <= now) {
+            return b;
+        }
+    }
+    return -1;
+}
+
+static inline int l7_connect(reactor_t* r, l7_t* l, int b, int idx) {
+    l7_backend_t* be = &l->backends[b];
+    int fd           = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd == -1) {
+        perror("socket upstream");
+        return -1;
+    }
+    if (connect(fd, (const struct sockaddr*)&be->addr, sizeof(be->addr)) == -1 && errno != EINPROGRESS) {
+        perror("connect upstream");
+        close(fd);
+        be->down_until = l7_now() + L7_RETRY_SECS;
+        return -1;
+    }
+    int slot = reactor_adopt(r, fd);
+    if (slot == -1) {
+        printf("Server full, no slot for an upstream connection\n");
+        close(fd);
+        return -1;
+    }
+    reactor_set_flush_policy(r, slot, fd, r->flush_policy);
+    l->slots[slot].backend  = b;
+    l->slots[slot].pool_idx = idx;
+    be->conns[idx]          = slot;
+    r->stats.l7_upstream_connects++;
+    if (r->verbose) {
+        printf("upstream connection %d to backend %d is fd %d\n", idx, b, fd);
+    }
+    return slot;
+}
+
+// Connection of the backend's pool for the next request: a new one while the pool is not full,
+// so pool_size connections share the load, else the least loaded.
+static inline int l7_upstream(reactor_t* r, l7_t* l, int b) {
+    l7_backend_t* be = &l->backends[b];
+    int best         = -1;
+    int free_idx     = -1;
+
+    for (int i = 0; i < l->pool_size; i++) {
+        int s = be->conns[i];
+        if (s == -1) {
+            if (free_idx == -1) {
+                free_idx = i;
+            }
+        } else if (best == -1 || l->slots[s].inflight < l->slots[best].inflight) {
+            best = s;
+        }
+    }
+    if (free_idx != -1) {
+        int s = l7_connect(r, l, b, free_idx);
+        if (s != -1) {
+            return s;
+        }
+    }
+    return best;
+}
+
+// A new request of the client's, at the end of its list.
+static inline l7_req_t* l7_req_new(reactor_t* r, l7_t* l, int slot) {
+    l7_slot_t* cl = &l->slots[slot];
+    l7_req_t* q   = l7_req_get(l);
+
+    if (q == NULL) {
+        return NULL;
+    }
+    q->next_up     = NULL;
+    q->next_client = NULL;
+    q->client      = slot;
+    q->answered    = 0;
+    q->reply       = NULL;
+    if (cl->tail != NULL) {
+        cl->tail->next_client = q;
+    } else {
+        cl->head = q;
+    }
+    cl->tail = q;
+    if (++cl->inflight >= L7_CLIENT_INFLIGHT) {
+        reactor_hold(r, slot, 1);
+    }
+    return q;
+}
+
+// A frame that is not forwarded: answered here, after whatever the client is still owed.
+static inline int l7_refuse(reactor_t* r, l7_t* l, int slot, const proto_frame_t* f) {
+    char text[64];
+    size_t len = (size_t)snprintf(text, sizeof(text), "frame type %u is not proxied\n", (unsigned)f->type);
+
+    if (r->verbose) {
+        printf("fd %d: %s", r->clients[slot].fd, text);
+    }
+    if (l->slots[slot].head == NULL) {
+        return reactor_send_frame(r, slot, PROTO_ADMIN, text, len);
+    }
+    l7_req_t* q = l7_req_new(r, l, slot);
+    if (q == NULL) {
+        return -1;
+    }
+    q->answered  = 1;
+    q->reply_len = PROTO_HDR_SIZE + len;
+    q->reply     = bufpool_get(&r->pool, q->reply_len);
+    if (q->reply == NULL) {
+        return -1;
+    }
+    proto_encode_hdr(q->reply, PROTO_ADMIN, len);
+    memcpy(q->reply + PROTO_HDR_SIZE, text, len);
+    return 0;
+}
+
+// A request frame from a client.
+static inline int l7_forward(reactor_t* r, l7_t* l, int slot, const proto_frame_t* f) {
+    if (!l7_proxied(f->type)) {
+        return l7_refuse(r, l, slot, f);
+    }
+    int b = l7_route(l, f);
+    if (b == -1) {
+        if (r->verbose) {
+            printf("no backend up for a frame from fd %d\n", r->clients[slot].fd);
+        }
+        return -1;
+    }
+    int up = l7_upstream(r, l, b);
+    l7_req_t* q;
+    if (up == -1 || (q = l7_req_new(r, l, slot)) == NULL) {
+        return -1;
+    }
+    l7_slot_t* us = &l->slots[up];
+
+    if (us->tail != NULL) {
+        us->tail->next_up = q;
+    } else {
+        us->head = q;
+    }
+    us->tail = q;
+    us->inflight++;
+    r->stats.l7_requests++;
+    return reactor_send_frame(r, up, f->type, f->payload, f->len);
+}
+
+// Sends the client every reply that is now due, in request order.
+static inline int l7_deliver(reactor_t* r, l7_t* l, int slot) {
+    l7_slot_t* cl = &l->slots[slot];
+
+    while (cl->head != NULL && cl->head->reply != NULL) {
+        l7_req_t* q = cl->head;
+        r->stats.tx_frames++;
+        if (reactor_send(r, slot, q->reply, q->reply_len) == -1) {
+            return -1;
+        }
+        cl->head = q->next_client;
+        if (cl->head == NULL) {
+            cl->tail = NULL;
+        }
+        cl->inflight--;
+        l7_req_put(r, l, q);
+    }
+    if (cl->inflight <= L7_CLIENT_INFLIGHT / 2) {
+        reactor_hold(r, slot, 0);
+    }
+    return 0;
+}
+
+// A reply frame from an upstream connection.
+static inline int l7_reply(reactor_t* r, l7_t* l, int up, const proto_frame_t* f) {
+    l7_slot_t* us = &l->slots[up];
+    l7_req_t* q   = us->head;
+
+    if (q == NULL) {
+        fprintf(stderr, "unsolicited frame from upstream fd %d\n", r->clients[up].fd);
+        return -1;
+    }
+    us->head = q->next_up;
+    if (us->head == NULL) {
+        us->tail = NULL;
+    }
+    us->inflight--;
+    q->answered = 1;
+    if (q->client == -1) {
+        l7_req_put(r, l, q); // its client went away meanwhile
+        return 0;
+    }
+
+    l7_slot_t* cl = &l->slots[q->client];
+    if (cl->head == q) {
+        // the common case: nothing earlier is outstanding, the reply goes straight out
+        int rc   = reactor_send_frame(r, q->client, f->type, f->payload, f->len);
+        cl->head = q->next_client;
+        if (cl->head == NULL) {
+            cl->tail = NULL;
+        }
+        cl->inflight--;
+        int client = q->client;
+        l7_req_put(r, l, q);
+        if (rc == -1) {
+            return 0; // the client's own flush fails and closes it
+        }
+        return l7_deliver(r, l, client);
+    }
+    q->reply_len = PROTO_HDR_SIZE + f->len;
+    q->reply     = bufpool_get(&r->pool, q->reply_len);
+    if (q->reply == NULL) {
+        return -1;
+    }
+    proto_encode_hdr(q->reply, f->type, f->len);
+    memcpy(q->reply + PROTO_HDR_SIZE, f->payload, f->len);
+    r->stats.l7_reordered++;
+    return 0;
+}
+
+static inline int l7_dispatch(reactor_t* r, int slot, const proto_frame_t* f) {
+    l7_t* l = r->user;
+    if (l->slots[slot].backend != -1) {
+        return l7_reply(r, l, slot, f);
+    }
+    return l7_forward(r, l, slot, f);
+}
+
+static inline void l7_on_close(reactor_t* r, int slot) {
+    l7_t* l      = r->user;
+    l7_slot_t* s = &l->slots[slot];
+
+    if (s->backend != -1) {
+        l7_backend_t* be       = &l->backends[s->backend];
+        be->conns[s->pool_idx] = -1;
+        if (!r->clients[slot].rx_eof) {
+            be->down_until = l7_now() + L7_RETRY_SECS; // refused, reset, timed out
+        }
+        r->stats.l7_upstream_lost++;
+        // whoever waits for a reply from here will not get one
+        for (l7_req_t* q = s->head; q != NULL;) {
+            l7_req_t* next = q->next_up;
+            q->answered    = 1;
+            if (q->client == -1) {
+                l7_req_put(r, l, q);
+            } else {
+                reactor_close_later(r, q->client);
+            }
+            q = next;
+        }
+    } else {
+        // requests still on an upstream FIFO are freed when their reply comes back
+        for (l7_req_t* q = s->head; q != NULL;) {
+            l7_req_t* next = q->next_client;
+            if (q->answered) {
+                l7_req_put(r, l, q);
+            } else {
+                q->client = -1;
+            }
+            q = next;
+        }
+    }
+    memset(s, 0, sizeof(*s));
+    s->backend = -1;
+}
+
+#endif
@@ -0,0 +1,749 @@
+// Load generator for the reactor.
+//
+// Opens -c connections and keeps -n requests in flight on each one (a new request goes out for
+// every reply), for -d seconds. Requests are PROTO_HELLO, or PROTO_DATA with -s payload bytes.
+// Every connection keeps its own latency histogram; the report groups connections by index so
+// an unfair server shows up as latency climbing with the connection index.
+//
+// -1 switches to one-shot mode, server.c's model: every request gets a fresh connection that
+// is closed after the reply, and the latency covers connect + request + reply. Adding -T sends
+// the request with TCP Fast Open, inside the SYN (Linux; the server needs -F and
+// net.ipv4.tcp_fastopen to include 2).
+//
+// -w sends PROTO_SET frames instead, -s bytes of value under a key per request in the window,
+// for the reactor's store (-J); with the log's group commit the latency is the commit wait.
+// -r sends PROTO_GET frames for the same keys, to a store or to one of its followers (-O).
+//
+// -U path runs the same closed loop over the shared-memory transport instead of TCP (Linux,
+// the server needs -U path too), each connection sleeping on its eventfd only when idle.
+//
+// -i idle_conns measures what connections cost while they sit idle, the C10K / C100K case:
+// the -c active connections run for -d seconds on their own, then -i more connections are
+// opened that exchange one HELLO each and go quiet, and the active ones run for -d seconds
+// again. The report compares the two runs' latency and, given the server's pid with -P, its
+// RSS per idle connection and CPU time per active request. Past ~28k connections to one
+// address the client runs out of ephemeral ports; towards 127.0.0.1 the idle connections
+// are spread over source addresses 127.0.0.1, .2, ... to get around that.
+//
+//     cc -O2 loadgen.c -o loadgen && ./loadgen -p 9090 -c 1000 -n 8 -d 5
+//     ./loadgen -p 9090 -c 100 -i 100000 -P $(pidof reactor)
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // memfd_create and accept4 in shm.h
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "proto.h"
+#include "hist.h"
+#ifdef __linux__
+#include "shm.h"
+#endif
+
+#define RX_BUF 65536
+#define IDLE_PER_SOURCE 20000 // idle connections per loopback source address, under the ephemeral range
+
+typedef struct {
+    int fd;
+#ifdef __linux__
+    shm_conn_t* shm; // set in -U mode, fd is then the eventfd the server wakes us through
+#endif
+    uint64_t* sent_at; // send time of each in-flight request, FIFO, `depth` entries
+    int sent_head;
+    int inflight;
+    size_t tx_left; // bytes of queued requests not yet written
+    size_t tx_off;  // position of the next byte within the request template
+    char* rx;
+    size_t rx_len;
+    hist_t hist;
+} conn_t;
+
+typedef struct {
+    const char* host;
+    int port;
+    int conns;
+    int depth;
+    int seconds;
+    size_t payload;
+    int groups;
+    int oneshot;
+    int fastopen;
+    int writes;
+    int reads;
+    const char* shm_path;
+    int idle;
+    int pid; // server, for -i's RSS and CPU figures
+} options_t;
+
+// one closed-loop run of the active connections
+typedef struct {
+    uint64_t requests;
+    double elapsed;
+    hist_t hist;
+    long long cpu_us; // server CPU time over the run, -1 without -P
+} phase_t;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int server_addr(const options_t* o, struct sockaddr_in* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port   = htons(o->port);
+    if (inet_pton(AF_INET, o->host, &addr->sin_addr) != 1) {
+        fprintf(stderr, "bad address %s\n", o->host);
+        return -1;
+    }
+    return 0;
+}
+
+static int connect_to(const options_t* o) {
+    struct sockaddr_in addr;
+    int one = 1;
+
+    if (server_addr(o, &addr) == -1) {
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+// queue k more requests, stamped with the time they were queued
+static void queue_requests(conn_t* c, int depth, size_t req_len, int k, uint64_t now) {
+    for (int i = 0; i < k; i++) {
+        c->sent_at[(c->sent_head + c->inflight) % depth] = now;
+        c->inflight++;
+    }
+    c->tx_left += (size_t)k * req_len;
+}
+
+// the template holds `depth` back to back copies of the request, so any run of queued
+// requests is a contiguous slice of it starting at tx_off
+static int flush_requests(conn_t* c, const char* tmpl, size_t req_len) {
+#ifdef __linux__
+    while (c->shm != NULL && c->tx_left > 0) {
+        ssize_t n = shm_produce(c->shm, tmpl + c->tx_off, c->tx_left);
+        if (n == -1) {
+            return -1;
+        }
+        if (n == 0) {
+            if (shm_wait_space(c->shm, 1)) {
+                return 0; // the server wakes us once it has consumed something
+            }
+            continue;
+        }
+        c->tx_left -= (size_t)n;
+        c->tx_off = (c->tx_off + (size_t)n) % req_len;
+    }
+#endif
+    while (c->tx_left > 0) {
+        ssize_t n = write(c->fd, tmpl + c->tx_off, c->tx_left);
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        c->tx_left -= (size_t)n;
+        c->tx_off = (c->tx_off + (size_t)n) % req_len;
+    }
+    return 0;
+}
+
+static void record_reply(conn_t* c, int depth, uint64_t now) {
+    if (c->inflight > 0) {
+        hist_record(&c->hist, (now - c->sent_at[c->sent_head]) / 1000);
+        c->sent_head = (c->sent_head + 1) % depth;
+        c->inflight--;
+    }
+}
+
+#ifdef __linux__
+// replies are parsed in place in the server -> client ring
+static int read_replies_shm(conn_t* c, int depth, uint64_t now) {
+    shm_conn_t* s = c->shm;
+    int replies   = 0;
+    proto_frame_t frame;
+    size_t len;
+
+    shm_drain_wakeups(s);
+    for (;;) {
+        ssize_t avail = shm_ring_used(&s->rx);
+        if (avail == -1) {
+            return -1; // the server broke the ring
+        }
+        size_t used = (size_t)avail;
+        if ((len = proto_parse(shm_ring_read_ptr(&s->rx), used, &frame)) > 0) {
+            record_reply(c, depth, now);
+            shm_consume(s, len);
+            replies++;
+        } else if (shm_prepare_sleep(s, used)) {
+            return replies;
+        }
+    }
+}
+#endif
+
+// Returns the number of replies received, -1 when the connection failed.
+static int read_replies(conn_t* c, int depth, uint64_t now) {
+#ifdef __linux__
+    if (c->shm != NULL) {
+        return read_replies_shm(c, depth, now);
+    }
+#endif
+    int replies = 0;
+    ssize_t n   = read(c->fd, c->rx + c->rx_len, RX_BUF - c->rx_len);
+
+    if (n == 0) {
+        return -1;
+    }
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    c->rx_len += (size_t)n;
+
+    size_t off = 0;
+    proto_frame_t frame;
+    size_t len;
+    while ((len = proto_parse(c->rx + off, c->rx_len - off, &frame)) > 0) {
+        off += len;
+        record_reply(c, depth, now);
+        replies++;
+    }
+    memmove(c->rx, c->rx + off, c->rx_len - off);
+    c->rx_len -= off;
+    return replies;
+}
+
+// server's resident set in kB, -1 if unknown
+static long proc_rss_kb(int pid) {
+    char path[64], line[256];
+    long kb = -1;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "VmRSS: %ld", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+// user + system CPU time the server has used, in microseconds, -1 if unknown
+static long long proc_cpu_us(int pid) {
+    char path[64], buf[1024];
+    unsigned long long utime, stime;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    // the command name in parentheses may hold spaces, fields are counted from its end
+    char* p = strrchr(buf, ')');
+    if (p == NULL || sscanf(p, ") %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+        return -1;
+    }
+    return (long long)((utime + stime) * 1000000ull / (unsigned long long)sysconf(_SC_CLK_TCK));
+}
+
+// Opens connection i of the idle set and has it exchange one HELLO, so the server has
+// accepted it and set it up by the time this returns. Returns the fd, blocking, or -1.
+static int connect_idle(const struct sockaddr_in* addr, int i) {
+    char hello[PROTO_HDR_SIZE], reply[PROTO_HDR_SIZE + 64];
+    size_t got = 0;
+    proto_frame_t frame;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    if ((ntohl(addr->sin_addr.s_addr) >> 24) == 127) {
+        struct sockaddr_in src = { 0 };
+        src.sin_family      = AF_INET;
+        src.sin_addr.s_addr = htonl(0x7f000001u + (uint32_t)(i / IDLE_PER_SOURCE));
+#ifdef IP_BIND_ADDRESS_NO_PORT
+        int one = 1;
+        setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one)); // port picked at connect
+#endif
+        if (bind(fd, (struct sockaddr*)&src, sizeof(src)) == -1) {
+            perror("bind");
+            close(fd);
+            return -1;
+        }
+    }
+    if (connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) == -1) {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    proto_encode_hdr(hello, PROTO_HELLO, 0);
+    if (write(fd, hello, sizeof(hello)) != (ssize_t)sizeof(hello)) {
+        perror("write");
+        close(fd);
+        return -1;
+    }
+    while (proto_parse(reply, got, &frame) == 0 && got < sizeof(reply)) {
+        ssize_t n = read(fd, reply + got, sizeof(reply) - got);
+        if (n <= 0) {
+            fprintf(stderr, "idle connection %d: %s\n", i, n == 0 ? "closed by the server" : strerror(errno));
+            close(fd);
+            return -1;
+        }
+        got += (size_t)n;
+    }
+    return fd;
+}
+
+static void report(const options_t* o, conn_t* conns, size_t req_len, uint64_t requests, double elapsed) {
+    hist_t all = { 0 };
+
+    printf("%d %sconnections, depth %d, %zu byte %s: %llu requests in %.2fs, %.0f req/s, %.1f MB/s sent\n",
+        o->conns, o->shm_path != NULL ? "shm " : "", o->depth, o->payload, o->writes ? "values" : o->reads ? "keys" : "payload",
+        (unsigned long long)requests, elapsed, (double)requests / elapsed,
+        (double)requests * (double)req_len / elapsed / 1e6);
+    printf("%-14s %10s %10s %10s %10s %10s\n", "conn index", "requests", "p50 us", "p99 us", "p99.9 us", "max us");
+
+    int per_group = (o->conns + o->groups - 1) / o->groups;
+    for (int g = 0; g * per_group < o->conns; g++) {
+        hist_t h = { 0 };
+        int lo   = g * per_group;
+        int hi   = lo + per_group < o->conns ? lo + per_group : o->conns;
+        for (int i = lo; i < hi; i++) {
+            hist_merge(&h, &conns[i].hist);
+        }
+        hist_merge(&all, &h);
+
+        char label[32];
+        snprintf(label, sizeof(label), "%d-%d", lo, hi - 1);
+        printf("%-14s %10llu %10llu %10llu %10llu %10llu\n",
+            label,
+            (unsigned long long)h.total,
+            (unsigned long long)hist_percentile(&h, 0.50),
+            (unsigned long long)hist_percentile(&h, 0.99),
+            (unsigned long long)hist_percentile(&h, 0.999),
+            (unsigned long long)h.max);
+    }
+    printf("%-14s %10llu %10llu %10llu %10llu %10llu\n",
+        "all",
+        (unsigned long long)all.total,
+        (unsigned long long)hist_percentile(&all, 0.50),
+        (unsigned long long)hist_percentile(&all, 0.99),
+        (unsigned long long)hist_percentile(&all, 0.999),
+        (unsigned long long)all.max);
+}
+
+// One exchange on a fresh connection, returns the latency in microseconds or -1.
+static long long oneshot_request(const options_t* o, const struct sockaddr_in* addr, const char* req, size_t req_len) {
+    char reply[PROTO_HDR_SIZE + 64];
+    size_t got = 0;
+    proto_frame_t frame;
+    // RST instead of FIN on close keeps thousands of short connections from piling up in TIME_WAIT
+    struct linger lg = { 1, 0 };
+    ssize_t n;
+
+    uint64_t t0 = now_ns();
+    int fd      = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+
+#ifdef MSG_FASTOPEN
+    if (o->fastopen) {
+        // connect and send in one go; without a cookie yet the kernel falls back to a normal
+        // handshake and sends the data after it, so this is always safe
+        n = sendto(fd, req, req_len, MSG_FASTOPEN, (const struct sockaddr*)addr, sizeof(*addr));
+    } else
+#endif
+    {
+        if (connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) == -1) {
+            perror("connect");
+            close(fd);
+            return -1;
+        }
+        n = write(fd, req, req_len);
+    }
+    if (n != (ssize_t)req_len) {
+        perror("send");
+        close(fd);
+        return -1;
+    }
+
+    while (proto_parse(reply, got, &frame) == 0 && got < sizeof(reply)) {
+        n = read(fd, reply + got, sizeof(reply) - got);
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        got += (size_t)n;
+    }
+    close(fd);
+    return (long long)((now_ns() - t0) / 1000);
+}
+
+static void run_oneshot(const options_t* o, const char* req, size_t req_len) {
+    struct sockaddr_in addr;
+    hist_t h = { 0 };
+
+    if (server_addr(o, &addr) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    uint64_t start    = now_ns();
+    uint64_t deadline = start + (uint64_t)o->seconds * 1000000000ull;
+    while (now_ns() < deadline) {
+        long long us = oneshot_request(o, &addr, req, req_len);
+        if (us < 0) {
+            exit(EXIT_FAILURE);
+        }
+        hist_record(&h, (uint64_t)us);
+    }
+    double elapsed = (double)(now_ns() - start) / 1e9;
+
+    printf("one-shot%s: %llu connections in %.2fs, %.0f conn/s\n",
+        o->fastopen ? " with TCP Fast Open" : "",
+        (unsigned long long)h.total,
+        elapsed,
+        (double)h.total / elapsed);
+    printf("p50 %llu us, p99 %llu us, p99.9 %llu us, max %llu us\n",
+        (unsigned long long)hist_percentile(&h, 0.50),
+        (unsigned long long)hist_percentile(&h, 0.99),
+        (unsigned long long)hist_percentile(&h, 0.999),
+        (unsigned long long)h.max);
+}
+
+// The closed loop: every connection keeps o->depth requests in flight for o->seconds.
+// Returns the replies received, latencies go to each connection's histogram.
+static uint64_t run_active(const options_t* o, conn_t* conns, struct pollfd* pfd, const char* tmpl, size_t req_len,
+    double* elapsed) {
+    uint64_t start    = now_ns();
+    uint64_t deadline = start + (uint64_t)o->seconds * 1000000000ull;
+    uint64_t requests = 0;
+
+    for (int i = 0; i < o->conns; i++) {
+        queue_requests(&conns[i], o->depth, req_len, o->depth, start);
+        flush_requests(&conns[i], tmpl, req_len);
+    }
+
+    uint64_t now = start;
+    while (now < deadline) {
+        for (int i = 0; i < o->conns; i++) {
+            // an eventfd is always writable, a full shm ring is waited out on POLLIN instead
+            pfd[i].events = POLLIN | (conns[i].tx_left > 0 && o->shm_path == NULL ? POLLOUT : 0);
+        }
+        if (poll(pfd, (nfds_t)o->conns, 100) == -1) {
+            perror("poll");
+            break;
+        }
+        now = now_ns();
+        for (int i = 0; i < o->conns; i++) {
+            conn_t* c = &conns[i];
+            if (pfd[i].revents & (POLLIN | POLLERR | POLLHUP)) {
+                int k = read_replies(c, o->depth, now);
+                if (k == -1) {
+                    fprintf(stderr, "connection %d lost\n", i);
+                    exit(EXIT_FAILURE);
+                }
+                requests += (uint64_t)k;
+                if (now < deadline) {
+                    queue_requests(c, o->depth, req_len, k, now);
+                }
+            }
+            if (c->tx_left > 0 && flush_requests(c, tmpl, req_len) == -1) {
+                fprintf(stderr, "connection %d lost\n", i);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    *elapsed = (double)(now - start) / 1e9;
+    return requests;
+}
+
+// Waits for the requests still in flight after a run, so the next one starts from empty
+// connections, and forgets their latencies.
+static void drain_active(const options_t* o, conn_t* conns, struct pollfd* pfd, const char* tmpl, size_t req_len) {
+    uint64_t deadline = now_ns() + 5000000000ull;
+    int busy          = 1;
+
+    while (busy && now_ns() < deadline) {
+        busy = 0;
+        for (int i = 0; i < o->conns; i++) {
+            busy |= conns[i].inflight > 0 || conns[i].tx_left > 0;
+            pfd[i].events = POLLIN | (conns[i].tx_left > 0 && o->shm_path == NULL ? POLLOUT : 0);
+        }
+        if (busy && poll(pfd, (nfds_t)o->conns, 100) > 0) {
+            for (int i = 0; i < o->conns; i++) {
+                if ((pfd[i].revents & (POLLIN | POLLERR | POLLHUP)) && read_replies(&conns[i], o->depth, 0) == -1) {
+                    fprintf(stderr, "connection %d lost\n", i);
+                    exit(EXIT_FAILURE);
+                }
+                if (conns[i].tx_left > 0 && flush_requests(&conns[i], tmpl, req_len) == -1) {
+                    fprintf(stderr, "connection %d lost\n", i);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+    }
+    if (busy) {
+        fprintf(stderr, "replies still missing 5 s after the run\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < o->conns; i++) {
+        memset(&conns[i].hist, 0, sizeof(hist_t));
+    }
+}
+
+static void run_phase(const options_t* o, conn_t* conns, struct pollfd* pfd, const char* tmpl, size_t req_len,
+    phase_t* ph) {
+    long long cpu0 = o->pid > 0 ? proc_cpu_us(o->pid) : -1;
+
+    memset(ph, 0, sizeof(*ph));
+    ph->requests   = run_active(o, conns, pfd, tmpl, req_len, &ph->elapsed);
+    long long cpu1 = o->pid > 0 ? proc_cpu_us(o->pid) : -1;
+    ph->cpu_us     = cpu0 != -1 && cpu1 != -1 ? cpu1 - cpu0 : -1;
+    for (int i = 0; i < o->conns; i++) {
+        hist_merge(&ph->hist, &conns[i].hist);
+    }
+    drain_active(o, conns, pfd, tmpl, req_len);
+}
+
+// -i: the active connections alone, then again with o->idle idle ones open
+static void run_idle(const options_t* o, conn_t* conns, struct pollfd* pfd, const char* tmpl, size_t req_len) {
+    struct sockaddr_in addr;
+    struct rlimit rl;
+    phase_t ph[2];
+    char label[32];
+
+    if (server_addr(o, &addr) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (rlim_t)o->conns + (rlim_t)o->idle + 16) {
+        fprintf(stderr, "%d connections need more than the %llu fds allowed, raise ulimit -n\n", o->conns + o->idle,
+            (unsigned long long)rl.rlim_cur);
+        exit(EXIT_FAILURE);
+    }
+    int* idle = malloc((size_t)o->idle * sizeof(int));
+    if (idle == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    run_phase(o, conns, pfd, tmpl, req_len, &ph[0]);
+
+    long rss0   = o->pid > 0 ? proc_rss_kb(o->pid) : -1;
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < o->idle; i++) {
+        if ((idle[i] = connect_idle(&addr, i)) == -1) {
+            fprintf(stderr, "opened %d of %d idle connections\n", i, o->idle);
+            exit(EXIT_FAILURE);
+        }
+    }
+    double opening = (double)(now_ns() - t0) / 1e9;
+    long rss1      = o->pid > 0 ? proc_rss_kb(o->pid) : -1;
+
+    run_phase(o, conns, pfd, tmpl, req_len, &ph[1]);
+
+    printf("%d active connections, depth %d, %zu byte payload; %d idle connections opened in %.2fs\n", o->conns,
+        o->depth, o->payload, o->idle, opening);
+    if (rss0 != -1 && rss1 != -1) {
+        printf("server RSS %.1f MB before the idle connections, %.1f MB with them: %.0f bytes per idle connection\n",
+            (double)rss0 / 1024, (double)rss1 / 1024, (double)(rss1 - rss0) * 1024 / o->idle);
+    } else {
+        printf("server RSS and CPU: pass the server's pid with -P\n");
+    }
+    snprintf(label, sizeof(label), "with %d idle", o->idle);
+    printf("%-22s %16s %16s\n", "", "active only", label);
+    printf("%-22s %16.0f %16.0f\n", "requests/s", (double)ph[0].requests / ph[0].elapsed,
+        (double)ph[1].requests / ph[1].elapsed);
+    if (ph[0].cpu_us != -1 && ph[1].cpu_us != -1) {
+        printf("%-22s %16.2f %16.2f\n", "server CPU us/request", (double)ph[0].cpu_us / (double)ph[0].requests,
+            (double)ph[1].cpu_us / (double)ph[1].requests);
+    }
+    const struct {
+        const char* name;
+        double q;
+    } rows[] = { { "p50 us", 0.50 }, { "p99 us", 0.99 }, { "p99.9 us", 0.999 } };
+    for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++) {
+        printf("%-22s %16llu %16llu\n", rows[i].name, (unsigned long long)hist_percentile(&ph[0].hist, rows[i].q),
+            (unsigned long long)hist_percentile(&ph[1].hist, rows[i].q));
+    }
+    printf("%-22s %16llu %16llu\n", "max us", (unsigned long long)ph[0].hist.max,
+        (unsigned long long)ph[1].hist.max);
+
+    for (int i = 0; i < o->idle; i++) {
+        close(idle[i]);
+    }
+    free(idle);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+        "usage: %s [-H host] [-p port] [-c conns] [-n depth] [-d seconds] [-s payload] [-g groups]\n"
+        "       [-1 [-T]] [-w | -r] [-U shm_socket_path] [-i idle_conns [-P server_pid]]\n",
+        prog);
+}
+
+int main(int argc, char** argv) {
+    options_t o = { "127.0.0.1", 9090, 100, 1, 5, 0, 10, 0, 0, 0, 0, NULL, 0, 0 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:p:c:n:d:s:g:1TwrU:i:P:h")) != -1) {
+        switch (opt) {
+        case 'H':
+            o.host = optarg;
+            break;
+        case 'p':
+            o.port = atoi(optarg);
+            break;
+        case 'c':
+            o.conns = atoi(optarg);
+            break;
+        case 'n':
+            o.depth = atoi(optarg);
+            break;
+        case 'd':
+            o.seconds = atoi(optarg);
+            break;
+        case 's':
+            o.payload = (size_t)atol(optarg);
+            break;
+        case 'g':
+            o.groups = atoi(optarg);
+            break;
+        case '1':
+            o.oneshot = 1;
+            break;
+        case 'T':
+            o.fastopen = 1;
+            break;
+        case 'w':
+            o.writes = 1;
+            break;
+        case 'r':
+            o.reads = 1;
+            break;
+        case 'U':
+            o.shm_path = optarg;
+            break;
+        case 'i':
+            o.idle = atoi(optarg);
+            break;
+        case 'P':
+            o.pid = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (o.conns < 1 || o.depth < 1 || o.groups < 1 || (o.writes && o.reads) || o.idle < 0 ||
+        (o.idle > 0 && (o.oneshot || o.shm_path != NULL))) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // a PROTO_SET payload is the 16-bit key length, the key and the value, a PROTO_GET one
+    // just the key (kv.h)
+    size_t key_len = o.writes || o.reads ? 8 : 0;
+    if (o.reads) {
+        o.payload = key_len; // what the report calls the request size
+    }
+    size_t body    = o.writes ? sizeof(uint16_t) + key_len + o.payload : o.reads ? key_len : o.payload;
+    size_t req_len = PROTO_HDR_SIZE + body;
+    char* tmpl     = calloc((size_t)o.depth, req_len);
+    for (int i = 0; i < o.depth; i++) {
+        char* req = tmpl + (size_t)i * req_len;
+        if (o.writes) {
+            uint16_t klen = htons((uint16_t)key_len);
+            char key[16];
+            proto_encode_hdr(req, PROTO_SET, body);
+            memcpy(req + PROTO_HDR_SIZE, &klen, sizeof(klen));
+            snprintf(key, sizeof(key), "key%05d", i % 100000);
+            memcpy(req + PROTO_HDR_SIZE + sizeof(klen), key, key_len);
+            memset(req + PROTO_HDR_SIZE + sizeof(klen) + key_len, 'v', o.payload);
+        } else if (o.reads) {
+            char key[16];
+            proto_encode_hdr(req, PROTO_GET, body);
+            snprintf(key, sizeof(key), "key%05d", i % 100000);
+            memcpy(req + PROTO_HDR_SIZE, key, key_len);
+        } else {
+            proto_encode_hdr(req, o.payload ? PROTO_DATA : PROTO_HELLO, o.payload);
+        }
+    }
+    if (o.oneshot) {
+        run_oneshot(&o, tmpl, req_len);
+        return 0;
+    }
+
+    conn_t* conns      = calloc((size_t)o.conns, sizeof(conn_t));
+    struct pollfd* pfd = calloc((size_t)o.conns, sizeof(struct pollfd));
+    for (int i = 0; i < o.conns; i++) {
+        if (o.shm_path != NULL) {
+#ifdef __linux__
+            conns[i].shm = malloc(sizeof(shm_conn_t));
+            if (shm_connect(o.shm_path, conns[i].shm) == -1) {
+                exit(EXIT_FAILURE);
+            }
+            shm_prepare_sleep(conns[i].shm, 0); // nothing to read until the first reply
+            conns[i].fd = conns[i].shm->my_efd;
+#else
+            fprintf(stderr, "the shared-memory transport needs Linux\n");
+            exit(EXIT_FAILURE);
+#endif
+        } else {
+            conns[i].fd = connect_to(&o);
+        }
+        conns[i].sent_at = calloc((size_t)o.depth, sizeof(uint64_t));
+        conns[i].rx      = malloc(RX_BUF);
+        if (conns[i].fd == -1) {
+            exit(EXIT_FAILURE);
+        }
+        pfd[i].fd = conns[i].fd;
+    }
+
+    if (o.idle > 0) {
+        run_idle(&o, conns, pfd, tmpl, req_len);
+        return 0;
+    }
+    double elapsed;
+    uint64_t requests = run_active(&o, conns, pfd, tmpl, req_len, &elapsed);
+    report(&o, conns, req_len, requests, elapsed);
+    return 0;
+}
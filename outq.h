@@ -0,0 +1,145 @@
+#ifndef OUTQ_H
+#define OUTQ_H
+
+// Per-connection output queue: a chain of fixed-size blocks taken from the buffer pool.
+//
+// Handlers only append; nothing is written until the reactor flushes the queue at the end of
+// the loop iteration, at which point every block is handed to a single writev(). A partial
+// write just advances the head block's start and the rest waits for EV_WRITE.
+
+#include <sys/uio.h>
+#include <string.h>
+#include "bufpool.h"
+
+#define OUTQ_BLOCK_SIZE (16 * 1024)
+#define OUTQ_MAX_IOV 64
+
+typedef struct outq_block {
+    struct outq_block* next;
+    size_t start; // first unsent byte
+    size_t end;   // one past the last queued byte
+    char data[];
+} outq_block_t;
+
+#define OUTQ_BLOCK_DATA (OUTQ_BLOCK_SIZE - sizeof(outq_block_t))
+
+typedef struct {
+    outq_block_t* head;
+    outq_block_t* tail;
+    size_t bytes; // queued and not yet written
+} outq_t;
+
+// Drops everything queued after the first keep bytes, returning the blocks that held it to
+// the pool. Used to take back an append that ran out of memory halfway.
+static inline void outq_truncate(outq_t* q, bufpool_t* pool, size_t keep) {
+    outq_block_t* last = NULL;
+    size_t left        = keep;
+
+    for (outq_block_t* b = q->head; b != NULL && left > 0; b = b->next) {
+        size_t n = b->end - b->start;
+        if (n >= left) {
+            b->end = b->start + left;
+            n      = left;
+        }
+        left -= n;
+        last = b;
+    }
+    outq_block_t* b = last != NULL ? last->next : q->head;
+    while (b != NULL) {
+        outq_block_t* next = b->next;
+        bufpool_put(pool, b, OUTQ_BLOCK_SIZE);
+        b = next;
+    }
+    if (last != NULL) {
+        last->next = NULL;
+    } else {
+        q->head = NULL;
+    }
+    q->tail  = last;
+    q->bytes = keep;
+}
+
+// All of data or none of it: an append that cannot get a block leaves the queue as it was.
+static inline int outq_append(outq_t* q, bufpool_t* pool, const void* data, size_t len) {
+    const char* p = data;
+    size_t total  = len;
+
+    while (len > 0) {
+        outq_block_t* b = q->tail;
+        if (b == NULL || b->end == OUTQ_BLOCK_DATA) {
+            b = bufpool_get(pool, OUTQ_BLOCK_SIZE);
+            if (b == NULL) {
+                outq_truncate(q, pool, q->bytes);
+                return -1;
+            }
+            b->next  = NULL;
+            b->start = 0;
+            b->end   = 0;
+            if (q->tail == NULL) {
+                q->head = b;
+            } else {
+                q->tail->next = b;
+            }
+            q->tail = b;
+        }
+        size_t n = OUTQ_BLOCK_DATA - b->end;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(b->data + b->end, p, n);
+        b->end += n;
+        p += n;
+        len -= n;
+    }
+    q->bytes += total;
+    return 0;
+}
+
+// Drops n bytes from the front of the queue, returning emptied blocks to the pool.
+static inline void outq_consume(outq_t* q, bufpool_t* pool, size_t n) {
+    q->bytes -= n;
+    while (n > 0 && q->head != NULL) {
+        outq_block_t* b = q->head;
+        size_t avail    = b->end - b->start;
+        if (n < avail) {
+            b->start += n;
+            return;
+        }
+        n -= avail;
+        q->head = b->next;
+        bufpool_put(pool, b, OUTQ_BLOCK_SIZE);
+    }
+    if (q->head == NULL) {
+        q->tail = NULL;
+    }
+}
+
+static inline void outq_clear(outq_t* q, bufpool_t* pool) {
+    outq_consume(q, pool, q->bytes);
+}
+
+// One writev() over as many queued blocks as fit in an iovec array, and at most max bytes.
+// *offered is set to the number of bytes handed to the kernel, so a return value below it
+// means a short write. Returns the number of bytes written, or -1 with errno set.
+static inline ssize_t outq_writev(outq_t* q, bufpool_t* pool, int fd, size_t max, size_t* offered) {
+    struct iovec iov[OUTQ_MAX_IOV];
+    int n    = 0;
+    *offered = 0;
+
+    for (outq_block_t* b = q->head; b != NULL && n < OUTQ_MAX_IOV && *offered < max; b = b->next) {
+        iov[n].iov_base = b->data + b->start;
+        iov[n].iov_len  = b->end - b->start;
+        if (iov[n].iov_len > max - *offered) {
+            iov[n].iov_len = max - *offered;
+        }
+        *offered += iov[n].iov_len;
+        n++;
+    }
+    ssize_t written = writev(fd, iov, n);
+    if (written > 0) {
+        outq_consume(q, pool, (size_t)written);
+    }
+    return written;
+}
+
+#endif
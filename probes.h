@@ -0,0 +1,95 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT (SystemTap SDT) probes, provider "reactor". Each probe is a single nop in the code
+// plus a note in the binary saying where the nop is and where its arguments live.
+// perf, bpftrace and SystemTap read the note and patch in a breakpoint only while they are
+// attached. With nobody attached, a probe costs the nop and putting its arguments in
+// registers. There is no flag to check and no rebuild to turn them on:
+//
+//     bpftrace -l 'usdt:./reactor:*'
+//     bpftrace -p $(pidof reactor) dispatch_latency.bt   # and the other *.bt scripts
+//
+// With <sys/sdt.h> (systemtap-sdt-dev / systemtap-sdt-devel) they are its DTRACE_PROBEn.
+// Without it, x86-64 builds emit the same note themselves, and other targets compile the
+// probes out. -DREACTOR_NO_PROBES compiles them out everywhere.
+//
+// Probes and their arguments, fd first unless noted:
+//   accept(fd, slot)              a connection got a slot (also adopted and shm ones)
+//   read(fd, bytes)               bytes read from a socket, 0 at EOF
+//   frame(fd, type, len)          a frame was parsed, its handler runs next
+//   dispatch_done(fd, type, rc)   its handler returned; frame -> dispatch_done is handler time
+//   write(fd, bytes, offered)     one writev of queued replies, a short one when bytes < offered
+//   close(fd, slot)
+//   wake(events)                  the loop returned from its wait with that many ready fds
+//   sleep(timeout_ms)             the loop is about to wait; sleep -> wake is time spent idle
+
+#include <stdint.h>
+
+#if defined(REACTOR_NO_PROBES)
+#define REACTOR_PROBES 0
+#elif defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define REACTOR_PROBES 1
+#endif
+#endif
+
+#if !defined(REACTOR_PROBES) && defined(__x86_64__) && defined(__ELF__)
+#define REACTOR_PROBES 2
+#endif
+
+#if REACTOR_PROBES == 1
+
+#define REACTOR_PROBE1(name, a) DTRACE_PROBE1(reactor, name, a)
+#define REACTOR_PROBE2(name, a, b) DTRACE_PROBE2(reactor, name, a, b)
+#define REACTOR_PROBE3(name, a, b, c) DTRACE_PROBE3(reactor, name, a, b, c)
+
+#elif REACTOR_PROBES == 2
+
+// The layout sys/sdt.h writes: a nop, a .note.stapsdt entry holding the nop's address, the
+// address of _.stapsdt.base (lets tools correct for prelink), no semaphore, provider, name and
+// one "size@operand" per argument. Every argument is widened to a signed 64-bit value.
+#define REACTOR_PROBE_ASM(name, args, ...)                                                          \
+    __asm__ __volatile__("990: nop\n"                                                                \
+                         ".pushsection .note.stapsdt,\"\",\"note\"\n"                                \
+                         ".balign 4\n"                                                               \
+                         ".4byte 992f-991f, 994f-993f, 3\n"                                          \
+                         "991: .asciz \"stapsdt\"\n"                                                 \
+                         "992: .balign 4\n"                                                          \
+                         "993: .8byte 990b\n"                                                        \
+                         ".8byte _.stapsdt.base\n"                                                   \
+                         ".8byte 0\n"                                                                \
+                         ".asciz \"reactor\"\n"                                                      \
+                         ".asciz \"" #name "\"\n"                                                    \
+                         ".asciz \"" args "\"\n"                                                     \
+                         "994: .balign 4\n"                                                          \
+                         ".popsection\n"                                                             \
+                         ".ifndef _.stapsdt.base\n"                                                  \
+                         ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"     \
+                         ".weak _.stapsdt.base\n"                                                    \
+                         ".hidden _.stapsdt.base\n"                                                  \
+                         "_.stapsdt.base: .space 1\n"                                                \
+                         ".size _.stapsdt.base, 1\n"                                                 \
+                         ".popsection\n"                                                             \
+                         ".endif\n"                                                                  \
+                         :                                                                           \
+                         : __VA_ARGS__)
+
+#define REACTOR_PROBE_ARG(x) "nor"((int64_t)(x))
+
+#define REACTOR_PROBE1(name, a) REACTOR_PROBE_ASM(name, "-8@%0", REACTOR_PROBE_ARG(a))
+#define REACTOR_PROBE2(name, a, b) REACTOR_PROBE_ASM(name, "-8@%0 -8@%1", REACTOR_PROBE_ARG(a), REACTOR_PROBE_ARG(b))
+#define REACTOR_PROBE3(name, a, b, c)                                                               \
+    REACTOR_PROBE_ASM(name, "-8@%0 -8@%1 -8@%2", REACTOR_PROBE_ARG(a), REACTOR_PROBE_ARG(b), REACTOR_PROBE_ARG(c))
+
+#else
+
+// sizeof keeps the arguments used without evaluating them
+#define REACTOR_PROBE1(name, a) ((void)sizeof(a))
+#define REACTOR_PROBE2(name, a, b) ((void)sizeof(a), (void)sizeof(b))
+#define REACTOR_PROBE3(name, a, b, c) ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c))
+
+#endif
+
+#endif
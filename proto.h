@@ -0,0 +1,83 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+// Wire protocol shared by server.c, the reactor and the tools.
+// A frame is a proto_hdr_t (type and len in network byte order) followed by len payload bytes.
+//
+// The payload length is 32 bits: len holds the low 16 bits and len_hi the high 16 bits. len_hi
+// sits in what used to be struct padding, so the header is still 8 bytes and every frame an
+// older sender produced (zeroed buffer, len_hi == 0) decodes to the same length as before.
+
+#include <stddef.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+typedef enum {
+    PROTO_HELLO,
+    PROTO_DATA, // opaque bytes, acknowledged with a PROTO_DATA frame holding the 32-bit count
+    PROTO_SET,  // store a value (layouts in kv.h), acknowledged with a PROTO_SET holding 1
+    PROTO_GET,  // answered with a PROTO_GET carrying the value, empty when the key is not set
+    PROTO_DEL,  // acknowledged with a PROTO_DEL holding 1 if the key was set, else 0
+    PROTO_SNAPSHOT, // start a snapshot of the store (snapshot.h), answered with 1, or 0 while
+                    // the previous one is still being written
+    PROTO_REPLICATE, // sent by a follower to become one; the leader ends its copy of the
+                     // store with one carrying its position and key count (repl.h)
+    PROTO_POSITION,  // leader -> follower: position and wall-clock time; from a client, answered
+                     // with the server's position and replication lag in microseconds
+    PROTO_ADMIN,     // a text command for the server ("help" lists them), answered with a
+                     // PROTO_ADMIN carrying text; only taken from same-host clients
+} proto_type_e;
+
+typedef struct {
+    proto_type_e type;
+    unsigned short len;
+    unsigned short len_hi;
+} proto_hdr_t;
+
+#define PROTO_HDR_SIZE sizeof(proto_hdr_t)
+#define PROTO_MAX_PAYLOAD 0xffffffffUL
+
+// a parsed frame; payload points into the receive buffer, nothing is copied
+typedef struct {
+    proto_type_e type;
+    size_t len;
+    const char* payload;
+} proto_frame_t;
+
+// a slice of a streamed payload: data holds payload bytes [offset, offset + n) of len,
+// the last chunk is the one with offset + n == len
+typedef struct {
+    proto_type_e type;
+    size_t len;
+    size_t offset;
+    const char* data;
+    size_t n;
+} proto_chunk_t;
+
+static inline void proto_encode_hdr(void* dst, proto_type_e type, size_t len) {
+    proto_hdr_t hdr = { 0 };
+    hdr.type        = htonl(type);
+    hdr.len         = htons((unsigned short)(len & 0xffff));
+    hdr.len_hi      = htons((unsigned short)(len >> 16));
+    memcpy(dst, &hdr, sizeof(hdr));
+}
+
+// Returns the size of the frame at p, 0 when fewer than a whole frame is available.
+// memcpy instead of a cast because p can sit at any offset inside the receive buffer.
+static inline size_t proto_parse(const char* p, size_t avail, proto_frame_t* frame) {
+    proto_hdr_t hdr;
+
+    if (avail < PROTO_HDR_SIZE) {
+        return 0;
+    }
+    memcpy(&hdr, p, sizeof(hdr));
+    frame->type    = (proto_type_e)ntohl(hdr.type);
+    frame->len     = ((size_t)ntohs(hdr.len_hi) << 16) | ntohs(hdr.len);
+    frame->payload = p + PROTO_HDR_SIZE;
+    if (avail < PROTO_HDR_SIZE + frame->len) {
+        return 0;
+    }
+    return PROTO_HDR_SIZE + frame->len;
+}
+
+#endif
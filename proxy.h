@@ -0,0 +1,217 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+// L4 proxy mode. Included by reactor.h once the connection types and reactor_mark_dirty exist.
+//
+// Every accepted client is paired with a fresh connection to the upstream, and the two slots
+// point at each other through `peer`. Each half owns a pipe holding the bytes it received that
+// are on their way to the other half: splice() moves them socket -> pipe on EV_READ and
+// pipe -> socket when the other half is flushed, so payload never crosses into user space.
+//
+// The pipe is the whole buffer: a half whose pipe is full stops being read until its peer
+// has drained some of it, so a slow receiver slows down the sender and nothing else. EOF is
+// passed on as shutdown(SHUT_WR) once everything before it has been delivered; the pair is
+// closed when both directions are done.
+
+#ifdef __linux__
+
+#include <fcntl.h>
+
+#define PROXY_PIPE_SIZE (256 * 1024)
+
+static inline int proxy_pipe(clientstate_t* c) {
+    if (pipe2(c->pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+        return -1;
+    }
+    // the kernel rounds up to whole pages; without the privilege for this size the default stays
+    int cap     = fcntl(c->pipe[1], F_SETPIPE_SZ, PROXY_PIPE_SIZE);
+    c->pipe_cap = cap > 0 ? (size_t)cap : (size_t)fcntl(c->pipe[1], F_GETPIPE_SZ);
+    return 0;
+}
+
+static inline void proxy_pipe_close(clientstate_t* c) {
+    if (c->pipe[0] != -1) {
+        close(c->pipe[0]);
+        close(c->pipe[1]);
+    }
+    c->pipe[0] = c->pipe[1] = -1;
+    c->piped                = 0;
+}
+
+// Opens the upstream connection for the client in slot and pairs the two.
+// Returns the upstream's slot, or -1 if the client has to be closed.
+static inline int reactor_proxy_pair(reactor_t* r, int slot) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket upstream");
+        return -1;
+    }
+    // the connect completes in the background; until it does a splice into the socket just
+    // reports EAGAIN and a refused connect shows up as an error on the next read
+    if (connect(fd, (const struct sockaddr*)r->upstream, sizeof(*r->upstream)) == -1 && errno != EINPROGRESS) {
+        perror("connect upstream");
+        close(fd);
+        return -1;
+    }
+    int up = find_free_slot(r);
+    if (up == -1 || fd >= r->fd_cap) {
+        printf("Server full, no slot for the upstream connection\n");
+        close(fd);
+        if (up != -1) {
+            r->free_slots[r->n_free++] = up;
+        }
+        return -1;
+    }
+    clientstate_t* c = &r->clients[slot];
+    clientstate_t* u = &r->clients[up];
+    if (proxy_pipe(c) == -1 || proxy_pipe(u) == -1) {
+        perror("pipe2");
+        proxy_pipe_close(c);
+        close(fd);
+        r->free_slots[r->n_free++] = up;
+        return -1;
+    }
+    reactor_set_flush_policy(r, up, fd, r->flush_policy);
+    u->fd          = fd;
+    u->state       = STATE_CONNECTED;
+    u->peer        = slot;
+    c->peer        = up;
+    r->fd_slot[fd] = up;
+    r->stats.proxy_pairs++;
+    reactor_seg_conn(r, up, 0, 0);
+    if (r->verbose) {
+        printf("fd %d paired with upstream fd %d (slot %d)\n", c->fd, fd, up);
+    }
+    return up;
+}
+
+// socket -> own pipe. Returns -1 when the pair has to be closed.
+static inline int reactor_proxy_on_readable(reactor_t* r, int slot) {
+    clientstate_t* c = &r->clients[slot];
+    size_t room      = c->pipe_cap - c->piped;
+
+    if (c->rx_eof) {
+        return 0;
+    }
+    if (room == 0) {
+        c->pipe_full = 1;
+        return 0;
+    }
+    ssize_t n = splice(c->fd, NULL, c->pipe[1], NULL, room < r->rx_budget ? room : r->rx_budget,
+        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n == 0) {
+        c->rx_eof = 1;
+        reactor_mark_dirty(r, c->peer); // pass the EOF on once the pipe is drained
+        return 0;
+    }
+    if (n < 0) {
+        if (errno == EAGAIN && c->piped > 0) {
+            // pipe space goes by page, not by byte: a pipe holding many small segments can be
+            // full before piped reaches pipe_cap, and with the socket still readable a
+            // level-triggered backend would spin. Wait for the peer to drain it instead.
+            c->pipe_full = 1;
+        }
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    c->piped += (size_t)n;
+    c->spliced += (unsigned long long)n;
+    r->stats.rx_bytes += (size_t)n;
+    reactor_seg_conn(r, slot, (size_t)n, 0);
+    reactor_mark_dirty(r, c->peer);
+    return 0;
+}
+
+// peer's pipe -> socket. Returns -1 on a write error or when both directions are finished.
+static inline int reactor_proxy_flush(reactor_t* r, int slot) {
+    clientstate_t* c   = &r->clients[slot];
+    clientstate_t* src = &r->clients[c->peer];
+    size_t moved       = 0;
+
+    while (src->piped > 0) {
+        ssize_t n = splice(src->pipe[0], NULL, c->fd, NULL, src->piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        r->stats.tx_syscalls++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        src->piped -= (size_t)n;
+        moved += (size_t)n;
+        r->stats.tx_bytes += (size_t)n;
+    }
+    if (moved > 0) {
+        reactor_seg_conn(r, slot, 0, moved);
+    }
+    if (moved > 0 && src->pipe_full) {
+        src->pipe_full = 0;
+        reactor_mark_dirty(r, c->peer); // its sync turns EV_READ back on
+    }
+    if (src->piped == 0 && src->rx_eof && !c->tx_shut) {
+        shutdown(c->fd, SHUT_WR);
+        c->tx_shut = 1;
+    }
+    return c->tx_shut && src->tx_shut ? -1 : 0;
+}
+
+static inline unsigned reactor_proxy_wanted_events(reactor_t* r, clientstate_t* c) {
+    return (c->rx_eof || c->pipe_full ? 0 : EV_READ) | (r->clients[c->peer].piped > 0 ? EV_WRITE : 0);
+}
+
+// Called for each half while its slot is released; the pair is always closed together.
+static inline void reactor_proxy_unpair(reactor_t* r, clientstate_t* c) {
+    clientstate_t* p = &r->clients[c->peer];
+
+    r->stats.proxy_bytes += c->spliced;
+    if (r->verbose && p->fd != -1) {
+        printf("proxy pair fd %d <-> fd %d closed: %llu bytes forwarded one way, %llu the other\n",
+            c->fd,
+            p->fd,
+            c->spliced,
+            p->spliced);
+    }
+    proxy_pipe_close(c);
+    c->peer      = -1;
+    c->spliced   = 0;
+    c->rx_eof    = 0;
+    c->tx_shut   = 0;
+    c->pipe_full = 0;
+}
+
+#else
+
+static inline int reactor_proxy_pair(reactor_t* r, int slot) {
+    (void)r;
+    (void)slot;
+    return -1;
+}
+
+static inline int reactor_proxy_on_readable(reactor_t* r, int slot) {
+    (void)r;
+    (void)slot;
+    return -1;
+}
+
+static inline int reactor_proxy_flush(reactor_t* r, int slot) {
+    (void)r;
+    (void)slot;
+    return -1;
+}
+
+static inline unsigned reactor_proxy_wanted_events(reactor_t* r, clientstate_t* c) {
+    (void)r;
+    (void)c;
+    return 0;
+}
+
+static inline void reactor_proxy_unpair(reactor_t* r, clientstate_t* c) {
+    (void)r;
+    c->peer = -1;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,914 @@
+// One server, four readiness backends.
+//
+// Runtime-selected build, every backend available behind -b (handy for benchmarking them
+// from one binary):
+//     cc -O2 -pthread reactor.c -o reactor && ./reactor -b epoll
+// Single-backend build, only that loop is compiled in:
+//     cc -O2 -pthread -DREACTOR_BACKEND=epoll reactor.c -o reactor_epoll
+//
+// Backends: select, poll, and on Linux epoll and uring (io_uring).
+//
+// -t N runs N independent loops, each with its own SO_REUSEPORT listener and pinned to CPU i;
+// -S additionally steers every connection to the loop on the CPU that received it.
+//
+// TLS (kernel TLS after an OpenSSL handshake, see tls.h) needs
+//     cc -O2 -pthread -DREACTOR_TLS reactor.c -o reactor -lssl -lcrypto
+// and is switched on with -C cert.pem -K key.pem.
+//
+// -U path (Linux) also serves same-host clients over shared memory (see shm.h): they connect
+// to the Unix socket at path and then exchange the same frames through a pair of rings.
+//
+// -X host:port (Linux) turns the server into an L4 proxy: no frames are parsed, every client
+// is paired with a connection to host:port and bytes are spliced between the two (proxy.h).
+//
+// -L host:port,host:port,... is the frame-aware proxy instead (l7.h): frames are routed to
+// those backends over -N pooled upstream connections per backend, PROTO_DATA by key hash
+// unless -R type routes everything by frame type.
+//
+// -J path makes the server a key/value store (kv.h) serving PROTO_SET / PROTO_GET / PROTO_DEL,
+// durable through an append-only log at path with group commit every -G microseconds (wal.h).
+// It keeps one store, so it runs a single loop. A PROTO_SNAPSHOT frame, or the log growing
+// past -Z bytes, writes a copy-on-write snapshot from a forked child and truncates the log
+// (snapshot.h); restarts then map the snapshot and only replay what came after it.
+//
+// -O host:port makes it a read-only follower of the store server at host:port instead
+// (repl.h): it keeps a copy in memory, fed by the leader, and serves PROTO_GET from it.
+//
+// -Q path records every frame clients send, with its arrival time, into a capture file of at
+// most -q MB (capture.h) that replay.c plays back against any server.
+//
+// -E keeps a flight recorder per connection (flight.h): its last events, which reactorctl.c
+// dumps for one fd with `reactorctl flight <fd>` while the loop goes on serving.
+//
+// -m path publishes the counters and a summary of every connection into a memory-mapped
+// stats segment (statseg.h), which statstop.c shows without ever talking to the server.
+//
+// -T auto|tsc|mono|coarse picks the clock the loops read once per wakeup (clock.h).
+
+#include "reactor.h"
+#include "backend_select.h"
+#include "backend_poll.h"
+#include "backend_epoll.h"
+#include "backend_uring.h"
+#include "l7.h"
+#include "wal.h"
+#include "snapshot.h"
+#include "repl.h"
+#include "capture.h"
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#define PORT 9090
+
+#define STR2(x) #x
+#define STR(x) STR2(x)
+#define RUN_FN2(x) reactor_run_##x
+#define RUN_FN(x) RUN_FN2(x)
+
+// queues a reply frame carrying one 32-bit value
+static int reactor_reply(reactor_t* r, int slot, proto_type_e type, unsigned int value) {
+    unsigned int body = htonl(value);
+    return reactor_send_frame(r, slot, type, &body, sizeof(body));
+}
+
+typedef struct {
+    kv_t kv;
+    wal_t wal;
+    snap_t snap;
+    repl_t repl;
+} store_t;
+
+// -J / -O: the key/value state, only ever touched by the one loop
+static store_t* store = NULL;
+
+// Mutations are applied and logged at once; their acknowledgement, and every reply queued
+// after it, waits for the commit that makes them durable. A read waits as well while
+// anything is uncommitted, it may have seen it.
+static int store_handle(reactor_t* r, int slot, const proto_frame_t* frame) {
+    repl_t* rp = &store->repl;
+    const char* key;
+    size_t klen;
+
+    if (frame->type == PROTO_POSITION) {
+        char pos[16];
+        repl_put64(pos, rp->following ? rp->leader_seq : rp->seq);
+        repl_put64(pos + 8, rp->following ? (uint64_t)rp->lag_us : 0);
+        return reactor_send_frame(r, slot, PROTO_POSITION, pos, sizeof(pos));
+    }
+    if (rp->following && frame->type != PROTO_GET) {
+        if (r->verbose) {
+            printf("fd %d: a follower only serves reads\n", r->clients[slot].fd);
+        }
+        return -1;
+    }
+    if (frame->type == PROTO_REPLICATE) {
+        return repl_add_follower(rp, &store->kv, &store->wal, r, slot);
+    }
+    if (frame->type == PROTO_SNAPSHOT) {
+        int rc = snap_start(&store->snap, &store->kv, &store->wal, r);
+        return rc == -1 ? -1 : reactor_reply(r, slot, PROTO_SNAPSHOT, (unsigned int)rc);
+    }
+    if (kv_frame_key(frame, &key, &klen) == -1) {
+        return -1;
+    }
+    if (frame->type == PROTO_GET) {
+        const kv_rec_t* rec = kv_get(&store->kv, key, klen);
+        if (wal_wait(&store->wal, r, slot) == -1) {
+            return -1;
+        }
+        return reactor_send_frame(r, slot, PROTO_GET, rec != NULL ? kv_value(rec) : NULL, rec != NULL ? rec->vlen : 0);
+    }
+    if (wal_append(&store->wal, frame) == -1) {
+        return -1; // neither logged nor applied, only this client notices
+    }
+    int rc = kv_apply(&store->kv, frame);
+    if (rc == -1) {
+        // logged already, so carrying on would let the log and the store disagree
+        perror("store");
+        exit(EXIT_FAILURE);
+    }
+    repl_forward(rp, &store->wal, r, frame);
+    if (wal_wait(&store->wal, r, slot) == -1) {
+        return -1;
+    }
+    return reactor_reply(r, slot, frame->type, frame->type == PROTO_SET ? 1 : (unsigned int)rc);
+}
+
+// A shm client's payload sits in a ring the client can still write to. A mutation is read
+// several times (key check, log, store, followers), so it works on one private copy: a
+// payload rewritten in between could otherwise leave the log and the store disagreeing.
+static int store_dispatch(reactor_t* r, int slot, const proto_frame_t* frame) {
+    if (r->clients[slot].shm == NULL || (frame->type != PROTO_SET && frame->type != PROTO_DEL) || frame->len == 0) {
+        return store_handle(r, slot, frame);
+    }
+    proto_frame_t f = *frame;
+    char* copy      = bufpool_get(&r->pool, frame->len);
+
+    if (copy == NULL) {
+        return -1;
+    }
+    memcpy(copy, frame->payload, frame->len);
+    f.payload = copy;
+    int rc    = store_handle(r, slot, &f);
+    bufpool_put(&r->pool, copy, frame->len);
+    return rc;
+}
+
+// -Q: the loop's capture writer, set in each loop's thread
+static __thread cap_writer_t* capture = NULL;
+
+// what the capture keeps: frames from clients, not the replies of upstreams or a leader's stream
+static int capture_wanted(reactor_t* r, int slot) {
+    if (capture == NULL) {
+        return 0;
+    }
+    if (r->user != NULL) {
+        return ((l7_t*)r->user)->slots[slot].backend == -1;
+    }
+    return store == NULL || slot != store->repl.leader;
+}
+
+// every loop, for admin commands that look at all of them; written before the loops start
+static reactor_t** loops = NULL;
+static int n_loops       = 0;
+
+#define ADMIN_REPLY_MAX (64 * 1024)
+
+// admin commands are for whoever runs the server, so only same-host peers may send them
+static int admin_allowed(reactor_t* r, int slot) {
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+
+    if (r->clients[slot].shm != NULL) {
+        return 1;
+    }
+    if (getpeername(r->clients[slot].fd, (struct sockaddr*)&peer, &len) == -1 || peer.sin_family != AF_INET) {
+        return 0;
+    }
+    return (ntohl(peer.sin_addr.s_addr) >> 24) == 127;
+}
+
+// The connection on fd in any loop. Other loops are read without stopping them: the slot can
+// change hands meanwhile, which a flight dump shows as the new connection's accept.
+static reactor_t* admin_find(int fd, int* slot) {
+    for (int i = 0; i < n_loops; i++) {
+        if (fd >= 0 && fd < loops[i]->fd_cap && (*slot = __atomic_load_n(&loops[i]->fd_slot[fd], __ATOMIC_RELAXED)) != -1) {
+            return loops[i];
+        }
+    }
+    return NULL;
+}
+
+static size_t admin_run(reactor_t* r, const char* cmd, char* out, size_t cap) {
+    int fd, slot;
+
+    if (sscanf(cmd, "flight %d", &fd) == 1) {
+        reactor_t* owner = admin_find(fd, &slot);
+        if (owner == NULL) {
+            return (size_t)snprintf(out, cap, "no connection on fd %d\n", fd);
+        }
+        if (owner->flight == NULL) {
+            return (size_t)snprintf(out, cap, "the flight recorder is off, start the server with -E\n");
+        }
+        return flight_format(&owner->flight[slot], out, cap);
+    }
+    if (strcmp(cmd, "conns") == 0) {
+        // only this loop's slots: another loop's slot state is written with plain stores
+        // while it runs, there is no reading it from here without a race
+        size_t len = 0;
+        int loop   = 0;
+        while (loop < n_loops && loops[loop] != r) {
+            loop++;
+        }
+        for (int s = 0; s < r->max_clients && len < cap; s++) {
+            const clientstate_t* c = &r->clients[s];
+            if (c->fd != -1) {
+                len += (size_t)snprintf(out + len, cap - len, "loop %d slot %d fd %d, %zu bytes queued\n",
+                    loop, s, c->fd, c->tx.bytes);
+            }
+        }
+        return len < cap ? len : cap - 1;
+    }
+    return (size_t)snprintf(out, cap,
+        "conns        the open connections of the loop that answers, and their fds\n"
+        "flight <fd>  the last %d events on that connection (needs -E)\n",
+        FLIGHT_EVENTS);
+}
+
+static int admin_dispatch(reactor_t* r, int slot, const proto_frame_t* frame) {
+    char cmd[128];
+    size_t n = frame->len < sizeof(cmd) - 1 ? frame->len : sizeof(cmd) - 1;
+
+    if (!admin_allowed(r, slot)) {
+        if (r->verbose) {
+            printf("fd %d: admin command from another host refused\n", r->clients[slot].fd);
+        }
+        return -1;
+    }
+    memcpy(cmd, frame->payload, n);
+    cmd[n]    = '\0';
+    char* out = malloc(ADMIN_REPLY_MAX);
+    if (out == NULL) {
+        return -1;
+    }
+    size_t len = admin_run(r, cmd, out, ADMIN_REPLY_MAX);
+    int rc     = reactor_send_frame(r, slot, PROTO_ADMIN, out, len);
+    free(out);
+    return rc;
+}
+
+// PROTO_HELLO is answered the way server.c's handle_client does: a HELLO carrying version 1.
+// PROTO_DATA is acknowledged with the number of payload bytes received.
+static int reactor_dispatch(reactor_t* r, int slot, const proto_frame_t* frame) {
+    clientstate_t* c = &r->clients[slot];
+
+    if (frame->type == PROTO_ADMIN && (r->user == NULL || ((l7_t*)r->user)->slots[slot].backend == -1)) {
+        return admin_dispatch(r, slot, frame);
+    }
+    if (capture_wanted(r, slot)) {
+        cap_frame(capture, slot, frame, 1);
+    }
+    if (r->user != NULL) {
+        return l7_dispatch(r, slot, frame);
+    }
+    if (store != NULL && slot == store->repl.leader) {
+        return repl_apply(&store->repl, &store->kv, r, frame);
+    }
+    if (store != NULL && frame->type >= PROTO_SET && frame->type <= PROTO_POSITION) {
+        return store_dispatch(r, slot, frame);
+    }
+    switch (frame->type) {
+    case PROTO_HELLO:
+        if (r->verbose) {
+            printf("HELLO from fd %d (%zu byte payload)\n", c->fd, frame->len);
+        }
+        return reactor_reply(r, slot, PROTO_HELLO, 1);
+    case PROTO_DATA:
+        return reactor_reply(r, slot, PROTO_DATA, (unsigned int)frame->len);
+    default:
+        if (r->verbose) {
+            printf("Unknown frame type %d from fd %d\n", frame->type, c->fd);
+        }
+        return -1;
+    }
+}
+
+// every large payload goes to the reactor's buffer pool
+static char* reactor_payload_buffer(reactor_t* r, int slot, proto_type_e type, size_t len) {
+    (void)r;
+    (void)slot;
+    (void)type;
+    (void)len;
+    return NULL;
+}
+
+// Streamed PROTO_DATA is consumed as it arrives and acknowledged once the last chunk is in,
+// so a multi-megabyte upload never needs more memory than the receive ring.
+static int reactor_on_chunk(reactor_t* r, int slot, const proto_chunk_t* chunk) {
+    if (chunk->type != PROTO_DATA) {
+        return -1;
+    }
+    if (chunk->offset == 0 && capture_wanted(r, slot)) {
+        proto_frame_t frame = { chunk->type, chunk->len, NULL };
+        cap_frame(capture, slot, &frame, 0);
+    }
+    if (r->user != NULL) {
+        fprintf(stderr, "fd %d: frames over %zu bytes are not proxied\n", r->clients[slot].fd, RX_STREAM_MIN);
+        return -1;
+    }
+    if (chunk->offset + chunk->n < chunk->len) {
+        return 0;
+    }
+    if (r->verbose) {
+        printf("streamed %zu bytes from fd %d\n", chunk->len, r->clients[slot].fd);
+    }
+    return reactor_reply(r, slot, PROTO_DATA, (unsigned int)chunk->len);
+}
+
+static void reactor_on_close(reactor_t* r, int slot) {
+    if (capture != NULL) {
+        cap_conn_closed(capture, slot);
+    }
+    if (r->user != NULL) {
+        l7_on_close(r, slot);
+    }
+    if (store != NULL) {
+        repl_on_close(&store->repl, slot);
+    }
+}
+
+static int reactor_on_iteration(reactor_t* r) {
+    if (store == NULL) {
+        return -1;
+    }
+    int timeout = wal_on_iteration(&store->wal, r);
+    int waits[] = { snap_on_iteration(&store->snap, &store->kv, &store->wal, r),
+        repl_on_iteration(&store->repl, &store->wal, r) };
+    for (size_t i = 0; i < sizeof(waits) / sizeof(waits[0]); i++) {
+        if (waits[i] != -1 && (timeout == -1 || waits[i] < timeout)) {
+            timeout = waits[i];
+        }
+    }
+    return timeout;
+}
+
+typedef struct {
+    const char* name;
+    int (*run)(reactor_t*, volatile sig_atomic_t*);
+} backend_entry_t;
+
+#ifdef REACTOR_BACKEND
+
+#define BACKEND REACTOR_BACKEND
+#include "reactor_loop.h"
+
+static const backend_entry_t backends[] = {
+    { STR(REACTOR_BACKEND), RUN_FN(REACTOR_BACKEND) },
+};
+
+#else
+
+#define BACKEND select
+#include "reactor_loop.h"
+#define BACKEND poll
+#include "reactor_loop.h"
+#ifdef __linux__
+#define BACKEND epoll
+#include "reactor_loop.h"
+#define BACKEND uring
+#include "reactor_loop.h"
+#endif
+
+// the choice is made once at startup, the loop itself never goes through this table
+static const backend_entry_t backends[] = {
+    { "select", reactor_run_select },
+    { "poll", reactor_run_poll },
+#ifdef __linux__
+    { "epoll", reactor_run_epoll },
+    { "uring", reactor_run_uring },
+#endif
+};
+
+#endif
+
+#define N_BACKENDS ((int)(sizeof(backends) / sizeof(backends[0])))
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+// only there to interrupt a worker's wait so it notices stop_requested
+static void on_wakeup(int sig) {
+    (void)sig;
+}
+
+typedef struct {
+    reactor_t r;
+    l7_t l7;
+    cap_writer_t cap;
+    const backend_entry_t* backend;
+    pthread_t thread;
+    int cpu;
+    int rc;
+    volatile int done;
+} worker_t;
+
+static void* worker_main(void* arg) {
+    worker_t* w = arg;
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        fprintf(stderr, "could not pin loop %d to its CPU\n", w->cpu);
+    }
+#endif
+    capture = w->cap.f != NULL ? &w->cap : NULL;
+    w->rc   = w->backend->run(&w->r, &stop_requested);
+    w->done = 1;
+    return NULL;
+}
+
+static void print_stats(const reactor_stats_t* st) {
+    if (st->proxy_pairs > 0) {
+        // nothing is parsed or queued in proxy mode, the frame and reply counters stay at 0
+        printf("proxied pairs: %llu, bytes spliced by closed pairs: %llu, splice calls to sockets: %llu\n",
+            st->proxy_pairs,
+            st->proxy_bytes,
+            st->tx_syscalls);
+        printf("accepts: %llu\n", st->accepts);
+        return;
+    }
+    printf("frames: %llu, bytes read: %llu, read directly into payload buffers: %llu\n",
+        st->frames,
+        st->rx_bytes,
+        st->rx_direct_bytes);
+    printf("replies: %llu, bytes written: %llu, writev calls: %llu, write syscalls saved: %lld\n",
+        st->tx_frames,
+        st->tx_bytes,
+        st->tx_syscalls,
+        (long long)st->tx_frames - (long long)st->tx_syscalls);
+    printf("backpressure pauses: %llu\n", st->rx_pauses);
+    printf("accepts: %llu, first request read straight after accept: %llu\n",
+        st->accepts,
+        st->accept_reads);
+    if (st->l7_requests > 0) {
+        printf("proxied frames: %llu, replies held back for ordering: %llu, upstream connects: %llu, lost: %llu\n",
+            st->l7_requests,
+            st->l7_reordered,
+            st->l7_upstream_connects,
+            st->l7_upstream_lost);
+    }
+    if (st->log_commits > 0) {
+        printf("log: %llu records, %llu bytes, %llu fdatasync calls, %.1f records per sync\n",
+            st->log_records,
+            st->log_bytes,
+            st->log_commits,
+            (double)st->log_records / (double)st->log_commits);
+    }
+    if (st->snapshots > 0) {
+        printf("snapshots: %llu, the loop spent %.0f us in fork() per snapshot\n",
+            st->snapshots,
+            (double)st->snapshot_fork_us / (double)st->snapshots);
+    }
+    if (st->repl_copies > 0 || st->repl_applied > 0) {
+        printf("replication: %llu copies sent, %llu mutations streamed, %llu applied from the leader\n",
+            st->repl_copies,
+            st->repl_streamed,
+            st->repl_applied);
+    }
+    if (st->shm_accepts > 0) {
+        printf("shm connections: %llu, eventfd wakeups: %llu, replies that needed no wakeup: %llu\n",
+            st->shm_accepts,
+            st->shm_wakeups,
+            st->shm_wakeups_saved);
+    }
+    if (st->tls_handshakes > 0) {
+        printf("TLS connections handed to the kernel: %llu\n", st->tls_handshakes);
+    }
+    if (st->tx_frames > 0) {
+        printf("TCP segments sent by closed connections: %llu, %.3f per reply\n",
+            st->tx_segments,
+            (double)st->tx_segments / (double)st->tx_frames);
+    }
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-b backend] [-p port] [-c max_clients] [-f fifo|rr] [-B read_budget]\n"
+                    "       [-W high_water:low_water] [-M tx_cap] [-P nagle|nodelay|cork]\n"
+                    "       [-D defer_accept_secs] [-F fastopen_qlen] [-t threads [-S]]\n"
+                    "       [-C cert.pem -K key.pem] [-U shm_socket_path] [-X upstream_host:port]\n"
+                    "       [-L backend_host:port,... [-N pool_size] [-R key|type]]\n"
+                    "       [-J log_path [-G group_commit_us] [-Z snapshot_after_bytes] | -O leader_host:port]\n"
+                    "       [-Q capture_path [-q capture_mb]] [-E] [-m stats_path] [-T auto|tsc|mono|coarse] [-v]\nbackends:", prog);
+    for (int i = 0; i < N_BACKENDS; i++) {
+        fprintf(stderr, " %s", backends[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+    const backend_entry_t* backend = &backends[N_BACKENDS - 1];
+    listen_opts_t lopts            = { PORT, 0, 0, 0 };
+    int max_clients                = MAX_CLIENTS;
+    int threads                    = 1;
+    int steer                      = 0;
+    const char* cert_file          = NULL;
+    const char* key_file           = NULL;
+    const char* shm_path           = NULL;
+    struct sockaddr_in upstream    = { 0 };
+    char upstream_host[64];
+    l7_t l7_conf                   = { 0 };
+    int l7                         = 0;
+    const char* log_path           = NULL;
+    long window_us                 = 0;
+    off_t snap_bytes               = 0;
+    struct sockaddr_in leader      = { 0 };
+    int follow                     = 0;
+    const char* capture_path       = NULL;
+    size_t capture_mb              = 1024;
+    static cap_file_t capture_file;
+    int flight                     = 0;
+    const char* stats_path         = NULL;
+    static statseg_t stats_seg;
+    const char* clock_name         = "auto";
+    reactor_t conf                 = { 0 };
+    int opt;
+
+    conf.fairness     = FAIR_ROTATE;
+    conf.rx_budget    = RX_BUDGET;
+    conf.tx_high      = TX_HIGH_WATER;
+    conf.tx_low       = TX_LOW_WATER;
+    conf.tx_cap       = TX_GLOBAL_CAP;
+    conf.flush_policy = FLUSH_NODELAY;
+    conf.unix_fd      = -1;
+    l7_conf.by_key    = 1;
+
+    while ((opt = getopt(argc, argv, "b:p:c:f:B:W:M:P:D:F:t:SC:K:U:X:L:N:R:J:G:Z:O:Q:q:Em:T:vh")) != -1) {
+        switch (opt) {
+        case 'b':
+            backend = NULL;
+            for (int i = 0; i < N_BACKENDS; i++) {
+                if (strcmp(optarg, backends[i].name) == 0) {
+                    backend = &backends[i];
+                }
+            }
+            if (backend == NULL) {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'p':
+            lopts.port = atoi(optarg);
+            break;
+        case 'D':
+            lopts.defer_accept = atoi(optarg);
+            break;
+        case 'F':
+            lopts.fastopen = atoi(optarg);
+            break;
+        case 'c':
+            max_clients = atoi(optarg);
+            break;
+        case 'f':
+            conf.fairness = strcmp(optarg, "fifo") == 0 ? FAIR_NONE : FAIR_ROTATE;
+            break;
+        case 'B':
+            conf.rx_budget = (size_t)atol(optarg);
+            break;
+        case 'W':
+            if (sscanf(optarg, "%zu:%zu", &conf.tx_high, &conf.tx_low) != 2 || conf.tx_low > conf.tx_high) {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'M':
+            conf.tx_cap = (size_t)atol(optarg);
+            break;
+        case 'P':
+            if (strcmp(optarg, "nagle") == 0) {
+                conf.flush_policy = FLUSH_NAGLE;
+            } else if (strcmp(optarg, "cork") == 0) {
+                conf.flush_policy = FLUSH_CORK;
+            } else if (strcmp(optarg, "nodelay") == 0) {
+                conf.flush_policy = FLUSH_NODELAY;
+            } else {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'S':
+            steer = 1;
+            break;
+        case 'C':
+            cert_file = optarg;
+            break;
+        case 'K':
+            key_file = optarg;
+            break;
+        case 'U':
+            shm_path = optarg;
+            break;
+        case 'X': {
+            int up_port;
+            if (sscanf(optarg, "%63[^:]:%d", upstream_host, &up_port) != 2 ||
+                inet_pton(AF_INET, upstream_host, &upstream.sin_addr) != 1) {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            upstream.sin_family = AF_INET;
+            upstream.sin_port   = htons(up_port);
+            conf.upstream       = &upstream;
+            break;
+        }
+        case 'L':
+            if (l7_parse_backends(&l7_conf, optarg) == -1) {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            l7 = 1;
+            break;
+        case 'N':
+            l7_conf.pool_size = atoi(optarg);
+            break;
+        case 'R':
+            l7_conf.by_key = strcmp(optarg, "type") != 0;
+            break;
+        case 'J':
+            log_path = optarg;
+            break;
+        case 'G':
+            window_us = atol(optarg);
+            break;
+        case 'Z':
+            snap_bytes = (off_t)atoll(optarg);
+            break;
+        case 'O': {
+            int leader_port;
+            if (sscanf(optarg, "%63[^:]:%d", upstream_host, &leader_port) != 2 ||
+                inet_pton(AF_INET, upstream_host, &leader.sin_addr) != 1) {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            leader.sin_family = AF_INET;
+            leader.sin_port   = htons(leader_port);
+            follow            = 1;
+            break;
+        }
+        case 'Q':
+            capture_path = optarg;
+            break;
+        case 'q':
+            capture_mb = (size_t)atol(optarg);
+            break;
+        case 'E':
+            flight = 1;
+            break;
+        case 'm':
+            stats_path = optarg;
+            break;
+        case 'T':
+            clock_name = optarg;
+            break;
+        case 'v':
+            conf.verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (threads < 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    struct sigaction sa = { 0 };
+    sa.sa_handler       = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = on_wakeup;
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    conf.read_on_accept = lopts.defer_accept > 0 || lopts.fastopen > 0;
+    if (cert_file != NULL || key_file != NULL) {
+#ifdef REACTOR_TLS
+        if (cert_file == NULL || key_file == NULL ||
+            (conf.tls_ctx = tls_server_ctx(cert_file, key_file)) == NULL) {
+            fprintf(stderr, "TLS needs a usable -C cert and -K key\n");
+            exit(EXIT_FAILURE);
+        }
+#else
+        fprintf(stderr, "built without TLS support, rebuild with -DREACTOR_TLS\n");
+        exit(EXIT_FAILURE);
+#endif
+    }
+    if (l7 && conf.upstream != NULL) {
+        fprintf(stderr, "-L and -X are two different proxy modes, pick one\n");
+        exit(EXIT_FAILURE);
+    }
+    if (l7 && shm_path != NULL) {
+        fprintf(stderr, "-L forwards frames between TCP connections, it does not combine with -U\n");
+        exit(EXIT_FAILURE);
+    }
+    if (conf.upstream != NULL) {
+#ifdef __linux__
+        if (conf.tls_ctx != NULL || shm_path != NULL) {
+            fprintf(stderr, "proxy mode forwards raw TCP, it does not combine with -C/-K or -U\n");
+            exit(EXIT_FAILURE);
+        }
+#else
+        fprintf(stderr, "proxy mode needs Linux (splice)\n");
+        exit(EXIT_FAILURE);
+#endif
+    }
+    if (log_path != NULL) {
+        if (threads != 1 || l7 || conf.upstream != NULL) {
+            fprintf(stderr, "-J keeps one store in one loop, it does not combine with -t, -L or -X\n");
+            exit(EXIT_FAILURE);
+        }
+        static store_t state;
+        if (snap_open_store(&state.snap, &state.kv, &state.wal, log_path, window_us < 0 ? 0 : window_us) == -1) {
+            exit(EXIT_FAILURE);
+        }
+        state.snap.auto_bytes = snap_bytes;
+        repl_init(&state.repl);
+        store = &state;
+    }
+    if (follow) {
+        if (log_path != NULL || threads != 1 || l7 || conf.upstream != NULL) {
+            fprintf(stderr, "-O keeps one in-memory copy in one loop, it does not combine with -J, -t, -L or -X\n");
+            exit(EXIT_FAILURE);
+        }
+        static store_t state;
+        repl_init(&state.repl);
+        if (kv_init(&state.kv, 0) == -1) {
+            perror("kv_init");
+            exit(EXIT_FAILURE);
+        }
+        state.wal.fd           = -1; // nothing is logged, the leader holds the durable copy
+        state.repl.leader_addr = leader;
+        state.repl.following   = 1;
+        store                  = &state;
+    }
+    if (capture_path != NULL) {
+        if (conf.upstream != NULL) {
+            fprintf(stderr, "-X forwards bytes without reading frames, there is nothing to capture\n");
+            exit(EXIT_FAILURE);
+        }
+        if (cap_create(&capture_file, capture_path, capture_mb << 20) == -1) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (clk_init(clock_name) == -1) {
+        fprintf(stderr, "-T %s: not a clock this machine can use\n", clock_name);
+        exit(EXIT_FAILURE);
+    }
+    if (flight) {
+        clk_calibrate(); // now, not on the first dump in the middle of a loop
+    }
+    lopts.reuseport     = threads > 1;
+
+    // listeners are created in order, so listener i is socket i of the reuseport group
+    if (stats_path != NULL && statseg_create(&stats_seg, stats_path, threads, max_clients, reactor_stat_names,
+                                  (int)(sizeof(reactor_stat_names) / sizeof(reactor_stat_names[0]))) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    worker_t* workers = calloc((size_t)threads, sizeof(worker_t));
+    loops             = calloc((size_t)threads, sizeof(reactor_t*));
+    n_loops           = threads;
+    for (int i = 0; i < threads; i++) {
+        worker_t* w = &workers[i];
+        w->r        = conf;
+        w->backend  = backend;
+        w->cpu      = i;
+        if (init_clients(&w->r, max_clients) == -1) {
+            perror("init_clients");
+            exit(EXIT_FAILURE);
+        }
+        if (l7) {
+            if (l7_init(&w->l7, &l7_conf, max_clients) == -1) {
+                perror("l7_init");
+                exit(EXIT_FAILURE);
+            }
+            w->r.user = &w->l7;
+        }
+        if (flight && (w->r.flight = calloc((size_t)max_clients, sizeof(flight_ring_t))) == NULL) {
+            perror("flight recorder");
+            exit(EXIT_FAILURE);
+        }
+        loops[i] = &w->r;
+        if (stats_path != NULL) {
+            w->r.seg = statseg_loop(&stats_seg, i);
+        }
+        if (capture_path != NULL && cap_writer_init(&w->cap, &capture_file, i, max_clients) == -1) {
+            perror("cap_writer_init");
+            exit(EXIT_FAILURE);
+        }
+        if ((w->r.listen_fd = reactor_listen(&lopts)) == -1) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (shm_path != NULL) {
+#ifdef __linux__
+        // one Unix listener is plenty for same-host clients, the first loop serves them all
+        if ((workers[0].r.unix_fd = shm_listen(shm_path)) == -1) {
+            exit(EXIT_FAILURE);
+        }
+#else
+        fprintf(stderr, "the shared-memory transport needs Linux\n");
+        exit(EXIT_FAILURE);
+#endif
+    }
+    if (steer && threads > 1 && reactor_steer_by_cpu(workers[0].r.listen_fd, threads) == -1) {
+        perror("SO_ATTACH_REUSEPORT_CBPF");
+    }
+
+    printf("Server listening on port %d%s%s%s (%s backend, %d loop%s%s, %s clock)\n",
+        lopts.port,
+        shm_path != NULL ? " and shm socket " : "",
+        shm_path != NULL ? shm_path : "",
+        conf.upstream != NULL ? ", proxying to upstream" : l7 ? ", routing frames to backends" : follow ? ", following a leader" : store != NULL ? ", serving the store" : "",
+        backend->name,
+        threads,
+        threads > 1 ? "s" : "",
+        steer && threads > 1 ? ", steered by CPU" : "",
+        clk_source_name());
+
+    int rc = 0;
+    if (threads == 1) {
+        capture = workers[0].cap.f != NULL ? &workers[0].cap : NULL;
+        rc      = backend->run(&workers[0].r, &stop_requested);
+    } else {
+        // workers only take SIGUSR1; SIGINT / SIGTERM land on this thread, which then wakes
+        // every worker until it has seen stop_requested and returned
+        sigset_t block, old;
+        sigemptyset(&block);
+        sigaddset(&block, SIGINT);
+        sigaddset(&block, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &block, &old);
+        for (int i = 0; i < threads; i++) {
+            pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+        }
+
+        // still blocked here, so a signal between the check and the wait stays pending
+        // until sigsuspend unblocks it, where pause() would have slept through it
+        while (!stop_requested) {
+            sigsuspend(&old);
+        }
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        for (int i = 0; i < threads; i++) {
+            while (!workers[i].done) {
+                pthread_kill(workers[i].thread, SIGUSR1);
+                usleep(10000);
+            }
+            pthread_join(workers[i].thread, NULL);
+            rc |= workers[i].rc;
+        }
+    }
+
+    if (store != NULL) {
+        // whatever is staged was never acknowledged, but it is already applied: keep it
+        if (wal_pending(&store->wal)) {
+            wal_commit(&store->wal, &workers[0].r);
+        }
+        snap_finish(&store->snap, &workers[0].r);
+        if (store->repl.following) {
+            printf("follower at position %llu, last lag %lld us, max %lld us\n",
+                (unsigned long long)store->repl.leader_seq,
+                store->repl.lag_us,
+                store->repl.max_lag_us);
+        }
+        wal_close(&store->wal);
+        kv_destroy(&store->kv);
+    }
+
+    if (capture_path != NULL) {
+        cap_close(&capture_file);
+    }
+
+    reactor_stats_t total = { 0 };
+    for (int i = 0; i < threads; i++) {
+        close(workers[i].r.listen_fd);
+        if (workers[i].r.unix_fd != -1) {
+            close(workers[i].r.unix_fd);
+            unlink(shm_path);
+        }
+        if (threads > 1) {
+            printf("loop %d: %llu accepts, %llu frames\n", i, workers[i].r.stats.accepts, workers[i].r.stats.frames);
+        }
+        reactor_stats_add(&total, &workers[i].r.stats);
+    }
+    print_stats(&total);
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
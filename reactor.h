@@ -0,0 +1,1259 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // memfd_create and friends
+#endif
+
+// Shared reactor core used by every event-loop backend.
+//
+// select_example.c and poll_example.c both carry their own clientstate_t, init_clients,
+// find_free_slot and accept/read code around a different readiness call. Here that logic
+// lives once; the backend only answers "which fds are ready?" (see backend_*.h), and
+// reactor_loop.h stitches the two together per backend at compile time.
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+#include "proto.h"
+#include "ringbuf.h"
+#ifdef __linux__
+#include "shm.h"
+#endif
+#include "bufpool.h"
+#include "outq.h"
+#include "clock.h"
+#include "flight.h"
+#include "statseg.h"
+#include "probes.h"
+#include <sys/uio.h>
+
+#define MAX_CLIENTS 256
+// per-connection receive ring; frames that do not fit are received directly or streamed
+#define RX_RING_SIZE (128 * 1024)
+#define MAX_EVENTS 256
+// payloads at least this big that have not fully arrived are read straight into their own buffer
+#define RX_DIRECT_MIN (16 * 1024)
+// payloads above this are never buffered whole, the handler gets them chunk by chunk
+#define RX_STREAM_MIN ((size_t)1 << BUFPOOL_MAX_SHIFT)
+// default cap on bytes read from one connection per wakeup, so a busy client cannot hog an iteration
+#define RX_BUDGET (64 * 1024)
+// output queue watermarks: past TX_HIGH_WATER a connection is not read from until its queue
+// drains to TX_LOW_WATER, and past TX_GLOBAL_CAP queued bytes in total every connection that
+// still has output pending stops being read until the total is back under half the cap
+#define TX_HIGH_WATER (1024 * 1024)
+#define TX_LOW_WATER (256 * 1024)
+#define TX_GLOBAL_CAP (256 * 1024 * 1024)
+
+typedef enum {
+    STATE_NEW,
+    STATE_HANDSHAKE, // TLS handshake in progress, no frames yet
+    STATE_CONNECTED,
+    STATE_DISCONNECTED,
+} state_e;
+
+// order in which the ready list of one wakeup is serviced
+typedef enum {
+    FAIR_NONE,   // backend order: low fds / low pollfd indexes always go first
+    FAIR_ROTATE, // start one entry further along every iteration
+} fairness_e;
+
+// how a connection's output reaches the wire
+typedef enum {
+    FLUSH_NAGLE,   // no socket options, the kernel's Nagle / delayed-ACK interplay applies
+    FLUSH_NODELAY, // TCP_NODELAY: every flush goes out immediately, best for request/response
+    FLUSH_CORK,    // TCP_NODELAY, plus TCP_CORK set before a flush's writev batch and lifted
+                   // once the queue has drained: only full segments leave meanwhile, and a
+                   // batch held up by a full socket buffer keeps its tail until it completes
+} flush_policy_e;
+
+// macOS spells TCP_CORK as TCP_NOPUSH
+#if !defined(TCP_CORK) && defined(TCP_NOPUSH)
+#define TCP_CORK TCP_NOPUSH
+#endif
+
+// readiness bits shared by all backends, so the core never sees POLLIN / EPOLLIN / fd_set
+#define EV_READ  0x1
+#define EV_WRITE 0x2
+#define EV_ERROR 0x4
+
+typedef struct {
+    int fd;
+    unsigned events;
+} ev_t;
+
+typedef struct {
+    int fd;
+    state_e state;
+    unsigned interest; // EV_* bits currently registered with the backend
+    int dirty;         // position on the reactor's dirty list plus one, 0 when not on it
+    int rx_paused;     // over the high watermark, reading stopped until the low watermark
+    int rx_hold;       // the program's hooks asked for reading to stop, see reactor_hold
+    int adopted;       // fd came from reactor_adopt and is not registered with the backend yet
+    int close_pending; // reactor_close_later was called, the next sync closes the connection
+    int tx_gated;      // output queued after tx_gate waits for reactor_ungate, see reactor_gate
+    size_t tx_gate;    // bytes at the front of tx that may still be written while gated
+    flush_policy_e flush_policy;
+    int corked;        // TCP_CORK set by reactor_flush and not lifted yet
+    void* tls;         // SSL* while the TLS handshake runs, NULL once the kernel took over
+    unsigned tls_want; // EV_* bits the handshake is waiting for
+    void* shm;         // shm_conn_t* for a shared-memory client (fd is then its eventfd), else NULL
+
+    // proxy mode (proxy.h): the other half of the pair, and the pipe carrying what this half
+    // received to it
+    int peer;
+    int pipe[2];
+    size_t pipe_cap;
+    size_t piped;               // bytes in the pipe
+    unsigned long long spliced; // bytes received and passed on over the connection's lifetime
+    int rx_eof;                 // the other end closed its side; also set outside proxy mode
+    int tx_shut;                // SHUT_WR sent after the peer's EOF
+    int pipe_full;
+    outq_t tx;
+    ringbuf_t rx; // mapped on the first connection in this slot and reused afterwards
+
+    // direct payload receive: set while the payload of `pending` is being read into direct_buf
+    proto_frame_t pending;
+    char* direct_buf;
+    size_t direct_got;
+    int direct_pooled;
+
+    // streamed payload receive: set while the payload of `pending` is fed to reactor_on_chunk
+    int streaming;
+    size_t stream_off;
+} clientstate_t;
+
+typedef struct {
+    unsigned long long rx_bytes;
+    unsigned long long rx_direct_bytes; // payload bytes that went from the kernel to their final buffer
+    unsigned long long frames;
+    unsigned long long tx_bytes;
+    unsigned long long tx_frames;   // frames queued by handlers, i.e. writes an eager server would do
+    unsigned long long tx_syscalls; // writev calls actually made
+    unsigned long long rx_pauses;   // times a connection stopped being read because of backpressure
+    unsigned long long tx_segments; // TCP segments sent on closed connections (Linux TCP_INFO)
+    unsigned long long accepts;
+    unsigned long long accept_reads; // connections whose first request was read without waiting for a wakeup
+    unsigned long long tls_handshakes;
+    unsigned long long shm_accepts;
+    unsigned long long shm_wakeups;       // eventfd writes to shm clients
+    unsigned long long shm_wakeups_saved; // shm replies that found the client busy and needed none
+    unsigned long long proxy_pairs;
+    unsigned long long proxy_bytes; // spliced through by closed pairs, both directions
+    unsigned long long l7_requests;
+    unsigned long long l7_reordered; // replies held back so a client still sees its own order
+    unsigned long long l7_upstream_connects;
+    unsigned long long l7_upstream_lost;
+    unsigned long long log_records;
+    unsigned long long log_bytes;
+    unsigned long long log_commits; // fdatasync calls, one per group commit
+    unsigned long long snapshots;
+    unsigned long long snapshot_fork_us; // time the loop spent in fork(), its only pause for a snapshot
+    unsigned long long repl_copies;      // full copies of the store sent to followers
+    unsigned long long repl_streamed;    // mutations streamed to followers
+    unsigned long long repl_applied;     // mutations a follower applied from its leader's stream
+} reactor_stats_t; // counters only, reactor_stats_add relies on it
+
+// reactor_stats_t's fields in order, as the stats segment (statseg.h) names them
+static const char* const reactor_stat_names[] = { "rx_bytes", "rx_direct_bytes", "frames", "tx_bytes",
+    "tx_frames", "tx_syscalls", "rx_pauses", "tx_segments", "accepts", "accept_reads", "tls_handshakes",
+    "shm_accepts", "shm_wakeups", "shm_wakeups_saved", "proxy_pairs", "proxy_bytes", "l7_requests",
+    "l7_reordered", "l7_upstream_connects", "l7_upstream_lost", "log_records", "log_bytes", "log_commits",
+    "snapshots", "snapshot_fork_us", "repl_copies", "repl_streamed", "repl_applied" };
+_Static_assert(sizeof(reactor_stat_names) / sizeof(reactor_stat_names[0]) * sizeof(unsigned long long) ==
+        sizeof(reactor_stats_t),
+    "reactor_stat_names is missing a counter");
+
+typedef struct {
+    int listen_fd;
+    int unix_fd; // shared-memory transport listener (see shm.h), -1 when off
+    int max_clients;
+    int verbose;
+    fairness_e fairness;
+    flush_policy_e flush_policy; // given to every new connection
+    unsigned rr_offset;
+    size_t rx_budget;
+    int read_on_accept; // the listener defers accept or takes TFO data, so try a read right away
+    size_t tx_high;
+    size_t tx_low;
+    size_t tx_cap;
+    size_t tx_total; // bytes queued over all connections
+    int tx_capped;   // tx_total went over tx_cap and has not yet come back under tx_cap / 2
+    clientstate_t* clients;
+
+    // free slots are kept on a stack, so taking one is O(1) instead of scanning for fd == -1
+    int* free_slots;
+    int n_free;
+
+    // fd -> slot lookup table, replaces the linear find_slot_by_fd scan
+    int* fd_slot;
+    int fd_cap;
+    int spare_fd; // held on /dev/null, given up to accept and shed a connection when out of fds
+
+    // slots that queued output during this iteration
+    int* dirty;
+    int n_dirty;
+
+    void* tls_ctx; // SSL_CTX*, NULL when connections are plaintext
+    const struct sockaddr_in* upstream; // proxy mode: every client is forwarded here, else NULL
+    void* user;                         // per-loop state of the program's hooks
+    flight_ring_t* flight;              // per slot, NULL when the flight recorder is off
+    statseg_loop_t* seg;                // this loop's part of the stats segment, NULL when off
+
+    bufpool_t pool;
+    reactor_stats_t stats;
+} reactor_t;
+
+#include "tls.h"
+
+// One event for the slot's flight recorder; a single predictable branch when it is off.
+static inline void reactor_flight(reactor_t* r, int slot, flight_kind_e kind, size_t arg, unsigned type) {
+    if (r->flight != NULL) {
+        flight_record(&r->flight[slot], kind, (uint32_t)arg, (uint16_t)type);
+    }
+}
+
+// The slot's summary in the stats segment, after its connection opened, moved bytes or closed.
+static inline void reactor_seg_conn(reactor_t* r, int slot, size_t rx, size_t tx) {
+    if (r->seg == NULL) {
+        return;
+    }
+    const clientstate_t* c = &r->clients[slot];
+    statseg_conn_t* s      = &statseg_conns(r->seg)[slot];
+
+    statseg_begin(&s->seq);
+    if (c->fd == -1) {
+        s->fd   = -1;
+        s->kind = SEG_FREE;
+    } else {
+        if (s->fd != c->fd) {
+            s->fd        = c->fd;
+            s->rx_bytes  = 0;
+            s->tx_bytes  = 0;
+            s->opened_ns = clk_now();
+        }
+        s->kind = c->shm != NULL ? SEG_SHM : c->peer != -1 ? SEG_PROXY : c->state == STATE_HANDSHAKE ? SEG_HANDSHAKE : SEG_TCP;
+        s->rx_bytes += rx;
+        s->tx_bytes += tx;
+        s->last_ns = clk_now();
+    }
+    statseg_end(&s->seq);
+}
+
+// Called by the loop at the end of each iteration.
+static inline void reactor_seg_publish(reactor_t* r) {
+    if (r->seg == NULL) {
+        return;
+    }
+    statseg_begin(&r->seg->seq);
+    r->seg->now_ns = clk_now();
+    r->seg->iterations++;
+    memcpy(r->seg->counters, &r->stats, sizeof(r->stats));
+    statseg_end(&r->seg->seq);
+}
+
+static inline void reactor_stats_add(reactor_stats_t* dst, const reactor_stats_t* src) {
+    unsigned long long* d       = (unsigned long long*)dst;
+    const unsigned long long* a = (const unsigned long long*)src;
+    for (size_t i = 0; i < sizeof(reactor_stats_t) / sizeof(unsigned long long); i++) {
+        d[i] += a[i];
+    }
+}
+
+static inline int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// largest fd number + 1 this process may ever hand out
+static inline int max_fd_count() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur == RLIM_INFINITY) {
+        return 65536;
+    }
+    return (int)rl.rlim_cur;
+}
+
+static inline int init_clients(reactor_t* r, int max_clients) {
+    r->max_clients = max_clients;
+    r->fd_cap      = max_fd_count();
+    r->clients     = calloc(max_clients, sizeof(clientstate_t));
+    r->free_slots  = malloc(max_clients * sizeof(int));
+    r->fd_slot     = malloc(r->fd_cap * sizeof(int));
+    r->dirty       = malloc(max_clients * sizeof(int));
+    r->n_dirty     = 0;
+    r->spare_fd    = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (r->rx_budget == 0) {
+        r->rx_budget = RX_BUDGET;
+    }
+    if (r->tx_high == 0) {
+        r->tx_high = TX_HIGH_WATER;
+        r->tx_low  = TX_LOW_WATER;
+    }
+    if (r->tx_cap == 0) {
+        r->tx_cap = TX_GLOBAL_CAP;
+    }
+    if (r->clients == NULL || r->free_slots == NULL || r->fd_slot == NULL || r->dirty == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < max_clients; i++) {
+        r->clients[i].fd      = -1; // is indicates a free slot
+        r->clients[i].state   = STATE_NEW;
+        r->clients[i].peer    = -1;
+        r->clients[i].pipe[0] = -1;
+        r->clients[i].pipe[1] = -1;
+    }
+    // push in reverse so slot 0 is handed out first, same order as the linear scan
+    r->n_free = 0;
+    for (int i = max_clients - 1; i >= 0; i--) {
+        r->free_slots[r->n_free++] = i;
+    }
+    for (int i = 0; i < r->fd_cap; i++) {
+        r->fd_slot[i] = -1;
+    }
+    return 0;
+}
+
+static inline int find_free_slot(reactor_t* r) {
+    if (r->n_free == 0) {
+        return -1;
+    }
+    return r->free_slots[--r->n_free];
+}
+
+static inline int find_slot_by_fd(reactor_t* r, int fd) {
+    if (fd < 0 || fd >= r->fd_cap) {
+        return -1;
+    }
+    return r->fd_slot[fd];
+}
+
+typedef struct {
+    int port;
+    int defer_accept; // TCP_DEFER_ACCEPT seconds: accept() only returns once the client sent data
+    int fastopen;     // TCP_FASTOPEN queue length: the first request may ride in the SYN
+    int reuseport;    // SO_REUSEPORT, one listener per loop thread on the same port
+} listen_opts_t;
+
+static inline int reactor_listen(const listen_opts_t* o) {
+    int listen_fd;
+    int opt = 1;
+    struct sockaddr_in server_addr;
+
+    if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+        perror("socket");
+        return -1;
+    }
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
+        perror("setsockopt");
+        close(listen_fd);
+        return -1;
+    }
+    if (o->reuseport && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))) {
+        perror("setsockopt SO_REUSEPORT");
+        close(listen_fd);
+        return -1;
+    }
+    // both are optimisations only, a kernel that refuses them still gets a working listener
+#ifdef TCP_DEFER_ACCEPT
+    if (o->defer_accept > 0 &&
+        setsockopt(listen_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &o->defer_accept, sizeof(o->defer_accept))) {
+        perror("setsockopt TCP_DEFER_ACCEPT");
+    }
+#endif
+#ifdef TCP_FASTOPEN
+    if (o->fastopen > 0 &&
+        setsockopt(listen_fd, IPPROTO_TCP, TCP_FASTOPEN, &o->fastopen, sizeof(o->fastopen))) {
+        perror("setsockopt TCP_FASTOPEN");
+    }
+#endif
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family      = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port        = htons(o->port);
+
+    if (bind(listen_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+        perror("Bind");
+        close(listen_fd);
+        return -1;
+    }
+    if (listen(listen_fd, SOMAXCONN) == -1) {
+        perror("listen");
+        close(listen_fd);
+        return -1;
+    }
+    // the loop drains accept() until EAGAIN, so the listener must never block
+    set_nonblocking(listen_fd);
+    return listen_fd;
+}
+
+// Steers each new connection of a SO_REUSEPORT group to listener (receiving CPU % n).
+//
+// Without this the kernel picks the listener by a hash of the 4-tuple, so a connection whose
+// packets are processed on CPU 2 can end up on the loop pinned to CPU 5 and every request
+// then bounces its socket's cache lines between the two. Listener i must be the i-th socket
+// added to the group and its loop must run on CPU i. Call after every listener is bound.
+static inline int reactor_steer_by_cpu(int listen_fd, int n) {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, (unsigned)(SKF_AD_OFF + SKF_AD_CPU) }, // A = cpu
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (unsigned)n },                      // A %= n
+        { BPF_RET | BPF_A, 0, 0, 0 },                                           // socket index A
+    };
+    struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+    return setsockopt(listen_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+#else
+    (void)listen_fd;
+    (void)n;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+static inline int set_tcp_option(int fd, int option, int on) {
+    return setsockopt(fd, IPPROTO_TCP, option, &on, sizeof(on));
+}
+
+static inline void reactor_set_flush_policy(reactor_t* r, int slot, int fd, flush_policy_e policy) {
+    r->clients[slot].flush_policy = policy;
+    set_tcp_option(fd, TCP_NODELAY, policy != FLUSH_NAGLE);
+}
+
+// segments sent so far on a TCP socket, 0 where TCP_INFO does not report it
+static inline unsigned long long tcp_segments_out(int fd) {
+#if defined(__linux__) && defined(TCP_INFO) && defined(__GLIBC__)
+    // glibc's struct tcp_info stops at tcpi_total_retrans, 104 bytes in, and linux/tcp.h
+    // cannot be included next to netinet/tcp.h. The kernel only ever appends fields, so the
+    // counters after it are declared here, for glibc's layout only; other libcs report 0.
+    _Static_assert(sizeof(struct tcp_info) == 104, "struct tcp_info is not glibc's 104-byte layout");
+    struct {
+        struct tcp_info base;
+        unsigned long long pacing_rate;
+        unsigned long long max_pacing_rate;
+        unsigned long long bytes_acked;
+        unsigned long long bytes_received;
+        unsigned int segs_out;
+        unsigned int segs_in;
+    } info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 && len >= sizeof(info)) {
+        return info.segs_out;
+    }
+#endif
+    (void)fd;
+    return 0;
+}
+
+// Accepts one pending connection and gives it a slot.
+// Returns the slot, -1 when the accept queue is drained, -2 when the connection was refused.
+static inline int reactor_accept(reactor_t* r) {
+    struct sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
+
+    int conn_fd = accept(r->listen_fd, (struct sockaddr*)&client_addr, &client_len);
+    if (conn_fd == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return -1;
+        }
+        if (errno == EINTR || errno == ECONNABORTED) {
+            return -2;
+        }
+        if ((errno == EMFILE || errno == ENFILE) && r->spare_fd != -1) {
+            // a connection left in the backlog keeps the listener readable and the loop
+            // spinning on it: take it with the spare fd and close it, so the client sees a
+            // close instead of a hang
+            close(r->spare_fd);
+            conn_fd = accept(r->listen_fd, NULL, NULL);
+            if (conn_fd != -1) {
+                printf("Out of file descriptors, closing new connection\n");
+                close(conn_fd);
+            }
+            r->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            return conn_fd == -1 ? -1 : -2;
+        }
+        perror("accept");
+        return -1;
+    }
+
+    int slot = find_free_slot(r);
+    if (slot == -1 || conn_fd >= r->fd_cap) {
+        printf("Server full, closing new connection\n");
+        close(conn_fd);
+        if (slot != -1) {
+            r->free_slots[r->n_free++] = slot;
+        }
+        return -2;
+    }
+    if (r->clients[slot].rx.base == NULL && rb_init(&r->clients[slot].rx, RX_RING_SIZE) == -1) {
+        perror("rb_init");
+        close(conn_fd);
+        r->free_slots[r->n_free++] = slot;
+        return -2;
+    }
+    set_nonblocking(conn_fd);
+    reactor_set_flush_policy(r, slot, conn_fd, r->flush_policy);
+
+    r->clients[slot].fd    = conn_fd;
+    r->clients[slot].state = STATE_CONNECTED;
+    if (r->tls_ctx != NULL && tls_begin(r, &r->clients[slot]) == -1) {
+        close(conn_fd);
+        r->clients[slot].fd        = -1;
+        r->free_slots[r->n_free++] = slot;
+        return -2;
+    }
+    r->fd_slot[conn_fd] = slot;
+    r->stats.accepts++;
+    reactor_flight(r, slot, FL_ACCEPT, (size_t)conn_fd, 0);
+    REACTOR_PROBE2(accept, conn_fd, slot);
+    reactor_seg_conn(r, slot, 0, 0);
+
+    if (r->verbose) {
+        printf("New connection from %s:%d, slot %d has fd %d\n",
+            inet_ntoa(client_addr.sin_addr),
+            ntohs(client_addr.sin_port),
+            slot,
+            conn_fd);
+    }
+    return slot;
+}
+
+// Puts the slot on the list flushed at the end of this iteration, once however often it is
+// called. A slot is on the list at most once, so the list never outgrows max_clients.
+static inline void reactor_mark_dirty(reactor_t* r, int slot) {
+    if (!r->clients[slot].dirty) {
+        r->dirty[r->n_dirty++] = slot;
+        r->clients[slot].dirty = r->n_dirty;
+    }
+}
+
+// Takes the slot off the dirty list, moving the last entry into its place.
+static inline void reactor_unmark_dirty(reactor_t* r, int slot) {
+    int pos = r->clients[slot].dirty - 1;
+
+    if (pos >= 0) {
+        int last               = r->dirty[--r->n_dirty];
+        r->dirty[pos]          = last;
+        r->clients[last].dirty = pos + 1;
+        r->clients[slot].dirty = 0;
+    }
+}
+
+// Gives a connected (or connecting) non-blocking socket the program opened itself, an
+// upstream connection say, a slot of its own. From then on it is read, parsed and flushed
+// like an accepted one; it is registered with the backend at the end of the iteration.
+// Returns the slot, or -1 (the fd is left to the caller).
+static inline int reactor_adopt(reactor_t* r, int fd) {
+    int slot = find_free_slot(r);
+    if (slot == -1 || fd >= r->fd_cap) {
+        if (slot != -1) {
+            r->free_slots[r->n_free++] = slot;
+        }
+        return -1;
+    }
+    if (r->clients[slot].rx.base == NULL && rb_init(&r->clients[slot].rx, RX_RING_SIZE) == -1) {
+        r->free_slots[r->n_free++] = slot;
+        return -1;
+    }
+    r->clients[slot].fd      = fd;
+    r->clients[slot].state   = STATE_CONNECTED;
+    r->clients[slot].adopted = 1;
+    r->fd_slot[fd]           = slot;
+    reactor_flight(r, slot, FL_CONNECT, (size_t)fd, 0);
+    REACTOR_PROBE2(accept, fd, slot);
+    reactor_seg_conn(r, slot, 0, 0);
+    reactor_mark_dirty(r, slot);
+    return slot;
+}
+
+// Stops (hold = 1) or resumes reading a connection on behalf of the program, for limits the
+// reactor does not know about. Takes effect when the connection is next synced.
+static inline void reactor_hold(reactor_t* r, int slot, int hold) {
+    if (r->clients[slot].rx_hold != hold) {
+        r->clients[slot].rx_hold = hold;
+        reactor_mark_dirty(r, slot);
+    }
+}
+
+// counts bytes that made it into the client's queue
+static inline void reactor_tx_queued(reactor_t* r, int slot, size_t len) {
+    r->tx_total += len;
+    if (r->tx_total >= r->tx_cap) {
+        r->tx_capped = 1;
+    }
+    reactor_mark_dirty(r, slot);
+}
+
+// Queues bytes for the client. Nothing reaches the socket until the end of the loop
+// iteration, so every reply produced while handling one read leaves in a single writev().
+// Out of memory queues nothing at all, and counts nothing.
+static inline int reactor_send(reactor_t* r, int slot, const void* data, size_t len) {
+    if (outq_append(&r->clients[slot].tx, &r->pool, data, len) == -1) {
+        return -1;
+    }
+    reactor_tx_queued(r, slot, len);
+    return 0;
+}
+
+// A whole frame or nothing: a payload that does not fit takes its header back out.
+static inline int reactor_send_frame(reactor_t* r, int slot, proto_type_e type, const void* payload, size_t len) {
+    outq_t* tx    = &r->clients[slot].tx;
+    size_t before = tx->bytes;
+    char hdr[PROTO_HDR_SIZE];
+
+    proto_encode_hdr(hdr, type, len);
+    if (outq_append(tx, &r->pool, hdr, sizeof(hdr)) == -1) {
+        return -1;
+    }
+    if (len > 0 && outq_append(tx, &r->pool, payload, len) == -1) {
+        outq_truncate(tx, &r->pool, before);
+        return -1;
+    }
+    r->stats.tx_frames++;
+    reactor_tx_queued(r, slot, sizeof(hdr) + len);
+    return 0;
+}
+
+// Holds back every reply queued for the client from now on until reactor_ungate, while what
+// was queued before still goes out; a reply that must not leave before something else has
+// happened (a log write reaching the disk, say) is queued after the gate. Returns 1 if the
+// connection was not gated yet, so the caller knows to remember it.
+static inline int reactor_gate(reactor_t* r, int slot) {
+    clientstate_t* c = &r->clients[slot];
+
+    if (c->tx_gated) {
+        return 0;
+    }
+    c->tx_gated = 1;
+    c->tx_gate  = c->tx.bytes;
+    return 1;
+}
+
+static inline void reactor_ungate(reactor_t* r, int slot) {
+    if (r->clients[slot].tx_gated) {
+        r->clients[slot].tx_gated = 0;
+        r->clients[slot].tx_gate  = 0;
+        reactor_mark_dirty(r, slot);
+    }
+}
+
+// Closes the connection at the end of this iteration, after one last flush. For the program's
+// hooks, which cannot take an fd out of the backend themselves: a hook closing another
+// connection (not the one it runs for) goes through here.
+static inline void reactor_close_later(reactor_t* r, int slot) {
+    r->clients[slot].close_pending = 1;
+    reactor_mark_dirty(r, slot);
+}
+
+// queued bytes that may be written now
+static inline size_t reactor_tx_ready(const clientstate_t* c) {
+    return c->tx_gated ? c->tx_gate : c->tx.bytes;
+}
+
+static inline void reactor_tx_drained(reactor_t* r, size_t n) {
+    r->tx_total -= n;
+    if (r->tx_capped && r->tx_total <= r->tx_cap / 2) {
+        r->tx_capped = 0;
+    }
+}
+
+#include "proxy.h"
+
+// Implemented by the program that includes this header: handles one complete frame.
+// Returns -1 to close the connection.
+static int reactor_dispatch(reactor_t* r, int slot, const proto_frame_t* frame);
+
+// Implemented by the program that includes this header: called when a frame announces a
+// payload of at least RX_DIRECT_MIN bytes that has not fully arrived yet. Return a buffer of
+// at least len bytes for the payload to be read into directly, or NULL to have the reactor
+// take one from its buffer pool. The buffer is handed back through the frame's payload
+// pointer on dispatch; a handler-provided buffer stays owned by the handler.
+static char* reactor_payload_buffer(reactor_t* r, int slot, proto_type_e type, size_t len);
+
+// Implemented by the program that includes this header: called whenever a slot is released,
+// whatever the reason, while its fd is still open.
+static void reactor_on_close(reactor_t* r, int slot);
+
+// Implemented by the program that includes this header: called once per loop iteration,
+// after the ready connections were handled and before their output is flushed. Returns the
+// longest the next wait may block in milliseconds, -1 for as long as it takes.
+static int reactor_on_iteration(reactor_t* r);
+
+// Implemented by the program that includes this header: receives the payload of a frame
+// larger than RX_STREAM_MIN piece by piece, as it arrives. Chunks point into the receive
+// ring and are only valid during the call. Returns -1 to close the connection.
+static int reactor_on_chunk(reactor_t* r, int slot, const proto_chunk_t* chunk);
+
+// every complete frame goes to reactor_dispatch through here, between its two probes
+static inline int reactor_handle_frame(reactor_t* r, int slot, const proto_frame_t* frame) {
+    int fd = r->clients[slot].fd;
+
+    REACTOR_PROBE3(frame, fd, frame->type, frame->len);
+    int rc = reactor_dispatch(r, slot, frame);
+    REACTOR_PROBE3(dispatch_done, fd, frame->type, rc);
+    return rc;
+}
+
+#ifdef __linux__
+
+// ---- shared-memory clients (shm.h) -------------------------------------------------------
+//
+// An shm client occupies a slot like a TCP one. Its fd is the server-side eventfd, which is
+// what the backend watches; the Unix socket is registered as well, only to notice EOF.
+// Frames are parsed in place in the client -> server ring and replies go from the output
+// queue into the server -> client ring, so EV_WRITE never comes into it.
+
+// Accepts one client on the Unix listener. Same return values as reactor_accept.
+static inline int reactor_shm_accept(reactor_t* r) {
+    shm_conn_t* s = malloc(sizeof(shm_conn_t));
+    if (s == NULL) {
+        return -1;
+    }
+    int rc = shm_accept(r->unix_fd, s);
+    if (rc == -1) {
+        int err = errno;
+        free(s);
+        if (err == EINTR || err == ECONNABORTED) {
+            return -2;
+        }
+        if (err != EAGAIN && err != EWOULDBLOCK) {
+            errno = err;
+            perror("accept AF_UNIX");
+        }
+        return -1;
+    }
+    if (rc == -2) {
+        free(s);
+        return -2;
+    }
+
+    int slot = find_free_slot(r);
+    if (slot == -1 || s->my_efd >= r->fd_cap || s->sock >= r->fd_cap) {
+        printf("Server full, closing new shm connection\n");
+        shm_destroy(s);
+        free(s);
+        if (slot != -1) {
+            r->free_slots[r->n_free++] = slot;
+        }
+        return -2;
+    }
+    r->clients[slot].fd    = s->my_efd;
+    r->clients[slot].shm   = s;
+    r->clients[slot].state = STATE_CONNECTED;
+    r->fd_slot[s->my_efd]  = slot;
+    r->fd_slot[s->sock]    = slot;
+    r->stats.accepts++;
+    r->stats.shm_accepts++;
+    REACTOR_PROBE2(accept, s->my_efd, slot);
+    reactor_seg_conn(r, slot, 0, 0);
+    if (r->verbose) {
+        printf("New shm connection, slot %d has eventfd %d\n", slot, s->my_efd);
+    }
+    return slot;
+}
+
+static inline int reactor_shm_sock(clientstate_t* c) {
+    return ((shm_conn_t*)c->shm)->sock;
+}
+
+// Copies the output queue into the server -> client ring. A full ring leaves the rest queued
+// with producer_waiting set, and the client's next read wakes this connection up again.
+// Returns -1 when the client broke the ring.
+static inline int reactor_shm_flush(reactor_t* r, clientstate_t* c) {
+    shm_conn_t* s = c->shm;
+
+    while (reactor_tx_ready(c) > 0) {
+        outq_block_t* b = c->tx.head;
+        size_t len      = b->end - b->start;
+        ssize_t n       = shm_produce(s, b->data + b->start, len < reactor_tx_ready(c) ? len : reactor_tx_ready(c));
+        if (n == -1) {
+            return -1; // the client broke the ring
+        }
+        if (n == 0) {
+            if (shm_wait_space(s, 1)) {
+                break;
+            }
+            continue;
+        }
+        r->stats.tx_bytes += (size_t)n;
+        reactor_seg_conn(r, (int)(c - r->clients), 0, (size_t)n);
+        outq_consume(&c->tx, &r->pool, (size_t)n);
+        reactor_tx_drained(r, (size_t)n);
+        if (c->tx_gated) {
+            c->tx_gate -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+// A connection that stopped parsing early (read budget used up, or backpressure) never told
+// the client it went to sleep, so nobody would wake it. Once it may read again it either goes
+// to sleep properly or, with bytes still in the ring, wakes itself.
+static inline void reactor_shm_resume(clientstate_t* c) {
+    shm_conn_t* s = c->shm;
+    uint64_t one  = 1;
+
+    if (__atomic_load_n(&s->rx.ctl->consumer_waiting, __ATOMIC_SEQ_CST) || shm_prepare_sleep(s, 0)) {
+        return;
+    }
+    if (write(s->my_efd, &one, sizeof(one)) != sizeof(one)) {
+        perror("eventfd write");
+    }
+}
+
+static inline int reactor_shm_rx_blocked(reactor_t* r, clientstate_t* c) {
+    return c->rx_paused || c->rx_hold || c->tx.bytes >= r->tx_high || (r->tx_capped && c->tx.bytes > 0);
+}
+
+// Dispatches the frames in the client -> server ring, payloads pointing straight into it.
+// A frame too big for the ring is streamed to reactor_on_chunk instead.
+static inline int reactor_shm_on_readable(reactor_t* r, int slot) {
+    clientstate_t* c = &r->clients[slot];
+    shm_conn_t* s    = c->shm;
+    size_t done      = 0;
+    proto_frame_t frame;
+
+    shm_drain_wakeups(s);
+    // a wakeup can also mean the client made room in the reply ring
+    reactor_mark_dirty(r, slot);
+
+    while (!reactor_shm_rx_blocked(r, c) && done < r->rx_budget) {
+        ssize_t avail = shm_ring_used(&s->rx);
+        if (avail == -1) {
+            errno = EPROTO;
+            return -1; // the client broke the ring
+        }
+        size_t used   = (size_t)avail;
+        const char* p = shm_ring_read_ptr(&s->rx);
+        size_t n      = 0;
+
+        if (c->streaming) {
+            proto_chunk_t chunk;
+            size_t left = c->pending.len - c->stream_off;
+            n           = used < left ? used : left;
+            if (n > 0) {
+                chunk.type   = c->pending.type;
+                chunk.len    = c->pending.len;
+                chunk.offset = c->stream_off;
+                chunk.data   = p;
+                chunk.n      = n;
+                if (reactor_on_chunk(r, slot, &chunk) == -1) {
+                    return -1;
+                }
+                c->stream_off += n;
+                if (c->stream_off == c->pending.len) {
+                    c->streaming = 0;
+                    r->stats.frames++;
+                }
+            }
+        } else if ((n = proto_parse(p, used, &frame)) > 0) {
+            r->stats.frames++;
+            if (reactor_handle_frame(r, slot, &frame) == -1) {
+                return -1;
+            }
+        } else if (used >= PROTO_HDR_SIZE && PROTO_HDR_SIZE + frame.len > s->rx.cap) {
+            c->pending    = frame;
+            c->streaming  = 1;
+            c->stream_off = 0;
+            n             = PROTO_HDR_SIZE;
+        }
+
+        if (n == 0) {
+            if (shm_prepare_sleep(s, used)) {
+                return 0;
+            }
+            continue;
+        }
+        shm_consume(s, n);
+        done += n;
+        r->stats.rx_bytes += n;
+        reactor_seg_conn(r, slot, n, 0);
+    }
+    return 0; // stopped early, reactor_shm_resume picks it up after the flush
+}
+
+static inline void reactor_shm_close(reactor_t* r, clientstate_t* c) {
+    shm_conn_t* s = c->shm;
+
+    r->stats.shm_wakeups += s->wakeups_sent;
+    r->stats.shm_wakeups_saved += s->wakeups_skipped;
+    r->fd_slot[s->sock] = -1;
+    shm_destroy(s); // closes c->fd too
+    free(s);
+    c->shm = NULL;
+}
+
+#else
+
+static inline int reactor_shm_accept(reactor_t* r) {
+    (void)r;
+    return -1;
+}
+
+static inline int reactor_shm_sock(clientstate_t* c) {
+    (void)c;
+    return -1;
+}
+
+static inline int reactor_shm_flush(reactor_t* r, clientstate_t* c) {
+    (void)r;
+    (void)c;
+    return -1;
+}
+
+static inline void reactor_shm_resume(clientstate_t* c) {
+    (void)c;
+}
+
+static inline int reactor_shm_on_readable(reactor_t* r, int slot) {
+    (void)r;
+    (void)slot;
+    return -1;
+}
+
+static inline void reactor_shm_close(reactor_t* r, clientstate_t* c) {
+    (void)r;
+    (void)c;
+}
+
+#endif
+
+// Writes out as much of the queue as the socket takes. Returns -1 on a fatal write error;
+// anything left over stays queued and the caller asks the backend for EV_WRITE.
+static inline int reactor_flush(reactor_t* r, int slot) {
+    clientstate_t* c = &r->clients[slot];
+    int rc           = 0;
+
+    if (c->shm != NULL) {
+        return reactor_shm_flush(r, c);
+    }
+    if (c->peer != -1) {
+        return reactor_proxy_flush(r, slot);
+    }
+
+    // cork for the whole batch this flush writes; a batch that cannot all go out now stays
+    // corked until a later flush finishes it
+    if (c->flush_policy == FLUSH_CORK && !c->corked && reactor_tx_ready(c) > 0) {
+        set_tcp_option(c->fd, TCP_CORK, 1);
+        c->corked = 1;
+    }
+
+    while (reactor_tx_ready(c) > 0) {
+        size_t offered;
+        ssize_t n = outq_writev(&c->tx, &r->pool, c->fd, reactor_tx_ready(c), &offered);
+        r->stats.tx_syscalls++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            rc = (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+            if (rc == 0) {
+                reactor_flight(r, slot, FL_WRITE_EAGAIN, 0, 0);
+            }
+            break;
+        }
+        reactor_flight(r, slot, (size_t)n < offered ? FL_WRITE_SHORT : FL_WRITE, (size_t)n, 0);
+        REACTOR_PROBE3(write, c->fd, n, offered);
+        reactor_seg_conn(r, slot, 0, (size_t)n);
+        r->stats.tx_bytes += (size_t)n;
+        reactor_tx_drained(r, (size_t)n);
+        if (c->tx_gated) {
+            c->tx_gate -= (size_t)n;
+        }
+        if ((size_t)n < offered) {
+            break; // short write, the socket buffer is full
+        }
+    }
+
+    if (c->corked && (reactor_tx_ready(c) == 0 || rc == -1)) {
+        set_tcp_option(c->fd, TCP_CORK, 0);
+        c->corked = 0;
+    }
+    return rc;
+}
+
+// EV_* bits the connection needs right now. This is where backpressure happens: a client
+// that does not read its replies stops having its requests read, so it cannot make the
+// server queue more than about tx_high (plus one read budget worth of replies) for it.
+static inline unsigned reactor_wanted_events(reactor_t* r, clientstate_t* c) {
+    if (c->state == STATE_HANDSHAKE) {
+        return c->tls_want;
+    }
+    if (c->peer != -1) {
+        return reactor_proxy_wanted_events(r, c);
+    }
+    if (c->tx.bytes >= r->tx_high) {
+        if (!c->rx_paused) {
+            r->stats.rx_pauses++;
+        }
+        c->rx_paused = 1;
+    } else if (c->tx.bytes <= r->tx_low) {
+        c->rx_paused = 0;
+    }
+
+    int paused = c->rx_paused || c->rx_hold || (r->tx_capped && c->tx.bytes > 0);
+    if (c->shm != NULL) {
+        // the eventfd brings both new frames and freed reply space, it is never taken out
+        if (!paused) {
+            reactor_shm_resume(c);
+        }
+        return EV_READ;
+    }
+    return (paused ? 0 : EV_READ) | (reactor_tx_ready(c) > 0 ? EV_WRITE : 0);
+}
+
+static inline void reactor_release_direct(reactor_t* r, clientstate_t* c) {
+    if (c->direct_buf != NULL && c->direct_pooled) {
+        bufpool_put(&r->pool, c->direct_buf, c->pending.len);
+    }
+    c->direct_buf = NULL;
+}
+
+// Switches the connection to direct payload receive for the frame whose header is at the
+// head of the ring. The part of the payload that already arrived with the header is the only
+// thing ever copied; everything after it is read straight into the destination. Returns -1
+// when there is no memory for the payload.
+static inline int reactor_begin_direct(reactor_t* r, int slot, const proto_frame_t* frame) {
+    clientstate_t* c = &r->clients[slot];
+    ringbuf_t* rx    = &c->rx;
+    size_t have      = rb_used(rx) - PROTO_HDR_SIZE;
+
+    c->pending       = *frame;
+    c->direct_buf    = reactor_payload_buffer(r, slot, frame->type, frame->len);
+    c->direct_pooled = c->direct_buf == NULL;
+    if (c->direct_pooled) {
+        c->direct_buf = bufpool_get(&r->pool, frame->len);
+    }
+    if (c->direct_buf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(c->direct_buf, rb_read_ptr(rx) + PROTO_HDR_SIZE, have);
+    c->direct_got = have;
+    rb_consume(rx, rb_used(rx));
+    return 0;
+}
+
+// Hands whatever part of the streamed payload is in the ring to reactor_on_chunk.
+static inline int reactor_feed_stream(reactor_t* r, int slot) {
+    clientstate_t* c = &r->clients[slot];
+    size_t left      = c->pending.len - c->stream_off;
+    size_t n         = rb_used(&c->rx) < left ? rb_used(&c->rx) : left;
+    proto_chunk_t chunk;
+
+    if (n == 0) {
+        return 0;
+    }
+    chunk.type   = c->pending.type;
+    chunk.len    = c->pending.len;
+    chunk.offset = c->stream_off;
+    chunk.data   = rb_read_ptr(&c->rx);
+    chunk.n      = n;
+    if (reactor_on_chunk(r, slot, &chunk) == -1) {
+        return -1;
+    }
+    rb_consume(&c->rx, n);
+    c->stream_off += n;
+    if (c->stream_off == c->pending.len) {
+        c->streaming = 0;
+        r->stats.frames++;
+        reactor_flight(r, slot, FL_FRAME, c->pending.len, c->pending.type);
+    }
+    return 0;
+}
+
+// Parses and dispatches every complete frame in the receive ring. A partial frame stays
+// where it is and the next read appends to it, unless its payload is big enough to be worth
+// receiving directly or so big that it has to be streamed.
+static inline int reactor_parse_frames(reactor_t* r, int slot) {
+    ringbuf_t* rx = &r->clients[slot].rx;
+    proto_frame_t frame;
+    size_t n;
+
+    while ((n = proto_parse(rb_read_ptr(rx), rb_used(rx), &frame)) > 0) {
+        r->stats.frames++;
+        reactor_flight(r, slot, FL_FRAME, frame.len, frame.type);
+        if (reactor_handle_frame(r, slot, &frame) == -1) {
+            return -1;
+        }
+        rb_consume(rx, n);
+    }
+    if (rb_used(rx) < PROTO_HDR_SIZE) {
+        return 0;
+    }
+    if (frame.len > RX_STREAM_MIN) {
+        clientstate_t* c = &r->clients[slot];
+        c->pending       = frame;
+        c->streaming     = 1;
+        c->stream_off    = 0;
+        rb_consume(rx, PROTO_HDR_SIZE);
+        return reactor_feed_stream(r, slot);
+    }
+    if (frame.len >= RX_DIRECT_MIN) {
+        return reactor_begin_direct(r, slot, &frame);
+    }
+    return 0;
+}
+
+// readv into [rest of the pending payload][ring free space]: the payload lands in its final
+// buffer and whatever follows it on the wire still goes to the ring, in one syscall. Both
+// together stay within rx_budget like a ring read; while the payload alone is over it, only
+// the payload is read.
+static inline ssize_t reactor_read_direct(reactor_t* r, int slot) {
+    clientstate_t* c = &r->clients[slot];
+    size_t left      = c->pending.len - c->direct_got;
+    struct iovec iov[2];
+
+    iov[0].iov_base = c->direct_buf + c->direct_got;
+    iov[0].iov_len  = left < r->rx_budget ? left : r->rx_budget;
+    iov[1].iov_base = rb_write_ptr(&c->rx);
+    iov[1].iov_len  = r->rx_budget - iov[0].iov_len;
+    if (iov[1].iov_len > rb_space(&c->rx)) {
+        iov[1].iov_len = rb_space(&c->rx);
+    }
+
+    ssize_t n = readv(c->fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+    if (n <= 0) {
+        return n;
+    }
+    size_t to_payload = (size_t)n < iov[0].iov_len ? (size_t)n : iov[0].iov_len;
+    c->direct_got += to_payload;
+    r->stats.rx_direct_bytes += to_payload;
+    rb_produce(&c->rx, (size_t)n - to_payload);
+
+    if (c->direct_got == c->pending.len) {
+        proto_frame_t frame = c->pending;
+        frame.payload       = c->direct_buf;
+        r->stats.frames++;
+        reactor_flight(r, slot, FL_FRAME, frame.len, frame.type);
+        int rc = reactor_handle_frame(r, slot, &frame);
+        reactor_release_direct(r, c);
+        if (rc == -1) {
+            errno = EPROTO;
+            return -1;
+        }
+    }
+    return n;
+}
+
+// Returns -1 when the connection is finished and should be closed.
+static inline int reactor_on_readable(reactor_t* r, int slot) {
+    clientstate_t* c = &r->clients[slot];
+    ssize_t bytes_read;
+
+    if (c->shm != NULL) {
+        return reactor_shm_on_readable(r, slot);
+    }
+    if (c->peer != -1) {
+        return reactor_proxy_on_readable(r, slot);
+    }
+    if (c->state == STATE_HANDSHAKE) {
+        // the sync at the end of the iteration picks up whatever the handshake waits for next
+        reactor_mark_dirty(r, slot);
+        return tls_handshake(r, c);
+    }
+    if (c->direct_buf != NULL) {
+        bytes_read = reactor_read_direct(r, slot);
+    } else if (rb_space(&c->rx) == 0) {
+        return -1; // cannot happen while RX_RING_SIZE holds a maximal frame
+    } else {
+        // whatever is left over past the budget is picked up on the next wakeup
+        size_t want = rb_space(&c->rx) < r->rx_budget ? rb_space(&c->rx) : r->rx_budget;
+        bytes_read  = read(c->fd, rb_write_ptr(&c->rx), want);
+        if (bytes_read > 0) {
+            rb_produce(&c->rx, (size_t)bytes_read);
+        }
+    }
+
+    if (bytes_read >= 0) {
+        REACTOR_PROBE2(read, c->fd, bytes_read);
+    }
+    if (bytes_read == 0) {
+        reactor_flight(r, slot, FL_EOF, 0, 0);
+        c->rx_eof = 1; // lets reactor_on_close tell an orderly close from an error
+        return -1;
+    }
+    if (bytes_read < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            reactor_flight(r, slot, FL_READ_EAGAIN, 0, 0);
+        }
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    reactor_flight(r, slot, FL_READ, (size_t)bytes_read, 0);
+    reactor_seg_conn(r, slot, (size_t)bytes_read, 0);
+    r->stats.rx_bytes += (size_t)bytes_read;
+    if (c->direct_buf != NULL) {
+        return 0; // still waiting for the rest of the payload
+    }
+    if (c->streaming) {
+        if (reactor_feed_stream(r, slot) == -1) {
+            return -1;
+        }
+        if (c->streaming) {
+            return 0;
+        }
+    }
+    return reactor_parse_frames(r, slot);
+}
+
+// The backend must already have forgotten the fd (select/poll keep their own fd lists).
+static inline void reactor_close(reactor_t* r, int slot) {
+    clientstate_t* c = &r->clients[slot];
+
+    reactor_on_close(r, slot);
+    reactor_flight(r, slot, FL_CLOSE, 0, 0);
+    REACTOR_PROBE2(close, c->fd, slot);
+    if (c->tls != NULL) {
+        tls_free(c);
+    }
+    if (c->peer != -1) {
+        reactor_proxy_unpair(r, c);
+    }
+    if (c->shm != NULL) {
+        reactor_shm_close(r, c);
+    } else {
+        r->stats.tx_segments += tcp_segments_out(c->fd);
+        close(c->fd);
+    }
+    rb_consume(&c->rx, rb_used(&c->rx));
+    reactor_release_direct(r, c);
+    reactor_tx_drained(r, c->tx.bytes);
+    outq_clear(&c->tx, &r->pool);
+    reactor_unmark_dirty(r, slot); // the slot may be reused and marked again this iteration
+    c->rx_paused               = 0;
+    c->rx_hold                 = 0;
+    c->adopted                 = 0;
+    c->close_pending           = 0;
+    c->tx_gated                = 0;
+    c->tx_gate                 = 0;
+    c->corked                  = 0;
+    c->rx_eof                  = 0;
+    c->streaming               = 0;
+    r->fd_slot[c->fd]          = -1;
+    c->fd                      = -1;
+    c->state                   = STATE_DISCONNECTED;
+    r->free_slots[r->n_free++] = slot;
+    reactor_seg_conn(r, slot, 0, 0);
+    if (r->verbose) {
+        printf("Client disconnected or error\n");
+    }
+}
+
+#endif
@@ -0,0 +1,206 @@
+// Event loop "template". Include this file once per backend with BACKEND defined to the
+// backend prefix (select, poll, epoll, uring); it expands to reactor_run_<BACKEND>() whose
+// calls into the backend are plain static inline functions, so the compiler inlines the
+// whole hot loop for that backend with no function pointers involved.
+//
+// A backend <name> provides:
+//   <name>_be_t                                       backend state
+//   int  <name>_be_init(b, fd_cap)                     0 / -1
+//   void <name>_be_destroy(b)
+//   int  <name>_be_add(b, fd, events)                  start watching fd for EV_* bits
+//   int  <name>_be_mod(b, fd, events)                  change the watched bits
+//   void <name>_be_del(b, fd)                          forget fd, called before close()
+//   int  <name>_be_wait(b, out, max, timeout_ms)       fill out[] with ready fds, -1 on error
+//
+// No include guard on purpose.
+
+#ifndef BACKEND
+#error "define BACKEND before including reactor_loop.h"
+#endif
+
+#define BK_CAT2(a, b) a##_##b
+#define BK_CAT(a, b) BK_CAT2(a, b)
+#define BK(fn) BK_CAT(BACKEND, BK_CAT(be, fn))
+
+static inline void BK_CAT(reactor_drop, BACKEND)(reactor_t* r, BK(t)* b, int slot) {
+    int peer = r->clients[slot].peer;
+
+    if (r->clients[slot].shm != NULL) {
+        BK(del)(b, reactor_shm_sock(&r->clients[slot]));
+    }
+    BK(del)(b, r->clients[slot].fd);
+    reactor_close(r, slot);
+    // the two halves of a proxied connection go together
+    if (peer != -1) {
+        BK(del)(b, r->clients[peer].fd);
+        reactor_close(r, peer);
+    }
+}
+
+// Flushes a connection's output and brings the backend's interest set in line with it:
+// EV_WRITE only while something is still queued. Closes it instead if reactor_close_later
+// asked for that.
+static inline void BK_CAT(reactor_sync, BACKEND)(reactor_t* r, BK(t)* b, int slot) {
+    clientstate_t* c = &r->clients[slot];
+
+    if (reactor_flush(r, slot) == -1 || c->close_pending) {
+        BK_CAT(reactor_drop, BACKEND)(r, b, slot);
+        return;
+    }
+    unsigned want = reactor_wanted_events(r, c);
+    if (c->adopted) {
+        if (BK(add)(b, c->fd, want) == -1) {
+            BK_CAT(reactor_drop, BACKEND)(r, b, slot);
+            return;
+        }
+        c->adopted  = 0;
+        c->interest = want;
+        return;
+    }
+    if (want != c->interest) {
+        if (BK(mod)(b, c->fd, want) == -1) {
+            BK_CAT(reactor_drop, BACKEND)(r, b, slot);
+            return;
+        }
+        c->interest = want;
+    }
+}
+
+static int BK_CAT(reactor_run, BACKEND)(reactor_t* r, volatile sig_atomic_t* stop) {
+    BK(t) b;
+    ev_t events[MAX_EVENTS];
+
+    if (BK(init)(&b, r->fd_cap) == -1) {
+        perror("backend init");
+        return -1;
+    }
+    if (BK(add)(&b, r->listen_fd, EV_READ) == -1) {
+        perror("backend add listener");
+        BK(destroy)(&b);
+        return -1;
+    }
+    if (r->unix_fd != -1 && BK(add)(&b, r->unix_fd, EV_READ) == -1) {
+        perror("backend add shm listener");
+        BK(destroy)(&b);
+        return -1;
+    }
+
+    int timeout = 0; // one pass straight away, so reactor_on_iteration runs before any event
+    while (!*stop) {
+        REACTOR_PROBE1(sleep, timeout);
+        int n = BK(wait)(&b, events, MAX_EVENTS, timeout);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("wait");
+            break;
+        }
+        clk_tick();
+        REACTOR_PROBE1(wake, n);
+
+        // with FAIR_ROTATE the entry serviced first moves along by one every iteration, so no
+        // position in the ready list is always first (and flushed first) or always last
+        int start = 0;
+        if (r->fairness == FAIR_ROTATE && n > 0) {
+            start = (int)(r->rr_offset++ % (unsigned)n);
+        }
+
+        for (int k = 0; k < n; k++) {
+            int i  = start + k < n ? start + k : start + k - n;
+            int fd = events[i].fd;
+
+            if (fd == r->listen_fd) {
+                int slot;
+                while ((slot = reactor_accept(r)) != -1) {
+                    if (slot < 0) {
+                        continue;
+                    }
+                    if (BK(add)(&b, r->clients[slot].fd, EV_READ) == -1) {
+                        perror("backend add");
+                        reactor_close(r, slot);
+                        continue;
+                    }
+                    r->clients[slot].interest = EV_READ;
+                    if (r->upstream != NULL) {
+                        int up = reactor_proxy_pair(r, slot);
+                        if (up == -1 || BK(add)(&b, r->clients[up].fd, EV_READ) == -1) {
+                            BK_CAT(reactor_drop, BACKEND)(r, &b, slot);
+                            continue;
+                        }
+                        r->clients[up].interest = EV_READ;
+                    }
+
+                    // with TCP_DEFER_ACCEPT or a TFO SYN the request is already in the socket,
+                    // reading it now saves a trip around the loop
+                    if (r->read_on_accept) {
+                        unsigned long long before = r->stats.rx_bytes;
+                        if (reactor_on_readable(r, slot) == -1) {
+                            BK_CAT(reactor_drop, BACKEND)(r, &b, slot);
+                        } else if (r->stats.rx_bytes != before) {
+                            r->stats.accept_reads++;
+                        }
+                    }
+                }
+                continue;
+            }
+            if (fd == r->unix_fd) {
+                int slot;
+                while ((slot = reactor_shm_accept(r)) != -1) {
+                    if (slot < 0) {
+                        continue;
+                    }
+                    clientstate_t* c = &r->clients[slot];
+                    if (BK(add)(&b, c->fd, EV_READ) == -1 || BK(add)(&b, reactor_shm_sock(c), EV_READ) == -1) {
+                        perror("backend add");
+                        BK_CAT(reactor_drop, BACKEND)(r, &b, slot);
+                        continue;
+                    }
+                    c->interest = EV_READ;
+                }
+                continue;
+            }
+
+            int slot = find_slot_by_fd(r, fd);
+            if (slot == -1) {
+                continue; // closed earlier in this batch
+            }
+            if (r->clients[slot].shm != NULL && fd != r->clients[slot].fd) {
+                // a shm client never writes to its Unix socket, readable means it hung up
+                BK_CAT(reactor_drop, BACKEND)(r, &b, slot);
+                continue;
+            }
+            // a TLS handshake can be waiting on EV_WRITE as well, reactor_on_readable runs it
+            if ((events[i].events & (EV_READ | EV_ERROR)) || r->clients[slot].state == STATE_HANDSHAKE) {
+                if (reactor_on_readable(r, slot) == -1) {
+                    BK_CAT(reactor_drop, BACKEND)(r, &b, slot);
+                    continue;
+                }
+            }
+            if (events[i].events & EV_WRITE) {
+                reactor_mark_dirty(r, slot);
+            }
+        }
+
+        timeout = reactor_on_iteration(r);
+
+        // deferred flush: one writev per connection that produced output this iteration,
+        // however many replies its handlers queued. Taken from the end, so a close during a
+        // sync (which takes its slot off the list) or a peer marked by one only ever changes
+        // the part still to do.
+        while (r->n_dirty > 0) {
+            int slot               = r->dirty[--r->n_dirty];
+            r->clients[slot].dirty = 0;
+            BK_CAT(reactor_sync, BACKEND)(r, &b, slot);
+        }
+        reactor_seg_publish(r);
+    }
+
+    BK(destroy)(&b);
+    return 0;
+}
+
+#undef BK
+#undef BK_CAT
+#undef BK_CAT2
+#undef BACKEND
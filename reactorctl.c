@@ -0,0 +1,60 @@
+// Sends one admin command to a running reactor and prints its answer (PROTO_ADMIN, which the
+// server only takes from the same host).
+//
+//     cc -O2 reactorctl.c -o reactorctl
+//     ./reactorctl conns                  # the serving loop's open connections and their fds
+//     ./reactorctl flight 12              # fd 12's last events, server started with -E
+//     ./reactorctl -p 9191 help
+
+#include "client.h"
+
+#define REPLY_MAX (64 * 1024)
+
+int main(int argc, char** argv) {
+    const char* host = "127.0.0.1";
+    int port         = 9090;
+    char cmd[128]    = "";
+    size_t len       = 0;
+    static char reply[REPLY_MAX];
+    proto_type_e type;
+    client_t c;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:p:h")) != -1) {
+        switch (opt) {
+        case 'H':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-H host] [-p port] command [args]\n", argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    // the words after the options, joined back into one command line
+    for (int i = optind; i < argc; i++) {
+        len += (size_t)snprintf(cmd + len, sizeof(cmd) - len, "%s%s", i > optind ? " " : "", argv[i]);
+        if (len >= sizeof(cmd)) {
+            fprintf(stderr, "command too long\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (len == 0) {
+        len = (size_t)snprintf(cmd, sizeof(cmd), "help");
+    }
+
+    if (client_init(&c, host, port, 1) == -1) {
+        perror("client_init");
+        exit(EXIT_FAILURE);
+    }
+    ssize_t n = client_call(&c, PROTO_ADMIN, cmd, len, reply, sizeof(reply), &type);
+    if (n < 0 || type != PROTO_ADMIN) {
+        fprintf(stderr, "no answer from %s:%d (admin commands are only taken from the same host)\n", host, port);
+        exit(EXIT_FAILURE);
+    }
+    fwrite(reply, 1, (size_t)n < sizeof(reply) ? (size_t)n : sizeof(reply), stdout);
+    client_destroy(&c);
+    return EXIT_SUCCESS;
+}
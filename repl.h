@@ -0,0 +1,383 @@
+#ifndef REPL_H
+#define REPL_H
+
+// Leader -> follower replication of the store, over the ordinary frame protocol.
+//
+// A follower (reactor.c's -O host:port) connects to the leader's listener like any client and
+// sends PROTO_REPLICATE. The leader forks, as for a snapshot (snapshot.h), and the child writes
+// the whole store to the follower's socket as PROTO_SET frames between two PROTO_REPLICATE
+// frames: the first holds the leader's table size, the last its position. The parent meanwhile keeps serving and queues every
+// mutation it applies for the follower behind a gate that opens when the child is done, so
+// the stream carries on exactly where the copy ends. Like a client's acknowledgement, a
+// streamed mutation waits for the group commit (wal.h): a follower never gets ahead of what
+// the leader has on disk.
+//
+// After every iteration that streamed something, and every REPL_BEAT_MS when idle, the leader
+// adds a PROTO_POSITION frame: its mutation count and wall-clock time. A follower's lag is how
+// long after that time it gets to apply the frame.
+//
+// A follower answers PROTO_GET from its own copy and refuses writes. A copy is received into a
+// second table and swapped in at its end, so while a follower resyncs after losing its leader
+// reads keep being answered, from the old data. That table starts at the leader's size: the
+// keys arrive in the order of the leader's slots, which inserted into a smaller table piles
+// them up in long runs that every later probe has to walk.
+//
+// Included by the program after snapshot.h.
+
+#include <poll.h>
+
+#define REPL_MAX_FOLLOWERS 16
+#define REPL_BEAT_MS 100
+#define REPL_COPY_POLL_MS 10 // what a follower streams during its copy waits for the copy's end
+#define REPL_RETRY_SECS 1
+#define REPL_REPORT_SECS 5
+
+typedef struct {
+    int slot;  // -1 once the follower is gone; the child may still need reaping
+    pid_t pid; // child copying the store to it, 0 once the copy is through
+} repl_follower_t;
+
+typedef struct {
+    // leader side
+    repl_follower_t followers[REPL_MAX_FOLLOWERS];
+    int n_followers;
+    uint64_t seq; // mutations applied since the leader started
+    uint64_t beat_ns;
+    int streamed; // mutations streamed since the last PROTO_POSITION
+
+    // follower side
+    struct sockaddr_in leader_addr;
+    int following;
+    int leader; // slot of the connection to the leader, -1 while there is none
+    uint64_t retry_ns;
+    kv_t incoming; // the copy being received
+    int copying;
+    uint64_t copy_ns;
+    uint64_t leader_seq; // leader position the store is at
+    long long lag_us;
+    long long max_lag_us;
+    uint64_t reported_ns;
+} repl_t;
+
+static inline void repl_put64(char* p, uint64_t v) {
+    uint32_t hi = htonl((uint32_t)(v >> 32));
+    uint32_t lo = htonl((uint32_t)v);
+    memcpy(p, &hi, sizeof(hi));
+    memcpy(p + sizeof(hi), &lo, sizeof(lo));
+}
+
+static inline uint64_t repl_get64(const char* p) {
+    uint32_t hi, lo;
+    memcpy(&hi, p, sizeof(hi));
+    memcpy(&lo, p + sizeof(hi), sizeof(lo));
+    return (uint64_t)ntohl(hi) << 32 | ntohl(lo);
+}
+
+static inline uint64_t repl_wall_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline void repl_init(repl_t* rp) {
+    memset(rp, 0, sizeof(*rp));
+    rp->leader = -1;
+}
+
+// ---- leader --------------------------------------------------------------------------------
+
+// Blocking write for the child, whose socket is shared with the parent and so stays non-blocking.
+static inline int repl_write_all(int fd, const char* p, size_t n) {
+    while (n > 0) {
+        ssize_t k = write(fd, p, n);
+        if (k < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { fd, POLLOUT, 0 };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += k;
+        n -= (size_t)k;
+    }
+    return 0;
+}
+
+// Runs in the child: the store as PROTO_SET frames between the two PROTO_REPLICATE.
+static inline int repl_copy(const kv_t* kv, int fd, uint64_t seq) {
+    char* buf   = malloc(SNAP_BUF);
+    size_t fill = PROTO_HDR_SIZE + 8;
+    uint64_t n  = 0;
+
+    if (buf == NULL) {
+        return -1;
+    }
+    proto_encode_hdr(buf, PROTO_REPLICATE, 8);
+    repl_put64(buf + PROTO_HDR_SIZE, kv->cap);
+    for (size_t i = 0; i < kv->cap; i++) {
+        const kv_rec_t* rec = kv->slots[i].rec;
+        if (rec == NULL || rec == KV_TOMBSTONE) {
+            continue;
+        }
+        uint16_t klen = htons(rec->klen);
+        size_t head   = PROTO_HDR_SIZE + sizeof(klen) + rec->klen;
+        if (fill + head + rec->vlen > SNAP_BUF) {
+            if (repl_write_all(fd, buf, fill) == -1) {
+                free(buf);
+                return -1;
+            }
+            fill = 0;
+        }
+        proto_encode_hdr(buf + fill, PROTO_SET, sizeof(klen) + rec->klen + rec->vlen);
+        memcpy(buf + fill + PROTO_HDR_SIZE, &klen, sizeof(klen));
+        memcpy(buf + fill + PROTO_HDR_SIZE + sizeof(klen), rec->data, rec->klen);
+        fill += head;
+        // a value too big for the buffer goes out on its own
+        if (head + rec->vlen > SNAP_BUF) {
+            if (repl_write_all(fd, buf, fill) == -1 || repl_write_all(fd, kv_value(rec), rec->vlen) == -1) {
+                free(buf);
+                return -1;
+            }
+            fill = 0;
+        } else {
+            memcpy(buf + fill, kv_value(rec), rec->vlen);
+            fill += rec->vlen;
+        }
+        n++;
+    }
+    char end[PROTO_HDR_SIZE + 16];
+    proto_encode_hdr(end, PROTO_REPLICATE, 16);
+    repl_put64(end + PROTO_HDR_SIZE, seq);
+    repl_put64(end + PROTO_HDR_SIZE + 8, n);
+    int rc = repl_write_all(fd, buf, fill) == -1 || repl_write_all(fd, end, sizeof(end)) == -1 ? -1 : 0;
+    free(buf);
+    return rc;
+}
+
+// PROTO_REPLICATE from a client: it becomes a follower. Returns -1 to close it.
+static inline int repl_add_follower(repl_t* rp, kv_t* kv, wal_t* w, reactor_t* r, int slot) {
+    clientstate_t* c = &r->clients[slot];
+
+    // the child writes to the socket directly; anything the parent still had to send would
+    // end up in the middle of the copy
+    if (c->tx.bytes > 0 || c->tx_gated || c->shm != NULL || rp->n_followers == REPL_MAX_FOLLOWERS) {
+        fprintf(stderr, "fd %d: cannot become a follower now\n", c->fd);
+        return -1;
+    }
+    // the commit's list of gated slots may still name this slot for a connection that had it
+    // before, and would open the gate mid-copy
+    if (wal_pending(w)) {
+        wal_commit(w, r);
+    }
+    reactor_gate(r, slot);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        snap_close_fds(c->fd, r->fd_cap);
+        _exit(repl_copy(kv, c->fd, rp->seq) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    rp->followers[rp->n_followers].slot = slot;
+    rp->followers[rp->n_followers].pid  = pid;
+    rp->n_followers++;
+    r->stats.repl_copies++;
+    if (r->verbose) {
+        printf("fd %d follows, copying %zu keys from child %d\n", c->fd, kv->count, (int)pid);
+    }
+    return 0;
+}
+
+// Streams an applied mutation to every follower.
+static inline void repl_forward(repl_t* rp, wal_t* w, reactor_t* r, const proto_frame_t* f) {
+    rp->seq++;
+    for (int i = 0; i < rp->n_followers; i++) {
+        int slot = rp->followers[i].slot;
+        if (slot == -1) {
+            continue;
+        }
+        // one lost frame and the follower silently diverges, it has to start over instead
+        if (reactor_send_frame(r, slot, f->type, f->payload, f->len) == -1 ||
+            (rp->followers[i].pid == 0 && wal_wait(w, r, slot) == -1)) {
+            shutdown(r->clients[slot].fd, SHUT_RDWR);
+            continue;
+        }
+        r->stats.repl_streamed++;
+        rp->streamed++;
+    }
+}
+
+static inline void repl_copy_done(wal_t* w, reactor_t* r, repl_follower_t* f, int status) {
+    f->pid = 0;
+    if (f->slot == -1) {
+        return;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "copy to follower fd %d failed\n", r->clients[f->slot].fd);
+        shutdown(r->clients[f->slot].fd, SHUT_RDWR);
+        return;
+    }
+    // what was queued during the copy may include mutations still waiting for their commit
+    if (!wal_pending(w) || wal_hold(w, f->slot) == -1) {
+        reactor_ungate(r, f->slot);
+    }
+}
+
+// ---- follower ------------------------------------------------------------------------------
+
+static inline void repl_connect(repl_t* rp, reactor_t* r) {
+    rp->retry_ns = clk_now() + REPL_RETRY_SECS * 1000000000ull;
+    int fd       = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket leader");
+        return;
+    }
+    if (connect(fd, (const struct sockaddr*)&rp->leader_addr, sizeof(rp->leader_addr)) == -1 && errno != EINPROGRESS) {
+        perror("connect leader");
+        close(fd);
+        return;
+    }
+    int slot = reactor_adopt(r, fd);
+    if (slot == -1) {
+        close(fd);
+        return;
+    }
+    reactor_set_flush_policy(r, slot, fd, r->flush_policy);
+    if (reactor_send_frame(r, slot, PROTO_REPLICATE, NULL, 0) == -1) {
+        shutdown(fd, SHUT_RDWR);
+    }
+    rp->leader  = slot;
+    rp->copying = 1;
+    rp->copy_ns = clk_now();
+}
+
+// A frame from the leader. Returns -1 to drop the connection and start over.
+static inline int repl_apply(repl_t* rp, kv_t* kv, reactor_t* r, const proto_frame_t* f) {
+    switch (f->type) {
+    case PROTO_SET:
+    case PROTO_DEL:
+        if ((rp->copying && rp->incoming.slots == NULL) || kv_apply(rp->copying ? &rp->incoming : kv, f) == -1) {
+            return -1;
+        }
+        if (!rp->copying) {
+            rp->leader_seq++;
+            r->stats.repl_applied++;
+        }
+        return 0;
+    case PROTO_REPLICATE:
+        if (rp->copying && rp->incoming.slots == NULL && f->len == 8) {
+            uint64_t cap = repl_get64(f->payload);
+            return cap > SIZE_MAX / 4 ? -1 : kv_init(&rp->incoming, (size_t)cap);
+        }
+        if (!rp->copying || rp->incoming.slots == NULL || f->len != 16) {
+            return -1;
+        }
+        kv_destroy(kv);
+        *kv             = rp->incoming;
+        rp->copying     = 0;
+        rp->leader_seq  = repl_get64(f->payload);
+        rp->reported_ns = clk_now();
+        rp->max_lag_us  = 0; // beats queued during the copy only tell how long it took
+        memset(&rp->incoming, 0, sizeof(rp->incoming));
+        printf("copied %zu keys from the leader at position %llu in %.0f ms\n",
+            kv->count,
+            (unsigned long long)rp->leader_seq,
+            (double)(clk_now() - rp->copy_ns) / 1e6);
+        return 0;
+    case PROTO_POSITION: {
+        if (f->len != 16) {
+            return -1;
+        }
+        long long lag  = ((long long)repl_wall_ns() - (long long)repl_get64(f->payload + 8)) / 1000;
+        rp->leader_seq = repl_get64(f->payload);
+        rp->lag_us     = lag > 0 ? lag : 0;
+        if (rp->lag_us > rp->max_lag_us) {
+            rp->max_lag_us = rp->lag_us;
+        }
+        return 0;
+    }
+    default:
+        return -1;
+    }
+}
+
+// ---- both ----------------------------------------------------------------------------------
+
+static inline void repl_on_close(repl_t* rp, int slot) {
+    for (int i = 0; i < rp->n_followers; i++) {
+        if (rp->followers[i].slot == slot) {
+            rp->followers[i].slot = -1;
+            if (rp->followers[i].pid != 0) {
+                kill(rp->followers[i].pid, SIGKILL);
+            }
+        }
+    }
+    if (rp->following && slot == rp->leader) {
+        fprintf(stderr, "lost the leader, reconnecting\n");
+        rp->leader = -1;
+        if (rp->copying) {
+            kv_destroy(&rp->incoming);
+            rp->copying = 0;
+        }
+    }
+}
+
+// For reactor_on_iteration: reaps finished copies, sends PROTO_POSITION, keeps a follower
+// connected. Returns how long the loop may sleep.
+static inline int repl_on_iteration(repl_t* rp, wal_t* w, reactor_t* r) {
+    uint64_t now = clk_now();
+    int live = 0, copies = 0;
+
+    for (int i = 0; i < rp->n_followers; i++) {
+        repl_follower_t* f = &rp->followers[i];
+        int status;
+        if (f->pid != 0 && waitpid(f->pid, &status, WNOHANG) == f->pid) {
+            repl_copy_done(w, r, f, status);
+        }
+        if (f->slot == -1 && f->pid == 0) {
+            *f = rp->followers[--rp->n_followers];
+            i--;
+            continue;
+        }
+        live += f->slot != -1;
+        copies += f->pid != 0;
+    }
+    if (live > 0) {
+        if (rp->streamed > 0 || now - rp->beat_ns >= REPL_BEAT_MS * 1000000ull) {
+            char pos[16];
+            repl_put64(pos, rp->seq);
+            repl_put64(pos + 8, repl_wall_ns());
+            for (int i = 0; i < rp->n_followers; i++) {
+                if (rp->followers[i].slot != -1) {
+                    reactor_send_frame(r, rp->followers[i].slot, PROTO_POSITION, pos, sizeof(pos));
+                }
+            }
+            rp->streamed = 0;
+            rp->beat_ns  = now;
+        }
+    }
+    if (!rp->following) {
+        return copies > 0 ? REPL_COPY_POLL_MS : live > 0 ? REPL_BEAT_MS : -1;
+    }
+    if (rp->leader == -1) {
+        if (now >= rp->retry_ns) {
+            repl_connect(rp, r);
+        }
+        return REPL_RETRY_SECS * 1000;
+    }
+    if (r->verbose && !rp->copying && now - rp->reported_ns >= REPL_REPORT_SECS * 1000000000ull) {
+        printf("follower at position %llu, lag %lld us, max %lld us\n",
+            (unsigned long long)rp->leader_seq,
+            rp->lag_us,
+            rp->max_lag_us);
+        rp->reported_ns = now;
+    }
+    return REPL_REPORT_SECS * 1000;
+}
+
+#endif
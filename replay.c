@@ -0,0 +1,381 @@
+// Replays a capture taken with the reactor's -Q (capture.h) against a server.
+//
+// Every connection in the capture is opened when the original sent its first frame, every
+// frame goes out at its recorded arrival time divided by -x (2 plays twice as fast, 0 sends
+// everything at once), and a connection is closed when the original was, once its replies
+// are in. Same traffic and timing against any server, backend or build, so runs compare
+// directly.
+//
+// The report gives how late frames went out against the schedule, which is the replayer's own
+// slip (when it is large, the latencies below it say more about this process than the server),
+// and the latency of every reply, from sending the frame to its reply arriving. A connection's
+// replies come in the order of its frames. PROTO_REPLICATE, a follower's request to be sent
+// the store, is not replayed.
+//
+//     cc -O2 replay.c -o replay && ./replay -f capture.bin -p 9090 -x 1
+
+#define _GNU_SOURCE // ppoll
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "proto.h"
+#include "hist.h"
+#include "capture.h"
+
+#define RX_BUF 65536
+#define DRAIN_SECS 2 // after the last frame, how long to wait for replies that do not come
+
+typedef struct {
+    int fd; // -1 until the connection's first frame, and again once closed
+    int closing;
+    char* tx; // frames not written yet
+    size_t tx_len;
+    size_t tx_off;
+    size_t tx_cap;
+    uint64_t* sent_at; // send time of each frame still waiting for its reply, FIFO
+    size_t q_head;
+    size_t q_len;
+    size_t q_cap;
+    char* rx;
+    size_t rx_len;
+    size_t rx_cap;
+} conn_t;
+
+typedef struct {
+    const char* host;
+    int port;
+    const char* path;
+    double speed;
+} options_t;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int connect_to(const options_t* o) {
+    struct sockaddr_in addr = { 0 };
+    int one                 = 1;
+
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(o->port);
+    if (inet_pton(AF_INET, o->host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "bad address %s\n", o->host);
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+static void* grow(void* p, size_t* cap, size_t need, size_t elem) {
+    size_t n = *cap > 0 ? *cap : 64;
+    while (n < need) {
+        n *= 2;
+    }
+    if (n == *cap) {
+        return p;
+    }
+    p = realloc(p, n * elem);
+    if (p == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    *cap = n;
+    return p;
+}
+
+// Queues a recorded frame, a payload kept as header only is sent as zeros.
+static void queue_frame(conn_t* c, const cap_rec_t* rec, uint64_t now) {
+    size_t n = PROTO_HDR_SIZE + rec->frame_len;
+
+    if (c->tx_off > 0 && c->tx_off == c->tx_len) {
+        c->tx_off = c->tx_len = 0;
+    }
+    c->tx = grow(c->tx, &c->tx_cap, c->tx_len + n, 1);
+    memcpy(c->tx + c->tx_len, cap_rec_frame(rec), rec->len);
+    memset(c->tx + c->tx_len + rec->len, 0, n - rec->len);
+    c->tx_len += n;
+
+    if (c->q_head > 0 && c->q_head + c->q_len == c->q_cap) {
+        memmove(c->sent_at, c->sent_at + c->q_head, c->q_len * sizeof(uint64_t));
+        c->q_head = 0;
+    }
+    c->sent_at = grow(c->sent_at, &c->q_cap, c->q_head + c->q_len + 1, sizeof(uint64_t));
+    c->sent_at[c->q_head + c->q_len++] = now;
+}
+
+static int flush_frames(conn_t* c) {
+    while (c->tx_off < c->tx_len) {
+        ssize_t n = write(c->fd, c->tx + c->tx_off, c->tx_len - c->tx_off);
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        c->tx_off += (size_t)n;
+    }
+    return 0;
+}
+
+// Returns the number of replies read, -1 when the connection is gone.
+static int read_replies(conn_t* c, hist_t* latency) {
+    if (c->rx_len == c->rx_cap) {
+        c->rx = grow(c->rx, &c->rx_cap, c->rx_cap + RX_BUF, 1);
+    }
+    ssize_t n = read(c->fd, c->rx + c->rx_len, c->rx_cap - c->rx_len);
+    if (n == 0) {
+        return -1;
+    }
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    c->rx_len += (size_t)n;
+
+    uint64_t now = now_ns();
+    int replies  = 0;
+    size_t off   = 0, len;
+    proto_frame_t frame;
+    while ((len = proto_parse(c->rx + off, c->rx_len - off, &frame)) > 0) {
+        off += len;
+        if (c->q_len > 0) {
+            hist_record(latency, (now - c->sent_at[c->q_head]) / 1000);
+            c->q_head++;
+            c->q_len--;
+        }
+        replies++;
+    }
+    memmove(c->rx, c->rx + off, c->rx_len - off);
+    c->rx_len -= off;
+    // a reply bigger than the buffer: make room for all of it
+    if (c->rx_len >= PROTO_HDR_SIZE && PROTO_HDR_SIZE + frame.len > c->rx_cap) {
+        c->rx = grow(c->rx, &c->rx_cap, PROTO_HDR_SIZE + frame.len, 1);
+    }
+    return replies;
+}
+
+static void close_conn(conn_t* c) {
+    close(c->fd);
+    c->fd      = -1;
+    c->closing = 1;
+}
+
+static int by_time(const void* a, const void* b) {
+    const cap_rec_t* x = *(const cap_rec_t* const*)a;
+    const cap_rec_t* y = *(const cap_rec_t* const*)b;
+    if (x->t_ns != y->t_ns) {
+        return x->t_ns < y->t_ns ? -1 : 1;
+    }
+    return x < y ? -1 : x > y; // records of one loop keep their file order
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s -f capture [-H host] [-p port] [-x speed]\n", prog);
+}
+
+int main(int argc, char** argv) {
+    options_t o = { "127.0.0.1", 9090, NULL, 1.0 };
+    cap_reader_t rd;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:H:p:x:h")) != -1) {
+        switch (opt) {
+        case 'f':
+            o.path = optarg;
+            break;
+        case 'H':
+            o.host = optarg;
+            break;
+        case 'p':
+            o.port = atoi(optarg);
+            break;
+        case 'x':
+            o.speed = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (o.path == NULL || o.speed < 0) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (cap_open(&rd, o.path) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    const cap_rec_t** recs = NULL;
+    size_t n = 0, recs_cap = 0, frames = 0;
+    for (const cap_rec_t* rec; (rec = cap_next(&rd)) != NULL;) {
+        recs      = grow(recs, &recs_cap, n + 1, sizeof(*recs));
+        recs[n++] = rec;
+        frames += rec->kind == CAP_FRAME;
+    }
+    qsort(recs, n, sizeof(*recs), by_time);
+    uint32_t n_conns = rd.hdr->next_conn;
+    double span      = n > 0 ? (double)recs[n - 1]->t_ns / 1e9 : 0;
+    printf("capture: %zu frames on %u connections over %.2f s, taken by %u loop%s\n",
+        frames,
+        n_conns,
+        span,
+        rd.hdr->loops,
+        rd.hdr->loops == 1 ? "" : "s");
+
+    conn_t* conns = calloc((size_t)n_conns + 1, sizeof(conn_t));
+    struct pollfd* pfd = calloc((size_t)n_conns + 1, sizeof(struct pollfd));
+    uint32_t* pconn    = calloc((size_t)n_conns + 1, sizeof(uint32_t));
+    for (uint32_t i = 0; i <= n_conns; i++) {
+        conns[i].fd = -1;
+    }
+    hist_t slip = { 0 }, latency = { 0 };
+    unsigned long long sent = 0, replies = 0, skipped = 0, lost = 0;
+
+    uint64_t start = now_ns(), last_progress = start;
+    size_t next    = 0;
+    for (;;) {
+        uint64_t now = now_ns();
+        while (next < n) {
+            const cap_rec_t* rec = recs[next];
+            uint64_t due         = start + (o.speed > 0 ? (uint64_t)((double)rec->t_ns / o.speed) : 0);
+            if (due > now) {
+                break;
+            }
+            next++;
+            if (rec->conn == 0 || rec->conn > n_conns) {
+                continue;
+            }
+            conn_t* c = &conns[rec->conn];
+            if (rec->kind == CAP_CLOSE) {
+                c->closing = 1;
+                continue;
+            }
+            if (rec->kind != CAP_FRAME) {
+                continue;
+            }
+            proto_hdr_t hdr;
+            memcpy(&hdr, cap_rec_frame(rec), sizeof(hdr));
+            if (ntohl(hdr.type) == PROTO_REPLICATE) {
+                skipped++;
+                continue;
+            }
+            if (c->closing) {
+                continue; // the server dropped it
+            }
+            if (c->fd == -1 && (c->fd = connect_to(&o)) == -1) {
+                exit(EXIT_FAILURE);
+            }
+            hist_record(&slip, (now - due) / 1000);
+            queue_frame(c, rec, now);
+            sent++;
+            if (flush_frames(c) == -1) {
+                lost += c->q_len;
+                close_conn(c);
+            }
+        }
+
+        // what is open, and what of it is finished
+        int np = 0;
+        for (uint32_t i = 1; i <= n_conns; i++) {
+            conn_t* c = &conns[i];
+            if (c->fd == -1) {
+                continue;
+            }
+            if (c->closing && c->q_len == 0 && c->tx_off == c->tx_len) {
+                close_conn(c);
+                continue;
+            }
+            pfd[np].fd     = c->fd;
+            pfd[np].events = POLLIN | (c->tx_off < c->tx_len ? POLLOUT : 0);
+            pconn[np++]    = i;
+        }
+        if (next == n && (np == 0 || now - last_progress > DRAIN_SECS * 1000000000ull)) {
+            break;
+        }
+
+        struct timespec ts = { 0, 100000000 };
+        if (next < n) {
+            uint64_t due  = start + (o.speed > 0 ? (uint64_t)((double)recs[next]->t_ns / o.speed) : 0);
+            uint64_t wait = due > now ? due - now : 0;
+            ts.tv_sec     = (time_t)(wait / 1000000000ull);
+            ts.tv_nsec    = (long)(wait % 1000000000ull);
+        }
+        if (ppoll(pfd, (nfds_t)np, &ts, NULL) == -1 && errno != EINTR) {
+            perror("ppoll");
+            exit(EXIT_FAILURE);
+        }
+        for (int k = 0; k < np; k++) {
+            conn_t* c = &conns[pconn[k]];
+            if (pfd[k].revents == 0) {
+                continue;
+            }
+            int got = 0;
+            if ((pfd[k].revents & POLLOUT) && flush_frames(c) == -1) {
+                got = -1;
+            } else if (pfd[k].revents & (POLLIN | POLLERR | POLLHUP)) {
+                got = read_replies(c, &latency);
+            }
+            if (got == -1) {
+                lost += c->q_len;
+                close_conn(c);
+                continue;
+            }
+            if (got > 0) {
+                replies += (unsigned long long)got;
+                last_progress = now_ns();
+            }
+        }
+    }
+    double took = (double)(now_ns() - start) / 1e9;
+    for (uint32_t i = 1; i <= n_conns; i++) {
+        if (conns[i].fd != -1) {
+            lost += conns[i].q_len;
+            close_conn(&conns[i]);
+        }
+    }
+
+    printf("replayed at %gx: %llu frames in %.2f s (%.2f s scheduled), %llu replies, %llu unanswered",
+        o.speed,
+        sent,
+        took,
+        o.speed > 0 ? span / o.speed : 0,
+        replies,
+        lost);
+    if (skipped > 0) {
+        printf(", %llu PROTO_REPLICATE skipped", skipped);
+    }
+    printf("\n%-14s %10s %10s %10s %10s\n", "", "p50 us", "p99 us", "p99.9 us", "max us");
+    printf("%-14s %10llu %10llu %10llu %10llu\n",
+        "send slip",
+        (unsigned long long)hist_percentile(&slip, 0.50),
+        (unsigned long long)hist_percentile(&slip, 0.99),
+        (unsigned long long)hist_percentile(&slip, 0.999),
+        (unsigned long long)slip.max);
+    printf("%-14s %10llu %10llu %10llu %10llu\n",
+        "reply latency",
+        (unsigned long long)hist_percentile(&latency, 0.50),
+        (unsigned long long)hist_percentile(&latency, 0.99),
+        (unsigned long long)hist_percentile(&latency, 0.999),
+        (unsigned long long)latency.max);
+    cap_close_reader(&rd);
+    return 0;
+}
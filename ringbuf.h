@@ -0,0 +1,133 @@
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // memfd_create and friends
+#endif
+
+// "Magic" ring buffer: the same physical pages are mapped twice, back to back.
+//
+//   virtual:  [ page 0 .. page n-1 ][ page 0 .. page n-1 ]
+//              ^ base                ^ base + cap
+//
+// Whatever sits at base + i is also at base + cap + i, so the used region starting at any
+// offset is contiguous in virtual memory even when it wraps. The frame parser can therefore
+// always look at one flat span, and a header split across the end of the buffer needs no
+// special case and no copy.
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <fcntl.h>
+
+typedef struct {
+    char* base;
+    size_t cap;  // power of two, multiple of the page size
+    size_t head; // read position, only ever grows
+    size_t tail; // write position, only ever grows
+} ringbuf_t;
+
+static inline int rb_backing_fd(size_t cap) {
+    int fd;
+#ifdef __linux__
+    fd = memfd_create("ringbuf", MFD_CLOEXEC);
+#else
+    // no memfd on macOS: an immediately unlinked POSIX shm object does the same job
+    char name[64];
+    snprintf(name, sizeof(name), "/ringbuf-%d-%p", (int)getpid(), (void*)&name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd != -1) {
+        shm_unlink(name);
+    }
+#endif
+    if (fd == -1) {
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)cap) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Maps [offset, offset + cap) of fd twice, back to back. Returns the base or MAP_FAILED.
+// Also used for the shared-memory transport, whose rings live inside one memfd.
+static inline char* rb_map_double(int fd, off_t offset, size_t cap) {
+    // reserve 2 * cap of address space first so both halves are guaranteed to be adjacent
+    char* base = mmap(NULL, 2 * cap, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    if (mmap(base, cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED ||
+        mmap(base + cap, cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED) {
+        munmap(base, 2 * cap);
+        return MAP_FAILED;
+    }
+    return base;
+}
+
+static inline int rb_init(ringbuf_t* rb, size_t cap) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (cap < page || (cap & (cap - 1)) != 0) {
+        return -1;
+    }
+
+    int fd = rb_backing_fd(cap);
+    if (fd == -1) {
+        return -1;
+    }
+    char* base = rb_map_double(fd, 0, cap);
+    // the mappings keep the pages alive, the fd itself is no longer needed
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+
+    rb->base = base;
+    rb->cap  = cap;
+    rb->head = 0;
+    rb->tail = 0;
+    return 0;
+}
+
+static inline void rb_destroy(ringbuf_t* rb) {
+    if (rb->base != NULL) {
+        munmap(rb->base, 2 * rb->cap);
+        rb->base = NULL;
+    }
+}
+
+static inline size_t rb_used(const ringbuf_t* rb) {
+    return rb->tail - rb->head;
+}
+
+static inline size_t rb_space(const ringbuf_t* rb) {
+    return rb->cap - (rb->tail - rb->head);
+}
+
+// start of the unread bytes, contiguous for rb_used() bytes
+static inline char* rb_read_ptr(const ringbuf_t* rb) {
+    return rb->base + (rb->head & (rb->cap - 1));
+}
+
+// start of the free space, contiguous for rb_space() bytes
+static inline char* rb_write_ptr(const ringbuf_t* rb) {
+    return rb->base + (rb->tail & (rb->cap - 1));
+}
+
+static inline void rb_produce(ringbuf_t* rb, size_t n) {
+    rb->tail += n;
+}
+
+static inline void rb_consume(ringbuf_t* rb, size_t n) {
+    rb->head += n;
+    // keep the counters small once everything is consumed
+    if (rb->head == rb->tail) {
+        rb->head = 0;
+        rb->tail = 0;
+    }
+}
+
+#endif
@@ -3,15 +3,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <unistd.h>
-
-typedef enum {
-    PROTO_HELLO,
-} proto_type_e;
-
-typedef struct {
-    proto_type_e type;
-    unsigned short len;
-} proto_hdr_t;
+#include "proto.h"
 
 void handle_client(int cfd) {
     char buf[4096] = { 0 };
@@ -0,0 +1,358 @@
+#ifndef SHM_H
+#define SHM_H
+
+// Same-host shared-memory transport (Linux only).
+//
+// A client connects to the server's Unix socket and gets back, over SCM_RIGHTS, one memfd and
+// two eventfds. The memfd holds a control page and two single-producer / single-consumer rings
+// (client -> server and server -> client) that carry ordinary proto_hdr_t frames. Each side
+// maps every ring twice back to back (see rb_map_double) so a frame is always contiguous.
+//
+// Wakeups are only paid for when the other side is idle: a consumer that has drained its ring
+// sets consumer_waiting and re-checks the ring before going to sleep on its eventfd, and a
+// producer only writes the eventfd when it sees that flag. A producer that finds the ring full
+// sets producer_waiting the same way and is woken once the consumer frees space. The server's
+// eventfd sits in the event loop like any socket, so shm and TCP clients share one loop.
+//
+// The Unix socket stays open for the lifetime of the connection; its EOF is how either side
+// notices the other went away.
+//
+// The control page is writable by both sides, so neither trusts what it finds there. Each
+// side keeps its own index (head of the ring it consumes, tail of the one it produces) in
+// private memory and only ever stores it to the page. The peer's index is loaded once per
+// look into a local and checked: it only moves forward, and head and tail never end up more
+// than the ring size apart. A peer that breaks either rule gets -1 from the ring operations
+// and the connection is dropped.
+
+#ifdef __linux__
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "ringbuf.h"
+
+#define SHM_RING_SIZE (1024 * 1024)
+#define SHM_PAGE 4096
+
+// one direction; producer and consumer fields sit on separate cache lines
+typedef struct {
+    uint64_t tail;
+    char pad0[56];
+    uint64_t head;
+    char pad1[56];
+    uint32_t consumer_waiting;
+    char pad2[60];
+    uint32_t producer_waiting;
+    char pad3[60];
+} shm_ring_ctl_t;
+
+typedef struct {
+    shm_ring_ctl_t c2s;
+    shm_ring_ctl_t s2c;
+} shm_ctl_t;
+
+typedef struct {
+    shm_ring_ctl_t* ctl;
+    char* data; // 2 * cap of virtual memory, both halves the same pages
+    size_t cap;
+    uint64_t own;  // this side's index, the page's copy is never read back
+    uint64_t peer; // the peer's index as last checked
+} shm_ring_t;
+
+typedef struct {
+    shm_ctl_t* ctl;
+    shm_ring_t rx; // the ring this side consumes
+    shm_ring_t tx; // the ring this side produces
+    int my_efd;    // written by the peer when this side has something to look at
+    int peer_efd;
+    int sock;
+    unsigned long long wakeups_sent;
+    unsigned long long wakeups_skipped; // produced while the peer was busy anyway
+} shm_conn_t;
+
+// ---- ring operations, valid from either side ------------------------------------------------
+
+// Bytes waiting in a ring this side consumes, -1 when the producer's tail is impossible.
+static inline ssize_t shm_ring_used(shm_ring_t* r) {
+    uint64_t tail = __atomic_load_n(&r->ctl->tail, __ATOMIC_ACQUIRE);
+
+    if ((int64_t)(tail - r->peer) < 0 || tail - r->own > r->cap) {
+        return -1;
+    }
+    r->peer = tail;
+    return (ssize_t)(tail - r->own);
+}
+
+// Free bytes in a ring this side produces, -1 when the consumer's head is impossible.
+static inline ssize_t shm_ring_space(shm_ring_t* r) {
+    uint64_t head = __atomic_load_n(&r->ctl->head, __ATOMIC_ACQUIRE);
+
+    if ((int64_t)(head - r->peer) < 0 || r->own - head > r->cap) {
+        return -1;
+    }
+    r->peer = head;
+    return (ssize_t)(r->cap - (r->own - head));
+}
+
+static inline const char* shm_ring_read_ptr(const shm_ring_t* r) {
+    return r->data + (r->own & (r->cap - 1));
+}
+
+static inline void shm_notify(shm_conn_t* c) {
+    uint64_t one = 1;
+    if (write(c->peer_efd, &one, sizeof(one)) == sizeof(one)) {
+        c->wakeups_sent++;
+    }
+}
+
+// Copies as much of data as fits and wakes the consumer if it is asleep.
+// Returns the number of bytes copied, -1 when the consumer broke the ring.
+static inline ssize_t shm_produce(shm_conn_t* c, const void* data, size_t len) {
+    shm_ring_t* r = &c->tx;
+    ssize_t space = shm_ring_space(r);
+
+    if (space == -1) {
+        return -1;
+    }
+    size_t n = len < (size_t)space ? len : (size_t)space;
+    if (n == 0) {
+        return 0;
+    }
+    memcpy(r->data + (r->own & (r->cap - 1)), data, n);
+    r->own += n;
+    // seq_cst store then load, mirrored by shm_prepare_sleep: either we see the consumer's
+    // flag or it sees our new tail, never neither
+    __atomic_store_n(&r->ctl->tail, r->own, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->ctl->consumer_waiting, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&r->ctl->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+        shm_notify(c);
+    } else {
+        c->wakeups_skipped++;
+    }
+    return (ssize_t)n;
+}
+
+// Frees n consumed bytes, at most what shm_ring_used last returned, and wakes a producer that
+// was waiting for space.
+static inline void shm_consume(shm_conn_t* c, size_t n) {
+    shm_ring_t* r = &c->rx;
+
+    r->own += n;
+    __atomic_store_n(&r->ctl->head, r->own, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->ctl->producer_waiting, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&r->ctl->producer_waiting, 0, __ATOMIC_SEQ_CST);
+        shm_notify(c);
+    }
+}
+
+// Announces that this side is about to sleep on its rx ring, having looked at `seen` bytes
+// (a partial frame, or nothing). Returns 0 if more arrived in the meantime (flag withdrawn,
+// keep going) or the ring is broken (the caller's next look finds out), 1 if it is safe to
+// block on my_efd.
+static inline int shm_prepare_sleep(shm_conn_t* c, size_t seen) {
+    __atomic_store_n(&c->rx.ctl->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+    ssize_t used = shm_ring_used(&c->rx);
+    if (used == -1 || (size_t)used > seen) {
+        __atomic_store_n(&c->rx.ctl->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+    return 1;
+}
+
+// Same for a producer facing a full tx ring. Returns 0 if space appeared in the meantime.
+static inline int shm_wait_space(shm_conn_t* c, size_t need) {
+    __atomic_store_n(&c->tx.ctl->producer_waiting, 1, __ATOMIC_SEQ_CST);
+    ssize_t space = shm_ring_space(&c->tx);
+    if (space == -1 || (size_t)space >= need) {
+        __atomic_store_n(&c->tx.ctl->producer_waiting, 0, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+    return 1;
+}
+
+// resets the eventfd counter after a wakeup
+static inline void shm_drain_wakeups(shm_conn_t* c) {
+    uint64_t v;
+    while (read(c->my_efd, &v, sizeof(v)) == sizeof(v)) {
+    }
+}
+
+// ---- setup -----------------------------------------------------------------------------------
+
+static inline int shm_map(shm_conn_t* c, int memfd, size_t cap, int is_server) {
+    shm_ring_t c2s, s2c;
+
+    c->ctl = mmap(NULL, SHM_PAGE, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (c->ctl == MAP_FAILED) {
+        return -1;
+    }
+    memset(&c2s, 0, sizeof(c2s));
+    memset(&s2c, 0, sizeof(s2c));
+    c2s.ctl  = &c->ctl->c2s;
+    c2s.cap  = cap;
+    c2s.data = rb_map_double(memfd, SHM_PAGE, cap);
+    s2c.ctl  = &c->ctl->s2c;
+    s2c.cap  = cap;
+    s2c.data = rb_map_double(memfd, (off_t)(SHM_PAGE + cap), cap);
+    if (c2s.data == MAP_FAILED || s2c.data == MAP_FAILED) {
+        // c->rx and c->tx are not set yet, shm_destroy would not find the one that worked
+        if (c2s.data != MAP_FAILED) {
+            munmap(c2s.data, 2 * cap);
+        }
+        if (s2c.data != MAP_FAILED) {
+            munmap(s2c.data, 2 * cap);
+        }
+        munmap(c->ctl, SHM_PAGE);
+        c->ctl = NULL;
+        return -1;
+    }
+    c->rx = is_server ? c2s : s2c;
+    c->tx = is_server ? s2c : c2s;
+    return 0;
+}
+
+static inline void shm_destroy(shm_conn_t* c) {
+    if (c->rx.data != NULL && c->rx.data != MAP_FAILED) {
+        munmap(c->rx.data, 2 * c->rx.cap);
+    }
+    if (c->tx.data != NULL && c->tx.data != MAP_FAILED) {
+        munmap(c->tx.data, 2 * c->tx.cap);
+    }
+    if (c->ctl != NULL && c->ctl != MAP_FAILED) {
+        munmap(c->ctl, SHM_PAGE);
+    }
+    close(c->my_efd);
+    close(c->peer_efd);
+    close(c->sock);
+    memset(c, 0, sizeof(*c));
+}
+
+static inline int shm_listen(const char* path) {
+    struct sockaddr_un addr = { 0 };
+    int fd                  = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd == -1) {
+        perror("socket AF_UNIX");
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        perror("bind/listen AF_UNIX");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Server side of the negotiation: accepts one Unix socket client, builds the shared region
+// and hands over [memfd, server eventfd, client eventfd] plus the ring size.
+// Returns 0, -1 when accept() itself failed (errno set), -2 when the handshake failed.
+static inline int shm_accept(int unix_fd, shm_conn_t* c) {
+    uint32_t cap = SHM_RING_SIZE;
+    int fds[3]   = { -1, -1, -1 };
+    char cbuf[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { &cap, sizeof(cap) };
+    struct msghdr msg = { 0 };
+
+    memset(c, 0, sizeof(*c));
+    c->my_efd = c->peer_efd = -1;
+    c->sock                 = accept4(unix_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (c->sock == -1) {
+        return -1;
+    }
+
+    fds[0] = memfd_create("shm-transport", MFD_CLOEXEC);
+    fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds[0] == -1 || fds[1] == -1 || fds[2] == -1 ||
+        ftruncate(fds[0], (off_t)(SHM_PAGE + 2 * (size_t)cap)) == -1 ||
+        shm_map(c, fds[0], cap, 1) == -1) {
+        goto fail;
+    }
+    c->my_efd   = fds[1];
+    c->peer_efd = fds[2];
+
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level     = SOL_SOCKET;
+    cm->cmsg_type      = SCM_RIGHTS;
+    cm->cmsg_len       = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    if (sendmsg(c->sock, &msg, MSG_NOSIGNAL) != sizeof(cap)) {
+        goto fail;
+    }
+    // the server starts out idle, the client's first frame has to wake it
+    __atomic_store_n(&c->rx.ctl->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+    close(fds[0]);
+    return 0;
+
+fail:
+    if (fds[0] != -1) {
+        close(fds[0]);
+    }
+    if (c->my_efd == -1) {
+        if (fds[1] != -1) {
+            close(fds[1]);
+        }
+        if (fds[2] != -1) {
+            close(fds[2]);
+        }
+    }
+    shm_destroy(c);
+    return -2;
+}
+
+// Client side: connects to the server's Unix socket and maps what it sends back.
+static inline int shm_connect(const char* path, shm_conn_t* c) {
+    struct sockaddr_un addr = { 0 };
+    uint32_t cap            = 0;
+    int fds[3];
+    char cbuf[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { &cap, sizeof(cap) };
+    struct msghdr msg = { 0 };
+
+    memset(c, 0, sizeof(*c));
+    c->my_efd = c->peer_efd = -1;
+    c->sock                 = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    addr.sun_family         = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (c->sock == -1 || connect(c->sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("connect AF_UNIX");
+        shm_destroy(c);
+        return -1;
+    }
+
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    struct cmsghdr* cm;
+    if (recvmsg(c->sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(cap) ||
+        (cm = CMSG_FIRSTHDR(&msg)) == NULL || cm->cmsg_type != SCM_RIGHTS ||
+        cm->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        fprintf(stderr, "shm handshake failed\n");
+        shm_destroy(c);
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+    c->my_efd   = fds[2];
+    c->peer_efd = fds[1];
+    int rc      = shm_map(c, fds[0], cap, 0);
+    close(fds[0]);
+    if (rc == -1) {
+        shm_destroy(c);
+        return -1;
+    }
+    return 0;
+}
+
+#endif
+#endif
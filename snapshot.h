@@ -0,0 +1,294 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+// Copy-on-write snapshots of the store (kv.h) for reactor.c's -J mode.
+//
+// snap_start forks. The child gets a frozen copy of the store for free (parent and child share
+// every page until the parent writes to one, and only that page is copied). It writes the
+// copy to a temporary file, syncs it and renames it over the snapshot while the parent goes
+// on serving; the loop only pauses for the fork itself, which copies page tables. Right
+// before the fork the log is rotated: the old file, entirely covered by the snapshot,
+// becomes <log>.prev and is deleted once the child has succeeded. That is what keeps the
+// log short.
+//
+// Startup maps the snapshot and points the table straight at the records in it (nothing is
+// copied or hashed), then replays <log>.prev if it is still there and the log. Replaying a
+// record the snapshot already holds is harmless: SET and DEL overwrite, so a key ends up as
+// the last record about it says, whichever earlier point replay starts from.
+//
+// File: snap_hdr_t, then per record its key hash and the kv_rec_t image, padded to 8 bytes.
+// Host byte order, which the header's `order` field checks.
+//
+// Included by the program after wal.h.
+
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <stddef.h>
+
+#define SNAP_MAGIC "KVSNAP01"
+#define SNAP_ORDER 0x01020304u
+#define SNAP_BUF (1024 * 1024)
+#define SNAP_POLL_MS 100   // how often the loop checks on a running child
+#define SNAP_RETRY_SECS 10 // an automatic snapshot that failed is not retried sooner
+
+typedef struct {
+    char magic[8];
+    uint32_t order;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t data_len; // bytes of records after the header
+} snap_hdr_t;
+
+typedef struct {
+    char path[PATH_MAX];
+    char log_path[PATH_MAX];
+    char prev_path[PATH_MAX];
+    pid_t pid;         // child writing a snapshot, 0 when none is running
+    int prev;          // prev_path exists: written by a rotation, not yet covered by a snapshot
+    off_t auto_bytes;  // start one once the log has grown past this, 0 for never
+    uint64_t failed_ns; // clk_now() of the last failure, 0 for none
+    uint64_t started_ns;
+} snap_t;
+
+static inline size_t snap_rec_size(const kv_rec_t* rec) {
+    size_t n = sizeof(uint64_t) + offsetof(kv_rec_t, data) + rec->klen + rec->vlen;
+    return (n + 7) & ~(size_t)7;
+}
+
+static inline int snap_out(int fd, char* buf, size_t* fill, const void* p, size_t n) {
+    if (*fill + n > SNAP_BUF) {
+        if (write(fd, buf, *fill) != (ssize_t)*fill) {
+            return -1;
+        }
+        *fill = 0;
+    }
+    if (n > SNAP_BUF) {
+        return write(fd, p, n) == (ssize_t)n ? 0 : -1;
+    }
+    memcpy(buf + *fill, p, n);
+    *fill += n;
+    return 0;
+}
+
+// For a child of the loop: closes every inherited descriptor but keep (-1 for none). A
+// client socket the parent closes would otherwise stay open, unanswered, until the child exits.
+static inline void snap_close_fds(int keep, int fd_cap) {
+#ifdef SYS_close_range
+    if (keep > 3) {
+        syscall(SYS_close_range, 3, keep - 1, 0);
+    }
+    if (syscall(SYS_close_range, keep >= 3 ? keep + 1 : 3, ~0u, 0) == 0) {
+        return;
+    }
+#endif
+    for (int fd = 3; fd < fd_cap; fd++) {
+        if (fd != keep) {
+            close(fd);
+        }
+    }
+}
+
+// Runs in the child. Returns -1 on error, the old snapshot is then left alone.
+static inline int snap_write(const kv_t* kv, const char* path) {
+    char tmp[PATH_MAX + 8];
+    snap_hdr_t hdr = { SNAP_MAGIC, SNAP_ORDER, 0, 0, 0 };
+    size_t fill    = 0;
+    static char pad[8];
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd    = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    char* buf = malloc(SNAP_BUF);
+    if (fd == -1 || buf == NULL || snap_out(fd, buf, &fill, &hdr, sizeof(hdr)) == -1) {
+        goto fail;
+    }
+    for (size_t i = 0; i < kv->cap; i++) {
+        const kv_rec_t* rec = kv->slots[i].rec;
+        if (rec == NULL || rec == KV_TOMBSTONE) {
+            continue;
+        }
+        size_t n = offsetof(kv_rec_t, data) + rec->klen + rec->vlen;
+        if (snap_out(fd, buf, &fill, &kv->slots[i].hash, sizeof(uint64_t)) == -1 ||
+            snap_out(fd, buf, &fill, rec, n) == -1 || snap_out(fd, buf, &fill, pad, -n & 7) == -1) {
+            goto fail;
+        }
+        hdr.count++;
+        hdr.data_len += snap_rec_size(rec);
+    }
+    if (write(fd, buf, fill) != (ssize_t)fill || pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        fsync(fd) == -1 || rename(tmp, path) == -1 || wal_sync_dir(path) == -1) {
+        goto fail;
+    }
+    close(fd);
+    free(buf);
+    return 0;
+
+fail:
+    perror("snapshot");
+    if (fd != -1) {
+        close(fd);
+        unlink(tmp);
+    }
+    free(buf);
+    return -1;
+}
+
+// Maps the snapshot at path into the (empty) store. A missing snapshot is not an error.
+static inline int snap_load(kv_t* kv, const char* path) {
+    snap_hdr_t hdr;
+    struct stat st;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(hdr) || read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        memcmp(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic)) != 0 || hdr.order != SNAP_ORDER ||
+        hdr.data_len != (uint64_t)st.st_size - sizeof(hdr)) {
+        fprintf(stderr, "%s is not a snapshot this build can read\n", path);
+        close(fd);
+        return -1;
+    }
+    char* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap snapshot");
+        return -1;
+    }
+    // sized up front, so loading never rehashes
+    if (kv_init(kv, (size_t)hdr.count * 2) == -1) {
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+    kv->map     = map;
+    kv->map_len = (size_t)st.st_size;
+
+    const char* p   = map + sizeof(hdr);
+    const char* end = map + st.st_size;
+    for (uint64_t i = 0; i < hdr.count; i++) {
+        uint64_t h;
+        kv_rec_t* rec = (kv_rec_t*)(p + sizeof(h));
+        if (p + sizeof(h) + sizeof(kv_rec_t) > end || p + snap_rec_size(rec) > end) {
+            fprintf(stderr, "%s: truncated at record %llu\n", path, (unsigned long long)i);
+            return -1;
+        }
+        memcpy(&h, p, sizeof(h));
+        if (kv_put(kv, rec, h) == -1) {
+            return -1;
+        }
+        p += snap_rec_size(rec);
+    }
+    printf("snapshot %s: %zu keys mapped\n", path, kv->count);
+    return 0;
+}
+
+// Recovers the store: snapshot, then the rotated log a snapshot did not finish, then the log.
+static inline int snap_open_store(snap_t* s, kv_t* kv, wal_t* w, const char* log_path, long window_us) {
+    memset(s, 0, sizeof(*s));
+    snprintf(s->path, sizeof(s->path), "%s.snap", log_path);
+    snprintf(s->log_path, sizeof(s->log_path), "%s", log_path);
+    snprintf(s->prev_path, sizeof(s->prev_path), "%s.prev", log_path);
+
+    memset(kv, 0, sizeof(*kv));
+    if (snap_load(kv, s->path) == -1) {
+        return -1;
+    }
+    if (kv->slots == NULL && kv_init(kv, 0) == -1) {
+        return -1;
+    }
+    int fd = open(s->prev_path, O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        off_t good;
+        int rc = wal_replay(fd, s->prev_path, kv, &good);
+        close(fd);
+        if (rc == -1) {
+            return -1;
+        }
+        s->prev = 1;
+    }
+    return wal_open(w, log_path, kv, window_us);
+}
+
+static inline void snap_reaped(snap_t* s, reactor_t* r, int status) {
+    double ms = (double)(clk_now() - s->started_ns) / 1e6;
+
+    s->pid = 0;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        // the log and <log>.prev still hold everything, the next snapshot covers both
+        fprintf(stderr, "snapshot failed after %.0f ms, the log is kept\n", ms);
+        s->failed_ns = clk_now();
+        return;
+    }
+    if (s->prev && (unlink(s->prev_path) == -1 || wal_sync_dir(s->prev_path) == -1)) {
+        perror("remove rotated log");
+    } else {
+        s->prev = 0;
+    }
+    if (r->verbose) {
+        printf("snapshot written in %.0f ms\n", ms);
+    }
+}
+
+// Rotates the log and forks the child. Returns 1 when started, 0 if one is still running,
+// -1 on error.
+static inline int snap_start(snap_t* s, kv_t* kv, wal_t* w, reactor_t* r) {
+    if (s->pid != 0) {
+        return 0;
+    }
+    // a <log>.prev left by a failed snapshot is already covered by the one starting now, the
+    // log then stays as it is and is only cleared by the next one
+    if (!s->prev) {
+        if (wal_rotate(w, r, s->log_path, s->prev_path) == -1) {
+            return -1;
+        }
+        s->prev = 1;
+    } else if (wal_pending(w)) {
+        wal_commit(w, r);
+    }
+
+    // read, not the loop's wakeup time: the fork is timed within this iteration
+    s->started_ns = clk_read();
+    pid_t pid     = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        snap_close_fds(-1, r->fd_cap);
+        _exit(snap_write(kv, s->path) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    s->pid = pid;
+    r->stats.snapshots++;
+    r->stats.snapshot_fork_us += (clk_read() - s->started_ns) / 1000;
+    return 1;
+}
+
+// For reactor_on_iteration: reaps a finished child, starts an automatic snapshot when the log
+// has grown past auto_bytes, and returns how long the loop may sleep.
+static inline int snap_on_iteration(snap_t* s, kv_t* kv, wal_t* w, reactor_t* r) {
+    int status;
+
+    if (s->pid != 0) {
+        pid_t pid = waitpid(s->pid, &status, WNOHANG);
+        if (pid == 0) {
+            return SNAP_POLL_MS;
+        }
+        snap_reaped(s, r, pid == s->pid ? status : -1);
+        return -1;
+    }
+    if (s->auto_bytes > 0 && w->end >= s->auto_bytes &&
+        (s->failed_ns == 0 || clk_now() - s->failed_ns >= SNAP_RETRY_SECS * 1000000000ull)) {
+        return snap_start(s, kv, w, r) == 1 ? SNAP_POLL_MS : -1;
+    }
+    return -1;
+}
+
+// Waits for a running child, at shutdown.
+static inline void snap_finish(snap_t* s, reactor_t* r) {
+    int status;
+
+    if (s->pid != 0) {
+        snap_reaped(s, r, waitpid(s->pid, &status, 0) == s->pid ? status : -1);
+    }
+}
+
+#endif
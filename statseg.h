@@ -0,0 +1,183 @@
+#ifndef STATSEG_H
+#define STATSEG_H
+
+// Stats segment (reactor.c's -m path): the server's counters and a summary of every
+// connection, published into a memory-mapped file that tools read on their own. statstop.c
+// is one. Nothing is ever asked of the server, so watching it never adds a syscall, a wakeup
+// or a lock to its loops.
+//
+// Each record has one writer, the loop that owns it, and a sequence number: odd while the
+// writer is in the middle of an update, even otherwise. A reader copies the record and keeps
+// the copy if the number was even and unchanged across the copy, else tries again. The writer
+// never waits on a reader.
+//
+// Layout: statseg_hdr_t with the counter names, then per loop a statseg_loop_t followed by
+// one statseg_conn_t per slot. Times are CLOCK_MONOTONIC nanoseconds, host byte order.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define STATSEG_MAGIC "STATSG01"
+#define STATSEG_MAX_COUNTERS 64
+#define STATSEG_NAME_LEN 32
+#define STATSEG_READ_TRIES 1000000
+
+typedef struct {
+    char magic[8];
+    uint32_t loops;
+    uint32_t slots; // per loop
+    uint32_t counters;
+    uint32_t pid;
+    uint64_t start_ns;
+    char names[STATSEG_MAX_COUNTERS][STATSEG_NAME_LEN];
+} statseg_hdr_t;
+
+typedef struct {
+    uint64_t seq;
+    uint64_t now_ns;     // when the loop last woke up
+    uint64_t iterations; // wakeups of the loop
+    uint64_t counters[STATSEG_MAX_COUNTERS];
+} statseg_loop_t;
+
+enum { SEG_FREE, SEG_TCP, SEG_HANDSHAKE, SEG_SHM, SEG_PROXY };
+
+typedef struct {
+    uint64_t seq;
+    int32_t fd; // -1 while the slot is free
+    uint32_t kind;
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint64_t opened_ns;
+    uint64_t last_ns; // last read or write
+} statseg_conn_t;
+
+typedef struct {
+    statseg_hdr_t* hdr;
+    size_t map_len;
+} statseg_t;
+
+static inline uint64_t statseg_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline size_t statseg_loop_size(uint32_t slots) {
+    return sizeof(statseg_loop_t) + slots * sizeof(statseg_conn_t);
+}
+
+static inline statseg_loop_t* statseg_loop(const statseg_t* s, int loop) {
+    return (statseg_loop_t*)((char*)s->hdr + sizeof(statseg_hdr_t) + (size_t)loop * statseg_loop_size(s->hdr->slots));
+}
+
+static inline statseg_conn_t* statseg_conns(statseg_loop_t* l) {
+    return (statseg_conn_t*)(l + 1);
+}
+
+// ---- writing, one writer per record --------------------------------------------------------
+
+static inline void statseg_begin(uint64_t* seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void statseg_end(uint64_t* seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline int statseg_create(statseg_t* s, const char* path, int loops, int slots, const char* const* names,
+    int n_names) {
+    s->map_len = sizeof(statseg_hdr_t) + (size_t)loops * statseg_loop_size((uint32_t)slots);
+    // a fresh file, so a viewer still holding the old one's mapping never sees this server
+    unlink(path);
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1 || ftruncate(fd, (off_t)s->map_len) == -1) {
+        perror("stats segment");
+        return -1;
+    }
+    void* map = mmap(NULL, s->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap stats segment");
+        return -1;
+    }
+    s->hdr           = map;
+    s->hdr->loops    = (uint32_t)loops;
+    s->hdr->slots    = (uint32_t)slots;
+    s->hdr->counters = (uint32_t)(n_names < STATSEG_MAX_COUNTERS ? n_names : STATSEG_MAX_COUNTERS);
+    s->hdr->pid      = (uint32_t)getpid();
+    s->hdr->start_ns = statseg_now_ns();
+    for (uint32_t i = 0; i < s->hdr->counters; i++) {
+        snprintf(s->hdr->names[i], STATSEG_NAME_LEN, "%s", names[i]);
+    }
+    for (int l = 0; l < loops; l++) {
+        statseg_conn_t* c = statseg_conns(statseg_loop(s, l));
+        for (int i = 0; i < slots; i++) {
+            c[i].fd = -1;
+        }
+    }
+    // last, a reader that sees the magic sees a complete header
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(s->hdr->magic, STATSEG_MAGIC, sizeof(s->hdr->magic));
+    return 0;
+}
+
+// ---- reading -------------------------------------------------------------------------------
+
+static inline int statseg_open(statseg_t* s, const char* path) {
+    struct stat st;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror(path);
+        return -1;
+    }
+    void* map = (size_t)st.st_size >= sizeof(statseg_hdr_t) ? mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0)
+                                                             : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "%s is not a stats segment\n", path);
+        return -1;
+    }
+    s->hdr     = map;
+    s->map_len = (size_t)st.st_size;
+    if (memcmp(s->hdr->magic, STATSEG_MAGIC, sizeof(s->hdr->magic)) != 0 ||
+        s->map_len < sizeof(statseg_hdr_t) + s->hdr->loops * statseg_loop_size(s->hdr->slots)) {
+        fprintf(stderr, "%s is not a stats segment this build can read\n", path);
+        munmap(map, s->map_len);
+        return -1;
+    }
+    return 0;
+}
+
+// Copies the record at src, n bytes starting with its sequence number, once it is not being
+// written. Returns -1 if it never settles, as when the server died in the middle of an update.
+static inline int statseg_read(const void* src, void* dst, size_t n) {
+    const uint64_t* seq = src;
+
+    for (int tries = 0; tries < STATSEG_READ_TRIES; tries++) {
+        uint64_t before = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(dst, src, n);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(seq, __ATOMIC_RELAXED) == before) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static inline void statseg_close(statseg_t* s) {
+    munmap(s->hdr, s->map_len);
+}
+
+#endif
@@ -0,0 +1,226 @@
+// top for the reactor: reads the stats segment a server started with -m publishes (statseg.h)
+// and redraws rates, per-loop activity and the busiest connections every -i seconds. The
+// server never knows it is being watched.
+//
+//     cc -O2 statstop.c -o statstop
+//     ./reactor -m /dev/shm/reactor.stats &
+//     ./statstop -f /dev/shm/reactor.stats            # -1 prints one screen and exits
+//
+// The first screen's rates are averages since the server started, later ones cover the
+// last interval.
+
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+#include "statseg.h"
+
+typedef struct {
+    const char* path;
+    double interval;
+    int top;
+    int once;
+} options_t;
+
+typedef struct {
+    int loop;
+    int slot;
+    statseg_conn_t now;
+    double rate; // bytes/s both ways over the interval
+} row_t;
+
+static const char* kind_names[] = { "-", "tcp", "tls hs", "shm", "proxy" };
+
+static int counter_index(const statseg_hdr_t* h, const char* name) {
+    for (uint32_t i = 0; i < h->counters; i++) {
+        if (strcmp(h->names[i], name) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static double counter_rate(const statseg_hdr_t* h, const uint64_t* now, const uint64_t* prev, const char* name,
+    double secs) {
+    int i = counter_index(h, name);
+    return i == -1 ? 0 : (double)(now[i] - prev[i]) / secs;
+}
+
+static int by_rate(const void* a, const void* b) {
+    const row_t* x = a;
+    const row_t* y = b;
+    if (x->rate != y->rate) {
+        return x->rate < y->rate ? 1 : -1;
+    }
+    return x->now.last_ns < y->now.last_ns ? 1 : -1;
+}
+
+static void human(double v, char* out, size_t cap) {
+    const char* unit = "";
+    if (v >= 1e9) {
+        v /= 1e9;
+        unit = "G";
+    } else if (v >= 1e6) {
+        v /= 1e6;
+        unit = "M";
+    } else if (v >= 1e3) {
+        v /= 1e3;
+        unit = "k";
+    }
+    snprintf(out, cap, "%.1f%s", v, unit);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s -f stats_path [-i seconds] [-n connections] [-1]\n", prog);
+}
+
+int main(int argc, char** argv) {
+    options_t o = { NULL, 1.0, 10, 0 };
+    statseg_t seg;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:i:n:1h")) != -1) {
+        switch (opt) {
+        case 'f':
+            o.path = optarg;
+            break;
+        case 'i':
+            o.interval = atof(optarg);
+            break;
+        case 'n':
+            o.top = atoi(optarg);
+            break;
+        case '1':
+            o.once = 1;
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (o.path == NULL || o.interval <= 0) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (statseg_open(&seg, o.path) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    const statseg_hdr_t* h = seg.hdr;
+    size_t n_slots         = (size_t)h->loops * h->slots;
+    statseg_loop_t* loops  = calloc(h->loops, sizeof(statseg_loop_t));
+    statseg_loop_t* prev   = calloc(h->loops, sizeof(statseg_loop_t));
+    statseg_conn_t* conns  = calloc(n_slots, sizeof(statseg_conn_t)); // as of the last screen
+    row_t* rows            = calloc(n_slots, sizeof(row_t));
+    uint64_t total[STATSEG_MAX_COUNTERS], total_prev[STATSEG_MAX_COUNTERS] = { 0 };
+    uint64_t shown_ns      = h->start_ns;
+    uint64_t iters_prev    = 0;
+    if (loops == NULL || prev == NULL || conns == NULL || rows == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (;;) {
+        uint64_t now = statseg_now_ns();
+        double secs  = (double)(now - shown_ns) / 1e9;
+        uint64_t iters = 0;
+        int n_rows     = 0;
+        int open       = 0;
+        char a[16], b[16], c[16];
+
+        memset(total, 0, sizeof(total));
+        for (uint32_t l = 0; l < h->loops; l++) {
+            if (statseg_read(statseg_loop(&seg, (int)l), &loops[l], sizeof(statseg_loop_t)) == -1) {
+                loops[l] = prev[l]; // the server died mid-update, keep what it last finished
+            }
+            for (uint32_t i = 0; i < h->counters; i++) {
+                total[i] += loops[l].counters[i];
+            }
+            iters += loops[l].iterations;
+
+            statseg_conn_t* src = statseg_conns(statseg_loop(&seg, (int)l));
+            for (uint32_t s = 0; s < h->slots; s++) {
+                statseg_conn_t cur;
+                statseg_conn_t* last = &conns[l * h->slots + s];
+                if (statseg_read(&src[s], &cur, sizeof(cur)) == -1 || cur.fd == -1) {
+                    last->fd = -1;
+                    continue;
+                }
+                // a connection that opened since the last screen counts from zero
+                int same        = last->fd == cur.fd && last->opened_ns == cur.opened_ns;
+                uint64_t before = same ? last->rx_bytes + last->tx_bytes : 0;
+                row_t* row      = &rows[n_rows++];
+                row->loop       = (int)l;
+                row->slot       = (int)s;
+                row->now        = cur;
+                row->rate       = (double)(cur.rx_bytes + cur.tx_bytes - before) / secs;
+                *last           = cur;
+                open++;
+            }
+        }
+        qsort(rows, (size_t)n_rows, sizeof(row_t), by_rate);
+
+        int alive = kill((pid_t)h->pid, 0) == 0 || errno == EPERM;
+        if (!o.once) {
+            printf("\033[H\033[2J");
+        }
+        printf("pid %u%s, up %.0f s, %u loop%s, %d connection%s open\n",
+            h->pid,
+            alive ? "" : " (exited)",
+            (double)(now - h->start_ns) / 1e9,
+            h->loops,
+            h->loops > 1 ? "s" : "",
+            open,
+            open == 1 ? "" : "s");
+        human(counter_rate(h, total, total_prev, "frames", secs), a, sizeof(a));
+        human(counter_rate(h, total, total_prev, "rx_bytes", secs), b, sizeof(b));
+        human(counter_rate(h, total, total_prev, "tx_bytes", secs), c, sizeof(c));
+        printf("frames/s %s   read B/s %s   written B/s %s\n", a, b, c);
+        human(counter_rate(h, total, total_prev, "accepts", secs), a, sizeof(a));
+        human(counter_rate(h, total, total_prev, "tx_syscalls", secs), b, sizeof(b));
+        human((double)(iters - iters_prev) / secs, c, sizeof(c));
+        printf("accepts/s %s   writev/s %s   wakeups/s %s\n\n", a, b, c);
+
+        if (h->loops > 1) {
+            printf("%5s %12s %12s %14s\n", "loop", "wakeups/s", "frames/s", "last wakeup");
+            int fi = counter_index(h, "frames");
+            for (uint32_t l = 0; l < h->loops; l++) {
+                printf("%5u %12.0f %12.0f %11.1f s\n",
+                    l,
+                    (double)(loops[l].iterations - prev[l].iterations) / secs,
+                    fi == -1 ? 0 : (double)(loops[l].counters[fi] - prev[l].counters[fi]) / secs,
+                    loops[l].now_ns != 0 ? (double)(now - loops[l].now_ns) / 1e9 : 0.0);
+            }
+            printf("\n");
+        }
+
+        printf("%5s %5s %7s %10s %10s %10s %9s %9s\n", "loop", "fd", "kind", "read", "written", "B/s", "idle s",
+            "age s");
+        for (int i = 0; i < n_rows && i < o.top; i++) {
+            const statseg_conn_t* k = &rows[i].now;
+            human((double)k->rx_bytes, a, sizeof(a));
+            human((double)k->tx_bytes, b, sizeof(b));
+            human(rows[i].rate, c, sizeof(c));
+            printf("%5d %5d %7s %10s %10s %10s %9.1f %9.1f\n",
+                rows[i].loop,
+                k->fd,
+                k->kind < sizeof(kind_names) / sizeof(kind_names[0]) ? kind_names[k->kind] : "?",
+                a,
+                b,
+                c,
+                (double)(now - k->last_ns) / 1e9,
+                (double)(now - k->opened_ns) / 1e9);
+        }
+        fflush(stdout);
+
+        if (o.once || !alive) {
+            break;
+        }
+        memcpy(prev, loops, h->loops * sizeof(statseg_loop_t));
+        memcpy(total_prev, total, sizeof(total));
+        iters_prev = iters;
+        shown_ns   = now;
+        usleep((useconds_t)(o.interval * 1e6));
+    }
+    statseg_close(&seg);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,47 @@
+#ifndef TEST_HOOKS_H
+#define TEST_HOOKS_H
+
+// reactor.h's hooks for tests that drive a reactor by hand: frames and closes are counted,
+// large payloads go to the buffer pool, nothing else happens.
+// A test that needs real hooks (l7.h's, say) defines its own instead of including this.
+
+#include "reactor.h"
+
+static int frames_seen = 0;
+static int closes_seen = 0;
+
+static int reactor_dispatch(reactor_t* r, int slot, const proto_frame_t* frame) {
+    (void)r;
+    (void)slot;
+    (void)frame;
+    frames_seen++;
+    return 0;
+}
+
+static char* reactor_payload_buffer(reactor_t* r, int slot, proto_type_e type, size_t len) {
+    (void)r;
+    (void)slot;
+    (void)type;
+    (void)len;
+    return NULL;
+}
+
+static void reactor_on_close(reactor_t* r, int slot) {
+    (void)r;
+    (void)slot;
+    closes_seen++;
+}
+
+__attribute__((unused)) static int reactor_on_iteration(reactor_t* r) {
+    (void)r;
+    return -1;
+}
+
+static int reactor_on_chunk(reactor_t* r, int slot, const proto_chunk_t* chunk) {
+    (void)r;
+    (void)slot;
+    (void)chunk;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef TEST_H
+#define TEST_H
+
+// What the unit tests share: CHECK records a failure and carries on, RUN prints one line per
+// test, test_done gives main its exit status. Plus a scratch directory, an open fd count for
+// leak checks, and an address space limit to make allocations fail on purpose.
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+static int test_failures = 0;
+
+#define CHECK(cond)                                                                    \
+    do {                                                                               \
+        if (!(cond)) {                                                                 \
+            test_failures++;                                                           \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);   \
+        }                                                                              \
+    } while (0)
+
+#define RUN(fn)                                                                        \
+    do {                                                                               \
+        int before_ = test_failures;                                                   \
+        fn();                                                                          \
+        printf("  %-44s %s\n", #fn, test_failures == before_ ? "ok" : "FAILED");       \
+    } while (0)
+
+static inline int test_done(const char* name) {
+    printf("%s: %s\n", name, test_failures == 0 ? "passed" : "FAILED");
+    return test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// A fresh directory under /tmp, for files a test creates; path holds at least 64 bytes.
+static inline void test_dir(char* path) {
+    strcpy(path, "/tmp/reactor-test-XXXXXX");
+    if (mkdtemp(path) == NULL) {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static inline int test_open_fds() {
+    int n    = 0;
+    DIR* dir = opendir("/proc/self/fd");
+
+    if (dir == NULL) {
+        return -1;
+    }
+    while (readdir(dir) != NULL) {
+        n++;
+    }
+    closedir(dir);
+    return n;
+}
+
+// Caps the address space at what is mapped now plus headroom, so the next large allocation
+// fails; test_unlimit_memory lifts the cap again.
+static struct rlimit test_saved_as;
+
+static inline void test_limit_memory(size_t headroom) {
+    unsigned long pages = 0;
+    FILE* f             = fopen("/proc/self/statm", "r");
+
+    if (f == NULL || fscanf(f, "%lu", &pages) != 1) {
+        perror("/proc/self/statm");
+        exit(EXIT_FAILURE);
+    }
+    fclose(f);
+    getrlimit(RLIMIT_AS, &test_saved_as);
+    struct rlimit rl = test_saved_as;
+    rl.rlim_cur      = pages * (size_t)sysconf(_SC_PAGESIZE) + headroom;
+    setrlimit(RLIMIT_AS, &rl);
+}
+
+static inline void test_unlimit_memory() {
+    setrlimit(RLIMIT_AS, &test_saved_as);
+}
+
+#endif
@@ -0,0 +1,112 @@
+// The readiness backends, outside a loop.
+
+#include "test.h"
+#include "hooks.h"
+#include "backend_select.h"
+#include "backend_poll.h"
+#include "backend_epoll.h"
+#include "backend_uring.h"
+
+// 3d0041a: an fd paused (no interest) while a lower fd is deleted must be watched again once
+// it resumes, even though the delete shrank maxfd below it
+static void test_select_resume_above_maxfd() {
+    select_be_t b;
+    ev_t out[8];
+    int lo[2], hi[2];
+
+    CHECK(pipe(lo) == 0 && pipe(hi) == 0);
+    CHECK(select_be_init(&b, 0) == 0);
+    CHECK(select_be_add(&b, lo[0], EV_READ) == 0);
+    CHECK(select_be_add(&b, hi[0], EV_READ) == 0);
+    CHECK(select_be_mod(&b, hi[0], 0) == 0);
+    select_be_del(&b, lo[0]);
+    CHECK(b.maxfd < hi[0]);
+    CHECK(select_be_mod(&b, hi[0], EV_READ) == 0);
+    CHECK(b.maxfd == hi[0]);
+    CHECK(write(hi[1], "x", 1) == 1);
+    int n = select_be_wait(&b, out, 8, 0);
+    CHECK(n == 1 && out[0].fd == hi[0] && out[0].events == EV_READ);
+    select_be_destroy(&b);
+    close(lo[0]);
+    close(lo[1]);
+    close(hi[0]);
+    close(hi[1]);
+}
+
+// every backend reports a readable fd, and stops once it is deleted
+static void test_backends_report_readable() {
+    ev_t out[8];
+    int p[2];
+
+    CHECK(pipe(p) == 0);
+    CHECK(write(p[1], "x", 1) == 1);
+
+    poll_be_t pb;
+    CHECK(poll_be_init(&pb, max_fd_count()) == 0);
+    CHECK(poll_be_add(&pb, p[0], EV_READ) == 0);
+    CHECK(poll_be_wait(&pb, out, 8, 0) == 1 && out[0].fd == p[0]);
+    poll_be_del(&pb, p[0]);
+    CHECK(poll_be_wait(&pb, out, 8, 0) == 0);
+    poll_be_destroy(&pb);
+
+    epoll_be_t eb;
+    CHECK(epoll_be_init(&eb, max_fd_count()) == 0);
+    CHECK(epoll_be_add(&eb, p[0], EV_READ) == 0);
+    CHECK(epoll_be_wait(&eb, out, 8, 0) == 1 && out[0].fd == p[0]);
+    epoll_be_del(&eb, p[0]);
+    CHECK(epoll_be_wait(&eb, out, 8, 0) == 0);
+    epoll_be_destroy(&eb);
+
+    uring_be_t ub;
+    if (uring_be_init(&ub, max_fd_count()) == 0) {
+        CHECK(uring_be_add(&ub, p[0], EV_READ) == 0);
+        CHECK(uring_be_wait(&ub, out, 8, 100) == 1 && out[0].fd == p[0]);
+        uring_be_del(&ub, p[0]);
+        CHECK(uring_be_wait(&ub, out, 8, 0) == 0);
+        uring_be_destroy(&ub);
+    }
+    close(p[0]);
+    close(p[1]);
+}
+
+static int mappings() {
+    int n   = 0;
+    FILE* f = fopen("/proc/self/maps", "r");
+    int c;
+
+    while (f != NULL && (c = fgetc(f)) != EOF) {
+        n += c == '\n';
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    return n;
+}
+
+// 9020b68: an init that fails after io_uring_setup gives back the ring fd and its mappings
+static void test_uring_init_unwinds() {
+    uring_be_t b;
+
+    if (uring_be_init(&b, 16) == -1) {
+        printf("  (io_uring not available, skipped)\n");
+        return;
+    }
+    uring_be_destroy(&b);
+
+    int fds  = test_open_fds();
+    int maps = mappings();
+    test_limit_memory(4 * 1024 * 1024);
+    int rc = uring_be_init(&b, 1 << 28); // per-fd arrays of a GB and more
+    test_unlimit_memory();
+    CHECK(rc == -1);
+    CHECK(b.ring_fd == -1);
+    CHECK(test_open_fds() == fds);
+    CHECK(mappings() == maps);
+}
+
+int main() {
+    RUN(test_select_resume_above_maxfd);
+    RUN(test_backends_report_readable);
+    RUN(test_uring_init_unwinds);
+    return test_done("backends");
+}
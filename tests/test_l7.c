@@ -0,0 +1,293 @@
+// l7.h: routing, and how the upstream pool grows and loses connections.
+
+#include "test.h"
+#include "reactor.h"
+#include "l7.h"
+
+static int reactor_dispatch(reactor_t* r, int slot, const proto_frame_t* frame) {
+    return l7_dispatch(r, slot, frame);
+}
+
+static char* reactor_payload_buffer(reactor_t* r, int slot, proto_type_e type, size_t len) {
+    (void)r;
+    (void)slot;
+    (void)type;
+    (void)len;
+    return NULL;
+}
+
+static void reactor_on_close(reactor_t* r, int slot) {
+    l7_on_close(r, slot);
+}
+
+__attribute__((unused)) static int reactor_on_iteration(reactor_t* r) {
+    (void)r;
+    return -1;
+}
+
+static int reactor_on_chunk(reactor_t* r, int slot, const proto_chunk_t* chunk) {
+    (void)r;
+    (void)slot;
+    (void)chunk;
+    return -1;
+}
+
+// a listener on an ephemeral loopback port, standing in for a backend
+static int backend_listen(int* port) {
+    struct sockaddr_in addr = { 0 };
+    socklen_t len           = sizeof(addr);
+    int fd                  = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd == -1 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(fd, 64) == -1 ||
+        getsockname(fd, (struct sockaddr*)&addr, &len) == -1) {
+        perror("backend listener");
+        exit(EXIT_FAILURE);
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static void setup(reactor_t* r, l7_t* l, const char* list, int pool_size, int by_key) {
+    l7_t conf = { 0 };
+
+    memset(r, 0, sizeof(*r));
+    CHECK(init_clients(r, 64) == 0);
+    CHECK(l7_parse_backends(&conf, list) == 0);
+    conf.pool_size = pool_size;
+    conf.by_key    = by_key;
+    CHECK(l7_init(l, &conf, 64) == 0);
+    r->user = l;
+}
+
+static void teardown(reactor_t* r, l7_t* l) {
+    for (int s = 0; s < r->max_clients; s++) {
+        if (r->clients[s].fd != -1) {
+            reactor_close(r, s);
+        }
+        rb_destroy(&r->clients[s].rx);
+    }
+    while (l->free_reqs != NULL) {
+        l7_req_t* q  = l->free_reqs;
+        l->free_reqs = q->next_up;
+        free(q);
+    }
+    free(l->slots);
+    free(r->clients);
+    free(r->free_slots);
+    free(r->fd_slot);
+    free(r->dirty);
+    close(r->spare_fd);
+    bufpool_destroy(&r->pool);
+}
+
+// a client on one end of a socketpair, the other end returned in *peer
+static int adopt_client(reactor_t* r, int* peer) {
+    int sv[2];
+
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) == 0);
+    *peer = sv[1];
+    return reactor_adopt(r, sv[0]);
+}
+
+// the type of every frame the client has been sent so far, -1 after the last
+static void read_types(reactor_t* r, int slot, int peer, int* types, int max) {
+    char buf[4096];
+    proto_frame_t f;
+    size_t off = 0;
+    int k      = 0;
+    size_t len;
+
+    CHECK(reactor_flush(r, slot) == 0);
+    ssize_t n = read(peer, buf, sizeof(buf));
+    while (n > 0 && k < max - 1 && (len = proto_parse(buf + off, (size_t)n - off, &f)) > 0) {
+        types[k++] = (int)f.type;
+        off += len;
+    }
+    types[k] = -1;
+}
+
+static void test_route_by_key() {
+    static reactor_t r;
+    static l7_t l;
+    char key[16];
+    int hits[3] = { 0, 0, 0 };
+
+    setup(&r, &l, "127.0.0.1:1,127.0.0.1:2,127.0.0.1:3", 2, 1);
+    for (int i = 0; i < 300; i++) {
+        snprintf(key, sizeof(key), "key-%d", i);
+        proto_frame_t f = { PROTO_DATA, strlen(key), key };
+        int b           = l7_route(&l, &f);
+        CHECK(b >= 0 && b < 3);
+        CHECK(l7_route(&l, &f) == b);
+        if (b >= 0 && b < 3) {
+            hits[b]++;
+        }
+    }
+    CHECK(hits[0] > 30 && hits[1] > 30 && hits[2] > 30);
+
+    // a backend that is down loses its keys to the others, nobody else's keys move
+    proto_frame_t f = { PROTO_DATA, 5, "key-7" };
+    int owner       = l7_route(&l, &f);
+    l.backends[owner].down_until = l7_now() + 60;
+    int other                    = l7_route(&l, &f);
+    CHECK(other != -1 && other != owner);
+    for (int b = 0; b < 3; b++) {
+        l.backends[b].down_until = l7_now() + 60;
+    }
+    CHECK(l7_route(&l, &f) == -1);
+    teardown(&r, &l);
+}
+
+static void test_route_by_type() {
+    static reactor_t r;
+    static l7_t l;
+
+    setup(&r, &l, "127.0.0.1:1,127.0.0.1:2,127.0.0.1:3", 2, 0);
+    proto_frame_t hello = { PROTO_HELLO, 0, NULL };
+    proto_frame_t data  = { PROTO_DATA, 3, "abc" };
+    proto_frame_t get   = { PROTO_GET, 3, "abc" };
+    CHECK(l7_route(&l, &hello) == 0);
+    CHECK(l7_route(&l, &data) == 1);
+    CHECK(l7_route(&l, &get) == 0);
+    l.backends[1].down_until = l7_now() + 60;
+    CHECK(l7_route(&l, &data) == 2);
+
+    // the type is the client's, a huge one still lands on a backend
+    proto_frame_t odd = { (proto_type_e)0xfffffff0u, 0, NULL };
+    int b             = l7_route(&l, &odd);
+    CHECK(b >= 0 && b < 3);
+    teardown(&r, &l);
+}
+
+// a frame that is not a client request is answered by the proxy and reaches no backend
+static void test_refused_types_stay_local() {
+    static reactor_t r;
+    static l7_t l;
+    char list[64];
+    int types[8];
+    int port, peer;
+    int lfd = backend_listen(&port);
+
+    snprintf(list, sizeof(list), "127.0.0.1:%d", port);
+    setup(&r, &l, list, 2, 0);
+    int slot                = adopt_client(&r, &peer);
+    proto_frame_t replicate = { PROTO_REPLICATE, 0, NULL };
+    proto_frame_t snapshot  = { PROTO_SNAPSHOT, 0, NULL };
+    CHECK(l7_dispatch(&r, slot, &replicate) == 0);
+    CHECK(l7_dispatch(&r, slot, &snapshot) == 0);
+    CHECK(r.stats.l7_upstream_connects == 0 && r.stats.l7_requests == 0);
+    read_types(&r, slot, peer, types, 8);
+    CHECK(types[0] == PROTO_ADMIN && types[1] == PROTO_ADMIN && types[2] == -1);
+    teardown(&r, &l);
+    close(peer);
+    close(lfd);
+}
+
+// a refusal behind a request still in flight waits for that request's reply
+static void test_refusal_keeps_reply_order() {
+    static reactor_t r;
+    static l7_t l;
+    char list[64];
+    int types[8];
+    int port, peer;
+    int lfd = backend_listen(&port);
+
+    snprintf(list, sizeof(list), "127.0.0.1:%d", port);
+    setup(&r, &l, list, 1, 0);
+    int slot                = adopt_client(&r, &peer);
+    proto_frame_t get       = { PROTO_GET, 3, "abc" };
+    proto_frame_t replicate = { PROTO_REPLICATE, 0, NULL };
+    CHECK(l7_dispatch(&r, slot, &get) == 0);
+    CHECK(l7_dispatch(&r, slot, &replicate) == 0);
+    read_types(&r, slot, peer, types, 8);
+    CHECK(types[0] == -1);
+
+    int up              = l.backends[0].conns[0];
+    proto_frame_t reply = { PROTO_GET, 3, "xyz" };
+    CHECK(up != -1 && l7_dispatch(&r, up, &reply) == 0);
+    read_types(&r, slot, peer, types, 8);
+    CHECK(types[0] == PROTO_GET && types[1] == PROTO_ADMIN && types[2] == -1);
+    CHECK(l.slots[slot].head == NULL && l.slots[slot].inflight == 0);
+    teardown(&r, &l);
+    close(peer);
+    close(lfd);
+}
+
+// a lost upstream leaves its waiting clients to the loop to close, it does not touch their
+// fds from inside another connection's close
+static void test_lost_upstream_closes_clients_later() {
+    static reactor_t r;
+    static l7_t l;
+    char list[64];
+    int port, peer;
+    int lfd = backend_listen(&port);
+
+    snprintf(list, sizeof(list), "127.0.0.1:%d", port);
+    setup(&r, &l, list, 1, 0);
+    int slot          = adopt_client(&r, &peer);
+    int fd            = r.clients[slot].fd;
+    proto_frame_t get = { PROTO_GET, 3, "abc" };
+    CHECK(l7_dispatch(&r, slot, &get) == 0);
+    int up = l.backends[0].conns[0];
+    CHECK(up != -1);
+    while (r.n_dirty > 0) {
+        r.clients[r.dirty[--r.n_dirty]].dirty = 0;
+    }
+    reactor_close(&r, up);
+    CHECK(r.clients[slot].fd == fd && r.clients[slot].close_pending);
+    CHECK(r.n_dirty == 1 && r.dirty[0] == slot);
+    CHECK(fcntl(fd, F_GETFD) != -1);
+    teardown(&r, &l);
+    close(peer);
+    close(lfd);
+}
+
+// 873f974: every free place in the pool is filled before connections are shared, and only a
+// connection lost to an error, not one the backend closed in an orderly way, marks it down
+static void test_pool_fills_and_orderly_close() {
+    static reactor_t r;
+    static l7_t l;
+    char list[64];
+    int port;
+    int lfd = backend_listen(&port);
+
+    snprintf(list, sizeof(list), "127.0.0.1:%d", port);
+    setup(&r, &l, list, 3, 1);
+    int s[3];
+    for (int i = 0; i < 3; i++) {
+        s[i] = l7_upstream(&r, &l, 0);
+        CHECK(s[i] != -1);
+        // the first request lands on the new connection, it is no longer idle
+        l.slots[s[i]].inflight++;
+    }
+    CHECK(s[0] != s[1] && s[1] != s[2] && s[0] != s[2]);
+    CHECK(r.stats.l7_upstream_connects == 3);
+    CHECK(l7_upstream(&r, &l, 0) == s[0]); // pool full: the least loaded one is shared
+    CHECK(r.stats.l7_upstream_connects == 3);
+    for (int i = 0; i < 3; i++) {
+        l.slots[s[i]].inflight--;
+    }
+
+    r.clients[s[0]].rx_eof = 1;
+    reactor_close(&r, s[0]);
+    CHECK(l.backends[0].conns[0] == -1);
+    CHECK(l.backends[0].down_until <= l7_now());
+
+    reactor_close(&r, s[1]);
+    CHECK(l.backends[0].down_until > l7_now());
+    CHECK(r.stats.l7_upstream_lost == 2);
+    teardown(&r, &l);
+    close(lfd);
+}
+
+int main() {
+    RUN(test_route_by_key);
+    RUN(test_route_by_type);
+    RUN(test_refused_types_stay_local);
+    RUN(test_refusal_keeps_reply_order);
+    RUN(test_lost_upstream_closes_clients_later);
+    RUN(test_pool_fills_and_orderly_close);
+    return test_done("l7");
+}
@@ -0,0 +1,145 @@
+// outq.h: appends across blocks, partial consumes, and writev through a pipe.
+
+#include "test.h"
+#include "outq.h"
+#include <errno.h>
+#include <fcntl.h>
+
+static void fill(char* p, size_t n, unsigned seed) {
+    for (size_t i = 0; i < n; i++) {
+        p[i] = (char)(seed + i * 7);
+    }
+}
+
+static void test_append_spans_blocks() {
+    bufpool_t pool = { 0 };
+    outq_t q       = { 0 };
+    size_t len     = 2 * OUTQ_BLOCK_DATA + 100;
+    char* data     = malloc(len);
+
+    fill(data, len, 1);
+    CHECK(outq_append(&q, &pool, data, len) == 0);
+    CHECK(q.bytes == len);
+    CHECK(q.head != q.tail && q.head->next->next == q.tail);
+    CHECK(q.tail->end == 100);
+    CHECK(memcmp(q.tail->data, data + 2 * OUTQ_BLOCK_DATA, 100) == 0);
+    outq_clear(&q, &pool);
+    CHECK(q.bytes == 0 && q.head == NULL && q.tail == NULL);
+    free(data);
+    bufpool_destroy(&pool);
+}
+
+static void test_consume_partial() {
+    bufpool_t pool = { 0 };
+    outq_t q       = { 0 };
+    char data[300];
+
+    fill(data, sizeof(data), 2);
+    CHECK(outq_append(&q, &pool, data, 100) == 0);
+    CHECK(outq_append(&q, &pool, data + 100, 200) == 0);
+    outq_consume(&q, &pool, 150);
+    CHECK(q.bytes == 150);
+    CHECK(memcmp(q.head->data + q.head->start, data + 150, 150) == 0);
+    outq_consume(&q, &pool, 150);
+    CHECK(q.bytes == 0 && q.head == NULL && q.tail == NULL);
+    CHECK(pool.n_cached[bufpool_class(OUTQ_BLOCK_SIZE)] == 1); // the block went back to the pool
+    bufpool_destroy(&pool);
+}
+
+// a pipe that takes less than the queue holds: a short write, then the rest
+static void test_writev_short_then_rest() {
+    bufpool_t pool = { 0 };
+    outq_t q       = { 0 };
+    size_t len     = 200 * 1024;
+    char* data     = malloc(len);
+    char* got      = malloc(len);
+    size_t offered, read_back = 0;
+    int p[2];
+
+    fill(data, len, 3);
+    CHECK(pipe(p) == 0);
+    CHECK(fcntl(p[1], F_SETFL, O_NONBLOCK) == 0);
+    CHECK(outq_append(&q, &pool, data, len) == 0);
+    ssize_t n = outq_writev(&q, &pool, p[1], q.bytes, &offered);
+    CHECK(n > 0 && (size_t)n < offered);
+    CHECK(q.bytes == len - (size_t)n);
+    while (q.bytes > 0 || read_back < len) {
+        ssize_t k = read(p[0], got + read_back, len - read_back);
+        CHECK(k > 0);
+        if (k <= 0) {
+            break;
+        }
+        read_back += (size_t)k;
+        if (q.bytes > 0) {
+            n = outq_writev(&q, &pool, p[1], q.bytes, &offered);
+            CHECK(n > 0 || errno == EAGAIN);
+        }
+    }
+    CHECK(read_back == len && memcmp(got, data, len) == 0);
+    // max caps what is offered
+    CHECK(outq_append(&q, &pool, data, 1000) == 0);
+    CHECK(outq_writev(&q, &pool, p[1], 10, &offered) == 10 && offered == 10);
+    CHECK(q.bytes == 990);
+    outq_clear(&q, &pool);
+    close(p[0]);
+    close(p[1]);
+    free(data);
+    free(got);
+    bufpool_destroy(&pool);
+}
+
+// user-055: an append that runs out of blocks halfway leaves the queue as it was, both the
+// byte count and the chain
+static void test_append_all_or_nothing() {
+    bufpool_t pool = { 0 };
+    outq_t q       = { 0 };
+    size_t big     = 64 * 1024 * 1024;
+    char* data     = malloc(big);
+    char head[100];
+
+    CHECK(data != NULL);
+    fill(head, sizeof(head), 4);
+    CHECK(outq_append(&q, &pool, head, sizeof(head)) == 0);
+    test_limit_memory(1024 * 1024);
+    int rc = outq_append(&q, &pool, data, big);
+    test_unlimit_memory();
+    CHECK(rc == -1);
+    CHECK(q.bytes == sizeof(head));
+    CHECK(q.head == q.tail && q.tail->next == NULL && q.tail->end == sizeof(head));
+    CHECK(memcmp(q.head->data, head, sizeof(head)) == 0);
+    // and the queue goes on working
+    CHECK(outq_append(&q, &pool, head, sizeof(head)) == 0);
+    CHECK(q.bytes == 2 * sizeof(head) && q.tail->end == 2 * sizeof(head));
+    outq_clear(&q, &pool);
+    CHECK(q.head == NULL && q.tail == NULL);
+    free(data);
+    bufpool_destroy(&pool);
+}
+
+static void test_truncate() {
+    bufpool_t pool = { 0 };
+    outq_t q       = { 0 };
+    size_t len     = 3 * OUTQ_BLOCK_DATA;
+    char* data     = malloc(len);
+
+    fill(data, len, 5);
+    CHECK(outq_append(&q, &pool, data, len) == 0);
+    outq_consume(&q, &pool, 10);
+    outq_truncate(&q, &pool, OUTQ_BLOCK_DATA - 10 + 5); // into the second block
+    CHECK(q.bytes == OUTQ_BLOCK_DATA - 5);
+    CHECK(q.head->next == q.tail && q.tail->next == NULL && q.tail->end == 5);
+    CHECK(pool.n_cached[bufpool_class(OUTQ_BLOCK_SIZE)] == 1);
+    outq_truncate(&q, &pool, 0);
+    CHECK(q.bytes == 0 && q.head == NULL && q.tail == NULL);
+    free(data);
+    bufpool_destroy(&pool);
+}
+
+int main() {
+    RUN(test_append_spans_blocks);
+    RUN(test_consume_partial);
+    RUN(test_writev_short_then_rest);
+    RUN(test_append_all_or_nothing);
+    RUN(test_truncate);
+    return test_done("outq");
+}
@@ -0,0 +1,280 @@
+// reactor.h, driven by hand without a loop: the dirty list, direct payload reads, and the
+// cork flush policy.
+
+#include "test.h"
+#include "hooks.h"
+#include <malloc.h>
+#include <netinet/tcp.h>
+
+static void setup(reactor_t* r) {
+    memset(r, 0, sizeof(*r));
+    r->flush_policy = FLUSH_NODELAY;
+    CHECK(init_clients(r, 16) == 0);
+}
+
+static void teardown(reactor_t* r) {
+    for (int s = 0; s < r->max_clients; s++) {
+        if (r->clients[s].fd != -1) {
+            reactor_close(r, s);
+        }
+        rb_destroy(&r->clients[s].rx);
+    }
+    free(r->clients);
+    free(r->free_slots);
+    free(r->fd_slot);
+    free(r->dirty);
+    close(r->spare_fd);
+    bufpool_destroy(&r->pool);
+}
+
+// one end of a fresh socketpair in a slot of its own; the other end is returned in *peer
+static int adopt_pair(reactor_t* r, int* peer) {
+    int sv[2];
+
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) == 0);
+    *peer = sv[1];
+    return reactor_adopt(r, sv[0]);
+}
+
+// a loopback TCP connection, the accepted end in a slot of its own
+static int adopt_tcp(reactor_t* r, int* peer) {
+    struct sockaddr_in addr = { 0 };
+    socklen_t len           = sizeof(addr);
+    int lfd                 = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(lfd, 1) == 0);
+    CHECK(getsockname(lfd, (struct sockaddr*)&addr, &len) == 0);
+    *peer = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    CHECK(connect(*peer, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    int fd = accept(lfd, NULL, NULL);
+    close(lfd);
+    CHECK(fd != -1 && set_nonblocking(fd) == 0 && set_nonblocking(*peer) == 0);
+    return reactor_adopt(r, fd);
+}
+
+static size_t frame(char* p, proto_type_e type, size_t len) {
+    proto_encode_hdr(p, type, len);
+    memset(p + PROTO_HDR_SIZE, 'x', len);
+    return PROTO_HDR_SIZE + len;
+}
+
+// 2c9dd0a: a slot closed while on the dirty list leaves it, and the list stays consistent for
+// whoever reuses the slot in the same iteration
+static void test_close_takes_slot_off_dirty_list() {
+    static reactor_t r;
+    int peers[4];
+
+    setup(&r);
+    int a = adopt_pair(&r, &peers[0]);
+    int b = adopt_pair(&r, &peers[1]);
+    int c = adopt_pair(&r, &peers[2]);
+    CHECK(r.n_dirty == 3);
+    reactor_close(&r, b);
+    CHECK(r.n_dirty == 2 && r.clients[b].dirty == 0);
+    for (int i = 0; i < r.n_dirty; i++) {
+        CHECK(r.dirty[i] != b);
+        CHECK(r.clients[r.dirty[i]].dirty == i + 1);
+    }
+    int d = adopt_pair(&r, &peers[3]);
+    CHECK(d == b && r.n_dirty == 3 && r.clients[d].dirty == 3);
+    reactor_mark_dirty(&r, a);
+    CHECK(r.n_dirty == 3);
+
+    // drained the way the loop does it, every slot comes up once
+    int seen[16] = { 0 };
+    while (r.n_dirty > 0) {
+        int slot              = r.dirty[--r.n_dirty];
+        r.clients[slot].dirty = 0;
+        seen[slot]++;
+    }
+    CHECK(seen[a] == 1 && seen[c] == 1 && seen[d] == 1);
+    teardown(&r);
+    for (int i = 0; i < 4; i++) {
+        close(peers[i]);
+    }
+}
+
+// e402c9b: while a payload is read directly, every read still stays within rx_budget, and
+// what follows the payload on the wire is parsed as usual
+static void test_direct_read_within_budget() {
+    static reactor_t r;
+    static char wire[100 * 1024];
+    int peer;
+
+    setup(&r);
+    r.rx_budget = 4096;
+    int slot    = adopt_pair(&r, &peer);
+    size_t len  = frame(wire, PROTO_DATA, 64 * 1024);
+    len += frame(wire + len, PROTO_HELLO, 10);
+    CHECK(write(peer, wire, len) == (ssize_t)len);
+
+    frames_seen = 0;
+    for (int i = 0; i < 100 && frames_seen < 2; i++) {
+        unsigned long long before = r.stats.rx_bytes;
+        CHECK(reactor_on_readable(&r, slot) == 0);
+        CHECK(r.stats.rx_bytes - before <= r.rx_budget);
+    }
+    CHECK(frames_seen == 2);
+    CHECK(r.stats.rx_bytes == len);
+    CHECK(r.stats.rx_direct_bytes > 32 * 1024);
+    CHECK(r.clients[slot].direct_buf == NULL);
+    teardown(&r);
+    close(peer);
+}
+
+// e402c9b: no memory for a direct payload closes the connection with ENOMEM instead of
+// reading into NULL
+static void test_direct_without_memory() {
+    static reactor_t r;
+    static char wire[PROTO_HDR_SIZE + 512 * 1024];
+    int peer;
+
+    setup(&r);
+    int slot = adopt_pair(&r, &peer);
+    CHECK(write(peer, wire, frame(wire, PROTO_DATA, 512 * 1024) - 1000) > 0);
+
+    mallopt(M_MMAP_THRESHOLD, 128 * 1024); // a fixed threshold, so the payload is one mmap
+    test_limit_memory(64 * 1024);
+    errno   = 0;
+    int rc  = reactor_on_readable(&r, slot);
+    int err = errno;
+    test_unlimit_memory();
+    CHECK(rc == -1 && err == ENOMEM);
+    CHECK(r.clients[slot].direct_buf == NULL);
+    teardown(&r);
+    close(peer);
+}
+
+static int corked(int fd) {
+    int on        = -1;
+    socklen_t len = sizeof(on);
+    getsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, &len);
+    return on;
+}
+
+// 619a1c0: under FLUSH_CORK every flush corks its batch and uncorks once it is all out, also
+// when that takes several flushes
+static void test_cork_follows_each_batch() {
+    static reactor_t r;
+    static char reply[4 * 1024 * 1024];
+    static char sink[256 * 1024];
+    int peer;
+
+    setup(&r);
+    int slot = adopt_tcp(&r, &peer);
+    int fd   = r.clients[slot].fd;
+    reactor_set_flush_policy(&r, slot, fd, FLUSH_CORK);
+
+    for (int round = 0; round < 2; round++) {
+        CHECK(reactor_send(&r, slot, reply, 100) == 0);
+        CHECK(reactor_flush(&r, slot) == 0);
+        CHECK(reactor_tx_ready(&r.clients[slot]) == 0);
+        CHECK(!r.clients[slot].corked && corked(fd) == 0);
+        while (read(peer, sink, sizeof(sink)) > 0) {
+        }
+    }
+
+    // more than the socket takes: corked until a later flush finishes the batch
+    CHECK(reactor_send(&r, slot, reply, sizeof(reply)) == 0);
+    CHECK(reactor_flush(&r, slot) == 0);
+    CHECK(reactor_tx_ready(&r.clients[slot]) > 0);
+    CHECK(r.clients[slot].corked && corked(fd) != 0);
+    for (int i = 0; i < 100000 && reactor_tx_ready(&r.clients[slot]) > 0; i++) {
+        while (read(peer, sink, sizeof(sink)) > 0) {
+        }
+        CHECK(reactor_flush(&r, slot) == 0);
+    }
+    CHECK(reactor_tx_ready(&r.clients[slot]) == 0);
+    CHECK(!r.clients[slot].corked && corked(fd) == 0);
+
+    // 619a1c0: the tcp_info layout gives a segment count, and closing adds it up
+    CHECK(tcp_segments_out(fd) > 0);
+    reactor_close(&r, slot);
+    CHECK(r.stats.tx_segments > 0);
+    teardown(&r);
+    close(peer);
+}
+
+// user-055: a frame whose payload does not fit takes its header back out, and nothing of it
+// is counted towards tx_total or the cap
+static void test_send_frame_all_or_nothing() {
+    static reactor_t r;
+    size_t big = 64 * 1024 * 1024;
+    char* data = malloc(big);
+    int peer;
+
+    setup(&r);
+    r.tx_cap = 1024 * 1024;
+    int slot = adopt_pair(&r, &peer);
+    CHECK(data != NULL);
+    CHECK(reactor_send_frame(&r, slot, PROTO_DATA, "abc", 3) == 0);
+    size_t queued = r.clients[slot].tx.bytes;
+    CHECK(queued == PROTO_HDR_SIZE + 3 && r.tx_total == queued);
+
+    test_limit_memory(1024 * 1024);
+    int rc = reactor_send_frame(&r, slot, PROTO_DATA, data, big);
+    test_unlimit_memory();
+    CHECK(rc == -1);
+    CHECK(r.clients[slot].tx.bytes == queued && r.tx_total == queued);
+    CHECK(!r.tx_capped && r.stats.tx_frames == 1);
+
+    // what is on the wire is the one whole frame
+    char buf[64];
+    proto_frame_t f = { 0 };
+    CHECK(reactor_flush(&r, slot) == 0 && r.tx_total == 0);
+    ssize_t n = read(peer, buf, sizeof(buf));
+    CHECK(n == (ssize_t)queued && proto_parse(buf, (size_t)n, &f) == queued && f.len == 3);
+    teardown(&r);
+    close(peer);
+    free(data);
+}
+
+// user-051: out of fds, the listener's next connection is taken with the spare fd and closed
+// instead of left in the backlog, and the spare is held again afterwards
+static void test_accept_sheds_when_out_of_fds() {
+    static reactor_t r;
+    struct sockaddr_in addr = { 0 };
+    socklen_t len           = sizeof(addr);
+    struct rlimit saved, rl;
+    char c;
+
+    setup(&r);
+    CHECK(r.spare_fd != -1);
+    r.listen_fd          = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(r.listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(r.listen_fd, 4) == 0);
+    CHECK(getsockname(r.listen_fd, (struct sockaddr*)&addr, &len) == 0);
+    int cli = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    CHECK(connect(cli, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+
+    // the lowest free fd becomes the limit, so nothing new can be opened
+    int lowest = dup(0);
+    close(lowest);
+    getrlimit(RLIMIT_NOFILE, &saved);
+    rl          = saved;
+    rl.rlim_cur = (rlim_t)lowest;
+    CHECK(setrlimit(RLIMIT_NOFILE, &rl) == 0);
+    int first  = reactor_accept(&r);
+    int second = reactor_accept(&r);
+    setrlimit(RLIMIT_NOFILE, &saved);
+
+    CHECK(first == -2 && second == -1);
+    CHECK(r.spare_fd != -1 && r.stats.accepts == 0);
+    CHECK(read(cli, &c, 1) == 0); // closed by the server
+    close(cli);
+    close(r.listen_fd);
+    teardown(&r);
+}
+
+int main() {
+    RUN(test_close_takes_slot_off_dirty_list);
+    RUN(test_direct_read_within_budget);
+    RUN(test_direct_without_memory);
+    RUN(test_cork_follows_each_batch);
+    RUN(test_send_frame_all_or_nothing);
+    RUN(test_accept_sheds_when_out_of_fds);
+    return test_done("reactor");
+}
@@ -0,0 +1,59 @@
+// ringbuf.h: the double mapping, and the counters around it.
+
+#include "test.h"
+#include "ringbuf.h"
+
+static void test_rejects_bad_sizes() {
+    ringbuf_t rb;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    CHECK(rb_init(&rb, page / 2) == -1);
+    CHECK(rb_init(&rb, page * 3) == -1);
+    CHECK(rb_init(&rb, page) == 0);
+    rb_destroy(&rb);
+    CHECK(rb.base == NULL);
+}
+
+// data that wraps past the end reads back as one contiguous span
+static void test_wrap_is_contiguous() {
+    ringbuf_t rb;
+    size_t cap = 64 * 1024;
+    char msg[100];
+
+    CHECK(rb_init(&rb, cap) == 0);
+    rb_produce(&rb, cap - 40);
+    rb_consume(&rb, cap - 60); // 20 bytes left, the next write starts 40 bytes before the end
+    CHECK(rb_used(&rb) == 20);
+    CHECK(rb_space(&rb) == cap - 20);
+    for (size_t i = 0; i < sizeof(msg); i++) {
+        msg[i] = (char)i;
+    }
+    memcpy(rb_write_ptr(&rb), msg, sizeof(msg));
+    rb_produce(&rb, sizeof(msg));
+    rb_consume(&rb, 20);
+    CHECK(rb_used(&rb) == sizeof(msg));
+    CHECK(memcmp(rb_read_ptr(&rb), msg, sizeof(msg)) == 0);
+    // the tail end of the message landed at the start of the buffer as well
+    CHECK(memcmp(rb.base, msg + 40, sizeof(msg) - 40) == 0);
+    rb_destroy(&rb);
+}
+
+static void test_counters_reset_when_empty() {
+    ringbuf_t rb;
+
+    CHECK(rb_init(&rb, 64 * 1024) == 0);
+    rb_produce(&rb, 1000);
+    rb_consume(&rb, 400);
+    CHECK(rb.head == 400 && rb.tail == 1000);
+    rb_consume(&rb, 600);
+    CHECK(rb.head == 0 && rb.tail == 0);
+    CHECK(rb_space(&rb) == rb.cap);
+    rb_destroy(&rb);
+}
+
+int main() {
+    RUN(test_rejects_bad_sizes);
+    RUN(test_wrap_is_contiguous);
+    RUN(test_counters_reset_when_empty);
+    return test_done("ringbuf");
+}
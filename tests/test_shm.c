@@ -0,0 +1,170 @@
+// shm.h: both ends of one connection mapped in this process, talking through the rings, and
+// a peer that writes impossible indices to the shared page.
+
+#include "test.h"
+#include "hooks.h"
+
+#define CAP (64 * 1024)
+
+static void pair(shm_conn_t* srv, shm_conn_t* cli) {
+    int memfd = memfd_create("test-shm", MFD_CLOEXEC);
+
+    CHECK(memfd != -1 && ftruncate(memfd, SHM_PAGE + 2 * CAP) == 0);
+    memset(srv, 0, sizeof(*srv));
+    memset(cli, 0, sizeof(*cli));
+    srv->my_efd = cli->peer_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    cli->my_efd = srv->peer_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    srv->sock = cli->sock = -1;
+    CHECK(shm_map(srv, memfd, CAP, 1) == 0);
+    CHECK(shm_map(cli, memfd, CAP, 0) == 0);
+    close(memfd);
+}
+
+static void unpair(shm_conn_t* srv, shm_conn_t* cli) {
+    int efds[2] = { srv->my_efd, cli->my_efd };
+
+    // each eventfd is held by both ends here, shm_destroy would close it twice
+    srv->my_efd = srv->peer_efd = cli->my_efd = cli->peer_efd = -1;
+    shm_destroy(srv);
+    shm_destroy(cli);
+    close(efds[0]);
+    close(efds[1]);
+}
+
+static void test_round_trip() {
+    shm_conn_t srv, cli;
+    char big[CAP];
+
+    pair(&srv, &cli);
+    CHECK(shm_produce(&cli, "hello", 5) == 5);
+    CHECK(shm_ring_used(&srv.rx) == 5);
+    CHECK(memcmp(shm_ring_read_ptr(&srv.rx), "hello", 5) == 0);
+    shm_consume(&srv, 5);
+    CHECK(shm_ring_space(&cli.tx) == CAP);
+
+    // a full ring takes what fits, and wraps
+    memset(big, 'z', sizeof(big));
+    CHECK(shm_produce(&cli, big, sizeof(big)) == CAP);
+    CHECK(shm_produce(&cli, big, 1) == 0);
+    shm_consume(&srv, 100);
+    CHECK(shm_produce(&cli, "wrap", 4) == 4);
+    CHECK(shm_ring_used(&srv.rx) == CAP - 100 + 4);
+    CHECK(memcmp(shm_ring_read_ptr(&srv.rx) + CAP - 100, "wrap", 4) == 0);
+    unpair(&srv, &cli);
+}
+
+// 9a295e0: a tail more than the ring size ahead, or one that went backwards, is refused
+static void test_bad_tail_is_refused() {
+    shm_conn_t srv, cli;
+
+    pair(&srv, &cli);
+    CHECK(shm_produce(&cli, "0123456789", 10) == 10);
+    CHECK(shm_ring_used(&srv.rx) == 10);
+    srv.rx.ctl->tail = srv.rx.own + CAP + 1;
+    CHECK(shm_ring_used(&srv.rx) == -1);
+    srv.rx.ctl->tail = 5;
+    CHECK(shm_ring_used(&srv.rx) == -1);
+    // the consumer's position is its own, whatever the page says
+    srv.rx.ctl->tail = 10;
+    srv.rx.ctl->head = 1000;
+    shm_consume(&srv, 4);
+    CHECK(srv.rx.own == 4 && srv.rx.ctl->head == 4);
+    CHECK(shm_ring_used(&srv.rx) == 6);
+    unpair(&srv, &cli);
+}
+
+// 9a295e0: a head past the producer's tail, or one that went backwards, is refused too
+static void test_bad_head_is_refused() {
+    shm_conn_t srv, cli;
+
+    pair(&srv, &cli);
+    CHECK(shm_produce(&srv, "0123456789", 10) == 10);
+    shm_consume(&cli, 6);
+    CHECK(shm_ring_space(&srv.tx) == CAP - 4);
+    srv.tx.ctl->head = 11;
+    CHECK(shm_ring_space(&srv.tx) == -1);
+    CHECK(shm_produce(&srv, "x", 1) == -1);
+    srv.tx.ctl->head = 2;
+    CHECK(shm_ring_space(&srv.tx) == -1);
+    unpair(&srv, &cli);
+}
+
+// 9a295e0: the server drops a client that broke its ring
+static void test_reactor_closes_broken_ring() {
+    static reactor_t r;
+    shm_conn_t* srv = malloc(sizeof(shm_conn_t));
+    shm_conn_t cli;
+
+    memset(&r, 0, sizeof(r));
+    CHECK(init_clients(&r, 4) == 0);
+    pair(srv, &cli);
+    int efds[2]            = { srv->my_efd, cli.my_efd };
+    r.clients[0].fd        = srv->my_efd;
+    r.clients[0].shm       = srv;
+    r.clients[0].state     = STATE_CONNECTED;
+    r.fd_slot[srv->my_efd] = 0;
+
+    char hdr[PROTO_HDR_SIZE];
+    proto_encode_hdr(hdr, PROTO_HELLO, 0);
+    frames_seen = 0;
+    CHECK(shm_produce(&cli, hdr, sizeof(hdr)) == sizeof(hdr));
+    CHECK(reactor_on_readable(&r, 0) == 0 && frames_seen == 1);
+    srv->rx.ctl->tail = srv->rx.own + CAP + 1;
+    errno             = 0;
+    CHECK(reactor_on_readable(&r, 0) == -1 && errno == EPROTO);
+
+    srv->my_efd = srv->peer_efd = cli.my_efd = cli.peer_efd = -1;
+    r.clients[0].fd = -1;
+    shm_destroy(srv);
+    shm_destroy(&cli);
+    free(srv);
+    close(efds[0]);
+    close(efds[1]);
+    free(r.clients);
+    free(r.free_slots);
+    free(r.fd_slot);
+    free(r.dirty);
+    close(r.spare_fd);
+}
+
+static int mappings() {
+    int n   = 0;
+    FILE* f = fopen("/proc/self/maps", "r");
+    int c;
+
+    while (f != NULL && (c = fgetc(f)) != EOF) {
+        n += c == '\n';
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    return n;
+}
+
+// user-062: when the second ring cannot be mapped, the first one and the control page are
+// unmapped again
+static void test_map_unwinds() {
+    size_t cap = 64 * 1024 * 1024;
+    int memfd  = memfd_create("test-shm", MFD_CLOEXEC);
+    shm_conn_t c;
+
+    CHECK(memfd != -1 && ftruncate(memfd, (off_t)(SHM_PAGE + 2 * cap)) == 0);
+    memset(&c, 0, sizeof(c));
+    int maps = mappings();
+    test_limit_memory(SHM_PAGE + 2 * cap + 1024 * 1024); // room for one ring, not two
+    int rc = shm_map(&c, memfd, cap, 1);
+    test_unlimit_memory();
+    CHECK(rc == -1);
+    CHECK(c.ctl == NULL && c.rx.data == NULL && c.tx.data == NULL);
+    CHECK(mappings() == maps);
+    close(memfd);
+}
+
+int main() {
+    RUN(test_round_trip);
+    RUN(test_bad_tail_is_refused);
+    RUN(test_bad_head_is_refused);
+    RUN(test_reactor_closes_broken_ring);
+    RUN(test_map_unwinds);
+    return test_done("shm");
+}
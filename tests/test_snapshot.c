@@ -0,0 +1,108 @@
+// snapshot.h: a written snapshot maps back into an equal store, and a damaged one is refused.
+
+#include "test.h"
+#include "hooks.h"
+#include "wal.h"
+#include "snapshot.h"
+
+static void make_store(kv_t* kv, int n) {
+    char key[16], val[64];
+
+    CHECK(kv_init(kv, 0) == 0);
+    for (int i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "k%d", i);
+        snprintf(val, sizeof(val), "value of key %d", i);
+        CHECK(kv_set(kv, key, strlen(key), val, strlen(val)) == 0);
+    }
+    CHECK(kv_del(kv, "k0", 2) == 1); // a tombstone, not written out
+}
+
+static void test_load_matches_written() {
+    char dir[64], path[96], key[16], val[64];
+    kv_t kv, loaded;
+
+    test_dir(dir);
+    snprintf(path, sizeof(path), "%s/snap", dir);
+    make_store(&kv, 500);
+    CHECK(snap_write(&kv, path) == 0);
+    memset(&loaded, 0, sizeof(loaded));
+    CHECK(snap_load(&loaded, path) == 0);
+    CHECK(loaded.count == 499);
+    CHECK(loaded.map != NULL);
+    CHECK(kv_get(&loaded, "k0", 2) == NULL);
+    for (int i = 1; i < 500; i++) {
+        snprintf(key, sizeof(key), "k%d", i);
+        snprintf(val, sizeof(val), "value of key %d", i);
+        const kv_rec_t* rec = kv_get(&loaded, key, strlen(key));
+        CHECK(rec != NULL && rec->vlen == strlen(val) && memcmp(kv_value(rec), val, rec->vlen) == 0);
+    }
+    // records in the mapping are replaced, never written to
+    CHECK(kv_set(&loaded, "k1", 2, "new", 3) == 0);
+    CHECK(kv_get(&loaded, "k1", 2)->vlen == 3);
+    kv_destroy(&kv);
+    kv_destroy(&loaded);
+    unlink(path);
+    rmdir(dir);
+}
+
+static void test_missing_is_empty() {
+    kv_t kv;
+
+    memset(&kv, 0, sizeof(kv));
+    CHECK(snap_load(&kv, "/tmp/reactor-test-no-such-snapshot") == 0);
+    CHECK(kv.slots == NULL);
+}
+
+static void test_damaged_is_refused() {
+    char dir[64], path[96];
+    kv_t kv, loaded;
+
+    test_dir(dir);
+    snprintf(path, sizeof(path), "%s/snap", dir);
+    make_store(&kv, 50);
+    CHECK(snap_write(&kv, path) == 0);
+
+    struct stat st;
+    CHECK(stat(path, &st) == 0);
+    CHECK(truncate(path, st.st_size - 8) == 0);
+    memset(&loaded, 0, sizeof(loaded));
+    CHECK(snap_load(&loaded, path) == -1);
+
+    CHECK(snap_write(&kv, path) == 0);
+    int fd = open(path, O_WRONLY);
+    CHECK(pwrite(fd, "KVSNAP99", 8, 0) == 8);
+    close(fd);
+    memset(&loaded, 0, sizeof(loaded));
+    CHECK(snap_load(&loaded, path) == -1);
+    kv_destroy(&kv);
+    unlink(path);
+    rmdir(dir);
+}
+
+// user-073: a failed snapshot holds the next automatic one back for SNAP_RETRY_SECS of the
+// loop's clock
+static void test_retry_waits_on_loop_clock() {
+    static reactor_t r;
+    snap_t s = { 0 };
+    wal_t w  = { 0 };
+
+    memset(&r, 0, sizeof(r));
+    s.auto_bytes  = 1;
+    w.end         = 100;
+    s.started_ns  = 4900000000ull;
+    clk_local.now = 5000000000ull;
+    snap_reaped(&s, &r, 1 << 8); // exit status 1
+    CHECK(s.failed_ns == 5000000000ull);
+    clk_local.now += SNAP_RETRY_SECS * 1000000000ull - 1;
+    CHECK(snap_on_iteration(&s, NULL, &w, &r) == -1);
+    CHECK(s.pid == 0 && r.stats.snapshots == 0);
+    clk_local.now = 0;
+}
+
+int main() {
+    RUN(test_load_matches_written);
+    RUN(test_missing_is_empty);
+    RUN(test_damaged_is_refused);
+    RUN(test_retry_waits_on_loop_clock);
+    return test_done("snapshot");
+}
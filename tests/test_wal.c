@@ -0,0 +1,117 @@
+// wal.h: what a commit writes comes back on replay, and a torn or garbled tail is cut off.
+
+#include "test.h"
+#include "hooks.h"
+#include "wal.h"
+
+static size_t set_payload(char* p, const char* key, const char* val) {
+    uint16_t klen = htons((uint16_t)strlen(key));
+
+    memcpy(p, &klen, sizeof(klen));
+    memcpy(p + sizeof(klen), key, strlen(key));
+    memcpy(p + sizeof(klen) + strlen(key), val, strlen(val));
+    return sizeof(klen) + strlen(key) + strlen(val);
+}
+
+// Appends and commits one SET per key, and a DEL of the last one when del is set.
+static void write_log(const char* path, int n, int del) {
+    static reactor_t r;
+    kv_t kv;
+    wal_t w;
+    char buf[64], key[16];
+
+    CHECK(kv_init(&kv, 0) == 0);
+    CHECK(wal_open(&w, path, &kv, 0) == 0);
+    for (int i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        proto_frame_t f = { PROTO_SET, set_payload(buf, key, "value"), buf };
+        CHECK(wal_append(&w, &f) == 0);
+    }
+    if (del) {
+        proto_frame_t f = { PROTO_DEL, strlen(key), key };
+        CHECK(wal_append(&w, &f) == 0);
+    }
+    wal_commit(&w, &r);
+    wal_close(&w);
+    kv_destroy(&kv);
+}
+
+static off_t file_size(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+static void test_replay_restores_store() {
+    char dir[64], path[96];
+    kv_t kv;
+    wal_t w;
+
+    test_dir(dir);
+    snprintf(path, sizeof(path), "%s/log", dir);
+    write_log(path, 10, 1);
+    CHECK(kv_init(&kv, 0) == 0);
+    CHECK(wal_open(&w, path, &kv, 0) == 0);
+    CHECK(kv.count == 9);
+    const kv_rec_t* rec = kv_get(&kv, "key3", 4);
+    CHECK(rec != NULL && rec->vlen == 5 && memcmp(kv_value(rec), "value", 5) == 0);
+    CHECK(kv_get(&kv, "key9", 4) == NULL);
+    CHECK(w.end == file_size(path));
+    wal_close(&w);
+    kv_destroy(&kv);
+    unlink(path);
+    rmdir(dir);
+}
+
+// a record cut short by a crash is dropped, and the file shrinks back to the last good one
+static void test_torn_tail_is_cut() {
+    char dir[64], path[96];
+    kv_t kv;
+    wal_t w;
+
+    test_dir(dir);
+    snprintf(path, sizeof(path), "%s/log", dir);
+    write_log(path, 4, 0);
+    off_t good = file_size(path);
+    CHECK(truncate(path, good - 3) == 0);
+    CHECK(kv_init(&kv, 0) == 0);
+    CHECK(wal_open(&w, path, &kv, 0) == 0);
+    CHECK(kv.count == 3);
+    CHECK(w.end < good - 3 && file_size(path) == w.end);
+    wal_close(&w);
+    kv_destroy(&kv);
+    unlink(path);
+    rmdir(dir);
+}
+
+// a flipped byte fails the record's CRC: replay stops there, later records included
+static void test_corrupt_record_ends_replay() {
+    char dir[64], path[96];
+    kv_t kv;
+    wal_t w;
+
+    test_dir(dir);
+    snprintf(path, sizeof(path), "%s/log", dir);
+    write_log(path, 4, 0);
+    off_t rec = file_size(path) / 4; // records are the same size
+    int fd    = open(path, O_RDWR);
+    char c;
+    CHECK(pread(fd, &c, 1, rec + rec - 1) == 1);
+    c ^= 0x55;
+    CHECK(pwrite(fd, &c, 1, rec + rec - 1) == 1);
+    close(fd);
+    CHECK(kv_init(&kv, 0) == 0);
+    CHECK(wal_open(&w, path, &kv, 0) == 0);
+    CHECK(kv.count == 1);
+    CHECK(w.end == rec);
+    wal_close(&w);
+    kv_destroy(&kv);
+    unlink(path);
+    rmdir(dir);
+}
+
+int main() {
+    RUN(test_replay_restores_store);
+    RUN(test_torn_tail_is_cut);
+    RUN(test_corrupt_record_ends_replay);
+    return test_done("wal");
+}
@@ -0,0 +1,123 @@
+#ifndef TLS_H
+#define TLS_H
+
+// TLS with the record layer in the kernel (kTLS). Included by reactor.h once the connection
+// types exist.
+//
+// OpenSSL only runs the handshake. Once it is done OpenSSL installs the session keys on the
+// socket (TLS_TX / TLS_RX), and from then on the kernel encrypts whatever write()/writev()/
+// sendfile() put on the socket and decrypts what read() takes off it. The SSL object is freed
+// right away and the connection goes through exactly the same ring buffer, frame parser and
+// output queue as a plaintext one.
+//
+// Build with -DREACTOR_TLS and link -lssl -lcrypto. Needs Linux with the tls module loaded
+// (`tls` listed in /proc/sys/net/ipv4/tcp_available_ulp) and an OpenSSL built with kTLS.
+// A connection that cannot be moved to kTLS is closed instead of falling back to user-space
+// TLS, which would put two copies back on every byte.
+
+#ifdef REACTOR_TLS
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+static inline void* tls_server_ctx(const char* cert_file, const char* key_file) {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if (ctx == NULL) {
+        return NULL;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    // only ciphers the kernel can take over
+    SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384");
+    SSL_CTX_set_cipher_list(ctx, "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:"
+                                 "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384");
+    // TLS 1.3 session tickets would be post-handshake messages nobody is left to send
+    SSL_CTX_set_num_tickets(ctx, 0);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) != 1) {
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+static inline int tls_begin(reactor_t* r, clientstate_t* c) {
+    SSL* ssl = SSL_new(r->tls_ctx);
+    if (ssl == NULL || SSL_set_fd(ssl, c->fd) != 1) {
+        SSL_free(ssl);
+        return -1;
+    }
+    c->tls      = ssl;
+    c->tls_want = EV_READ;
+    c->state    = STATE_HANDSHAKE;
+    return 0;
+}
+
+static inline void tls_free(clientstate_t* c) {
+    SSL_free(c->tls);
+    c->tls = NULL;
+}
+
+// Advances the handshake. Returns -1 to close the connection.
+static inline int tls_handshake(reactor_t* r, clientstate_t* c) {
+    SSL* ssl = c->tls;
+    int rc   = SSL_accept(ssl);
+
+    if (rc != 1) {
+        switch (SSL_get_error(ssl, rc)) {
+        case SSL_ERROR_WANT_READ:
+            c->tls_want = EV_READ;
+            return 0;
+        case SSL_ERROR_WANT_WRITE:
+            c->tls_want = EV_WRITE;
+            return 0;
+        default:
+            if (r->verbose) {
+                ERR_print_errors_fp(stderr);
+            }
+            return -1;
+        }
+    }
+
+    if (!BIO_get_ktls_send(SSL_get_wbio(ssl)) || !BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+        fprintf(stderr, "fd %d: handshake done but kTLS could not be enabled (%s), closing\n",
+            c->fd,
+            SSL_get_cipher_name(ssl));
+        return -1;
+    }
+    if (SSL_has_pending(ssl)) {
+        // application data OpenSSL already pulled off the socket would be lost to the kernel
+        fprintf(stderr, "fd %d: data buffered in OpenSSL at kTLS switch-over, closing\n", c->fd);
+        return -1;
+    }
+
+    // the kernel owns the record layer from here on; SSL_free leaves the fd open
+    tls_free(c);
+    c->state = STATE_CONNECTED;
+    r->stats.tls_handshakes++;
+    return 0;
+}
+
+#else
+
+static inline int tls_begin(reactor_t* r, clientstate_t* c) {
+    (void)r;
+    (void)c;
+    return -1;
+}
+
+static inline void tls_free(clientstate_t* c) {
+    c->tls = NULL;
+}
+
+static inline int tls_handshake(reactor_t* r, clientstate_t* c) {
+    (void)r;
+    (void)c;
+    return -1;
+}
+
+#endif
+
+#endif
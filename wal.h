@@ -0,0 +1,358 @@
+#ifndef WAL_H
+#define WAL_H
+
+// Append-only persistence log for the store (kv.h), with group commit.
+//
+// A mutating frame is applied to the store straight away and copied into the log's staging
+// blocks; nothing is written per request. Once per group-commit window everything staged goes
+// to the end of the file in one pwritev() and a single fdatasync() makes it durable, and only
+// then are the replies released: every connection that was answered while records were
+// staged is gated (reactor_gate) until the commit covering them. That includes reads, so no
+// client ever sees a value that could still be lost. A wider window puts more records behind
+// each sync, at the price of that much more latency.
+//
+// wal_open replays the file into the store. A record cut short or garbled by a crash in the
+// middle of a commit ends the replay and is cut off; its client never got an answer.
+//
+// Record: CRC-32 of the frame (network order), then the frame exactly as it was received.
+//
+// Included by the program after reactor.h.
+
+#include <stdint.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "kv.h"
+
+#define WAL_BLOCK_SIZE (64 * 1024)
+#define WAL_MAX_BATCH (4 * 1024 * 1024) // staged bytes that force a commit before the window is up
+#define WAL_REC_HDR 4
+
+typedef struct {
+    int fd;
+    off_t end;      // where the next commit writes
+    long window_us; // group-commit window, 0 commits at the end of every loop iteration
+    // staged records, filling blocks[0 .. n_blocks); blocks stay allocated between commits
+    char** blocks;
+    int n_blocks;
+    int blocks_cap;
+    size_t staged;
+    size_t tail_len; // bytes used in the last staged block
+    unsigned long long staged_records;
+    uint64_t first_staged_ns;
+    // connections gated until the next commit
+    int* waiting;
+    int n_waiting;
+    int waiting_cap;
+} wal_t;
+
+// zlib's crc32(): chaining wal_crc32(wal_crc32(0, a), b) gives the CRC of a followed by b
+static inline uint32_t wal_crc32(uint32_t crc, const void* p, size_t n) {
+    static uint32_t table[256];
+    const unsigned char* b = p;
+
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c >> 1) ^ (c & 1 ? 0xedb88320u : 0);
+            }
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) {
+        crc = table[(crc ^ b[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static inline int wal_stage(wal_t* w, const void* data, size_t len) {
+    const char* p = data;
+
+    while (len > 0) {
+        if (w->n_blocks == 0 || w->tail_len == WAL_BLOCK_SIZE) {
+            if (w->n_blocks == w->blocks_cap) {
+                int cap      = w->blocks_cap ? w->blocks_cap * 2 : 16;
+                char** grown = realloc(w->blocks, (size_t)cap * sizeof(char*));
+                if (grown == NULL) {
+                    return -1;
+                }
+                memset(grown + w->blocks_cap, 0, (size_t)(cap - w->blocks_cap) * sizeof(char*));
+                w->blocks     = grown;
+                w->blocks_cap = cap;
+            }
+            if (w->blocks[w->n_blocks] == NULL && (w->blocks[w->n_blocks] = malloc(WAL_BLOCK_SIZE)) == NULL) {
+                return -1;
+            }
+            w->n_blocks++;
+            w->tail_len = 0;
+        }
+        size_t n = WAL_BLOCK_SIZE - w->tail_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(w->blocks[w->n_blocks - 1] + w->tail_len, p, n);
+        w->tail_len += n;
+        w->staged += n;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Stages one frame. Returns -1 when out of memory; a partly staged record is taken back.
+static inline int wal_append(wal_t* w, const proto_frame_t* f) {
+    char hdr[WAL_REC_HDR + PROTO_HDR_SIZE];
+    size_t staged = w->staged;
+    int n_blocks  = w->n_blocks;
+    size_t tail   = w->tail_len;
+
+    proto_encode_hdr(hdr + WAL_REC_HDR, f->type, f->len);
+    uint32_t crc = wal_crc32(0, hdr + WAL_REC_HDR, PROTO_HDR_SIZE);
+    crc          = htonl(wal_crc32(crc, f->payload, f->len));
+    memcpy(hdr, &crc, sizeof(crc));
+    if (wal_stage(w, hdr, sizeof(hdr)) == -1 || wal_stage(w, f->payload, f->len) == -1) {
+        w->staged   = staged;
+        w->n_blocks = n_blocks;
+        w->tail_len = tail;
+        return -1;
+    }
+    if (w->staged_records++ == 0) {
+        w->first_staged_ns = clk_now();
+    }
+    return 0;
+}
+
+static inline int wal_pending(const wal_t* w) {
+    return w->staged > 0;
+}
+
+// Puts an already gated slot on the list the next commit releases.
+static inline int wal_hold(wal_t* w, int slot) {
+    if (w->n_waiting == w->waiting_cap) {
+        int cap    = w->waiting_cap ? w->waiting_cap * 2 : 256;
+        int* grown = realloc(w->waiting, (size_t)cap * sizeof(int));
+        if (grown == NULL) {
+            return -1;
+        }
+        w->waiting     = grown;
+        w->waiting_cap = cap;
+    }
+    w->waiting[w->n_waiting++] = slot;
+    return 0;
+}
+
+// Holds the replies queued for slot from now on back until the next commit. Only needed
+// while something is staged: with nothing pending every reply is already durable.
+static inline int wal_wait(wal_t* w, reactor_t* r, int slot) {
+    if (!wal_pending(w) || !reactor_gate(r, slot)) {
+        return 0;
+    }
+    return wal_hold(w, slot);
+}
+
+// Writes everything staged at the end of the file and syncs it, then releases the replies
+// waiting for it. A gated slot may have been closed and reused since; if the new connection
+// is gated, that too happened before this commit, so releasing it is right.
+static inline void wal_commit(wal_t* w, reactor_t* r) {
+    struct iovec iov[64];
+    size_t done = 0;
+
+    while (done < w->staged) {
+        int n      = 0;
+        size_t off = done;
+        for (int b = (int)(done / WAL_BLOCK_SIZE); b < w->n_blocks && n < 64; b++) {
+            size_t len      = b == w->n_blocks - 1 ? w->tail_len : WAL_BLOCK_SIZE;
+            size_t skip     = off - (size_t)b * WAL_BLOCK_SIZE;
+            iov[n].iov_base = w->blocks[b] + skip;
+            iov[n].iov_len  = len - skip;
+            off += iov[n].iov_len;
+            n++;
+        }
+        ssize_t k = pwritev(w->fd, iov, n, w->end + (off_t)done);
+        if (k == -1 && errno == EINTR) {
+            continue;
+        }
+        // the store has applied these already and the clients are waiting on them; with the
+        // log unable to take them the only honest way out is to stop, and replay what made it
+        if (k <= 0) {
+            perror("log pwritev");
+            exit(EXIT_FAILURE);
+        }
+        done += (size_t)k;
+    }
+    // after a failed sync the kernel may have dropped the dirty pages, retrying proves nothing
+    if (fdatasync(w->fd) == -1) {
+        perror("log fdatasync");
+        exit(EXIT_FAILURE);
+    }
+    r->stats.log_records += w->staged_records;
+    r->stats.log_bytes += w->staged;
+    r->stats.log_commits++;
+    w->end += (off_t)w->staged;
+    w->staged         = 0;
+    w->staged_records = 0;
+    w->n_blocks       = 0;
+    w->tail_len       = 0;
+
+    for (int i = 0; i < w->n_waiting; i++) {
+        reactor_ungate(r, w->waiting[i]);
+    }
+    w->n_waiting = 0;
+}
+
+// For reactor_on_iteration: commits once the oldest staged record has waited out the window
+// (or too much is staged), and otherwise says how long the loop may sleep before it has to.
+static inline int wal_on_iteration(wal_t* w, reactor_t* r) {
+    if (!wal_pending(w)) {
+        return -1;
+    }
+    uint64_t waited_us = (clk_now() - w->first_staged_ns) / 1000;
+    if (waited_us >= (uint64_t)w->window_us || w->staged >= WAL_MAX_BATCH) {
+        wal_commit(w, r);
+        return -1;
+    }
+    // waits are in whole milliseconds: round up, waking early only means coming back here
+    return (int)(((uint64_t)w->window_us - waited_us + 999) / 1000);
+}
+
+// A new file's directory entry needs a sync of its own before the first commit counts.
+static inline int wal_sync_dir(const char* path) {
+    char dir[PATH_MAX];
+    const char* slash = strrchr(path, '/');
+
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+    }
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+// Replays the records in fd into kv, stopping at the first incomplete or corrupt one.
+// *good is set to the end of the last good record. Returns -1 on error.
+static inline int wal_replay(int fd, const char* path, kv_t* kv, off_t* good) {
+    struct stat st;
+
+    *good = 0;
+    if (fstat(fd, &st) == -1) {
+        perror(path);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        return 0;
+    }
+    char* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap log");
+        return -1;
+    }
+
+    size_t size                = (size_t)st.st_size;
+    size_t off                 = 0;
+    unsigned long long records = 0;
+    while (off + WAL_REC_HDR < size) {
+        proto_frame_t f;
+        uint32_t crc;
+        size_t n = proto_parse(map + off + WAL_REC_HDR, size - off - WAL_REC_HDR, &f);
+        if (n == 0) {
+            break;
+        }
+        memcpy(&crc, map + off, sizeof(crc));
+        if (ntohl(crc) != wal_crc32(0, map + off + WAL_REC_HDR, n) || !kv_is_mutation(f.type)) {
+            break;
+        }
+        if (kv_apply(kv, &f) == -1) {
+            fprintf(stderr, "%s: record at offset %zu cannot be applied\n", path, off);
+            munmap(map, size);
+            return -1;
+        }
+        off += WAL_REC_HDR + n;
+        records++;
+    }
+    munmap(map, size);
+    if (off < size) {
+        fprintf(stderr, "%s: %zu bytes of incomplete or corrupt tail at offset %zu\n", path, size - off, off);
+    }
+    *good = (off_t)off;
+    printf("log %s: replayed %llu records, %zu keys\n", path, records, kv->count);
+    return 0;
+}
+
+// Opens (or creates) the log at path and replays it into kv. A torn tail is cut off, the
+// next commit goes where it started. Returns -1 on error.
+static inline int wal_open(wal_t* w, const char* path, kv_t* kv, long window_us) {
+    struct stat st;
+
+    memset(w, 0, sizeof(*w));
+    w->window_us = window_us;
+    w->fd        = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (w->fd == -1 || fstat(w->fd, &st) == -1) {
+        perror(path);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        if (wal_sync_dir(path) == -1) {
+            perror("sync log directory");
+            return -1;
+        }
+        return 0;
+    }
+    if (wal_replay(w->fd, path, kv, &w->end) == -1) {
+        return -1;
+    }
+    if (w->end < st.st_size && (ftruncate(w->fd, w->end) == -1 || fdatasync(w->fd) == -1)) {
+        perror("truncate log");
+        return -1;
+    }
+    return 0;
+}
+
+// Moves the log to prev_path and carries on in a fresh file at path. Everything staged is
+// committed first, so prev_path ends exactly where the new file begins. Returns -1 with the
+// old log still in use.
+static inline int wal_rotate(wal_t* w, reactor_t* r, const char* path, const char* prev_path) {
+    if (wal_pending(w)) {
+        wal_commit(w, r);
+    }
+    if (rename(path, prev_path) == -1) {
+        perror("rename log");
+        return -1;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 || wal_sync_dir(path) == -1) {
+        // put the old one back, nothing was written to either
+        perror("new log");
+        if (fd != -1) {
+            close(fd);
+        }
+        rename(prev_path, path);
+        return -1;
+    }
+    close(w->fd);
+    w->fd  = fd;
+    w->end = 0;
+    return 0;
+}
+
+static inline void wal_close(wal_t* w) {
+    if (w->fd == -1) {
+        return;
+    }
+    for (int i = 0; i < w->blocks_cap; i++) {
+        free(w->blocks[i]);
+    }
+    free(w->blocks);
+    free(w->waiting);
+    close(w->fd);
+}
+
+#endif